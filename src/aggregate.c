@@ -0,0 +1,290 @@
+/* aggregate.c -- per-station statistics over decoded observations
+   Copyright 2016 Andrew Walton <dwalton64@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "aggregate.h"
+
+extern int verbose;
+
+/* open addressing hash table of partial aggregates, keyed by station and bucket */
+typedef struct {
+	agg_t  *slots;
+	char   *used;
+	size_t  size;    // always a power of two
+	size_t  count;
+} agg_table_t;
+
+/* work for one thread: a slice of the input and the table it reduces into */
+typedef struct {
+	const obs_record_t *recs;
+	size_t count;
+	int64_t bucket_seconds;
+	agg_table_t table;
+	int started;     // running on its own thread
+	int failed;
+} agg_work_t;
+
+
+/* PUBLIC--
+ * Append a copy of rec to the array.
+ */
+int obs_array_add(obs_array_t *array, const obs_record_t *rec) {
+	obs_record_t *recs;
+
+	if (array->count == array->size) {
+		size_t size = array->size ? array->size * 2 : 1024;
+		recs = realloc(array->recs, size * sizeof(obs_record_t));
+		if (recs == NULL) {
+			fprintf(stderr, "Out of memory collecting observations\n");
+			return 1;
+		}
+		array->recs = recs;
+		array->size = size;
+	}
+	array->recs[array->count++] = *rec;
+	return 0;
+}
+
+/* PUBLIC--
+ * Free the observations in the array.
+ */
+void obs_array_free(obs_array_t *array) {
+	free(array->recs);
+	memset(array, 0x0, sizeof(obs_array_t));
+}
+
+
+static uint64_t agg_hash(station_id_t station, int64_t bucket) {
+	uint64_t h = ((uint64_t) station_hash(station) << 32) ^ (uint64_t) bucket;
+
+	h *= 0x9e3779b97f4a7c15ULL;
+	return h ^ (h >> 29);
+}
+
+static int table_init(agg_table_t *table, size_t size) {
+	table->slots = malloc(size * sizeof(agg_t));
+	table->used = calloc(size, 1);
+	table->size = size;
+	table->count = 0;
+	return (table->slots == NULL || table->used == NULL) ? 1 : 0;
+}
+
+static void table_free(agg_table_t *table) {
+	free(table->slots);
+	free(table->used);
+}
+
+/* return the aggregate for station and bucket, adding an empty one if needed */
+static agg_t *table_get(agg_table_t *table, station_id_t station, int64_t bucket) {
+	size_t i;
+	agg_t *agg;
+
+	if ((table->count + 1) * 4 > table->size * 3) {
+		/* grow at 75% load */
+		agg_table_t bigger;
+		if (table_init(&bigger, table->size * 2)) {
+			table_free(&bigger);
+			return NULL;
+		}
+		for (i = 0; i < table->size; i++) {
+			if (table->used[i]) {
+				agg = table_get(&bigger, table->slots[i].station, table->slots[i].bucket);
+				*agg = table->slots[i];
+			}
+		}
+		table_free(table);
+		*table = bigger;
+	}
+
+	i = agg_hash(station, bucket) & (table->size - 1);
+	while (table->used[i]) {
+		agg = &table->slots[i];
+		if (agg->bucket == bucket && agg->station == station)
+			return agg;
+		i = (i + 1) & (table->size - 1);
+	}
+
+	table->used[i] = 1;
+	table->count++;
+	agg = &table->slots[i];
+	memset(agg, 0x0, sizeof(agg_t));
+	agg->station = station;
+	agg->bucket = bucket;
+	return agg;
+}
+
+
+/* PUBLIC--
+ * Combine the partial aggregate src into dst.
+ */
+void agg_merge(agg_t *dst, const agg_t *src) {
+	if (src->count == 0)
+		return;
+	if (dst->count == 0) {
+		*dst = *src;
+		return;
+	}
+	dst->count += src->count;
+	if (src->temp_count > 0) {
+		if (dst->temp_count == 0 || src->temp_min < dst->temp_min) dst->temp_min = src->temp_min;
+		if (dst->temp_count == 0 || src->temp_max > dst->temp_max) dst->temp_max = src->temp_max;
+		dst->temp_count += src->temp_count;
+		dst->temp_sum += src->temp_sum;
+	}
+	if (src->wind_max > dst->wind_max) dst->wind_max = src->wind_max;
+	if (src->gust_max > dst->gust_max) dst->gust_max = src->gust_max;
+	dst->ifr_hours |= src->ifr_hours;
+}
+
+/* PUBLIC--
+ * Number of hours in the bucket with an IFR or LIFR observation.
+ */
+int agg_ifr_hours(const agg_t *agg) {
+	return __builtin_popcountll(agg->ifr_hours);
+}
+
+
+/* reduce one slice of the input to partial aggregates */
+static void *aggregate_slice(void *arg) {
+	agg_work_t *work = arg;
+	const obs_record_t *rec;
+	agg_t one, *agg;
+	size_t i;
+
+	if (work->failed)
+		return NULL;
+
+	for (i = 0; i < work->count; i++) {
+		rec = &work->recs[i];
+
+		memset(&one, 0x0, sizeof(agg_t));
+		one.bucket = rec->obs_time - (((rec->obs_time % work->bucket_seconds) + work->bucket_seconds) % work->bucket_seconds);
+		one.count = 1;
+		if (rec->flags & OBS_HAVE_TEMP) {
+			one.temp_count = 1;
+			one.temp_min = one.temp_max = rec->temp;
+			one.temp_sum = rec->temp;
+		}
+		one.wind_max = rec->windstr;
+		one.gust_max = rec->windgust;
+		if (rec->category >= FLIGHT_CATEGORY_IFR)
+			one.ifr_hours = 1ULL << ((rec->obs_time - one.bucket) / 3600);
+
+		agg = table_get(&work->table, rec->station, one.bucket);
+		if (agg == NULL) {
+			work->failed = 1;
+			break;
+		}
+		one.station = rec->station;
+		agg_merge(agg, &one);
+	}
+	return NULL;
+}
+
+static int compare_agg(const void *a, const void *b) {
+	const agg_t *x = a, *y = b;
+	if (x->station != y->station)
+		return x->station > y->station ? 1 : -1;
+	return (x->bucket > y->bucket) - (x->bucket < y->bucket);
+}
+
+
+/* PUBLIC--
+ * Aggregate the observations per station and per bucket, in parallel.
+ */
+long aggregate(const obs_array_t *obs, int bucket_hours, int nthreads, agg_t **result) {
+	agg_work_t *work;
+	pthread_t *threads;
+	agg_table_t merged;
+	agg_t *agg, *rows;
+	size_t chunk, i, j, n;
+	int t, failed = 0;
+
+	*result = NULL;
+	if (bucket_hours < 1 || bucket_hours > AGG_MAX_BUCKET_HOURS) {
+		fprintf(stderr, "Aggregation buckets must be 1 to %d hours\n", AGG_MAX_BUCKET_HOURS);
+		return -1;
+	}
+	if (nthreads < 1) nthreads = 1;
+	if ((size_t) nthreads > obs->count / 1024 + 1) nthreads = (int) (obs->count / 1024 + 1);
+
+	work = calloc((size_t) nthreads, sizeof(agg_work_t));
+	threads = calloc((size_t) nthreads, sizeof(pthread_t));
+	if (work == NULL || threads == NULL) {
+		free(work);
+		free(threads);
+		return -1;
+	}
+
+	/* every thread reduces a contiguous slice of the input */
+	chunk = (obs->count + (size_t) nthreads - 1) / (size_t) nthreads;
+	for (t = 0; t < nthreads; t++) {
+		work[t].recs = obs->recs + (size_t) t * chunk;
+		work[t].count = (size_t) t * chunk >= obs->count ? 0 :
+			(obs->count - (size_t) t * chunk < chunk ? obs->count - (size_t) t * chunk : chunk);
+		work[t].bucket_seconds = (int64_t) bucket_hours * 3600;
+		if (table_init(&work[t].table, 256))
+			work[t].failed = 1;
+	}
+	for (t = 1; t < nthreads; t++) {
+		if (pthread_create(&threads[t], NULL, aggregate_slice, &work[t]) == 0)
+			work[t].started = 1;
+		else
+			aggregate_slice(&work[t]);   // no more threads, do the work here
+	}
+	aggregate_slice(&work[0]);
+	for (t = 1; t < nthreads; t++)
+		if (work[t].started) pthread_join(threads[t], NULL);
+	if (verbose) printf("Aggregated %lu observations on %d threads\n", (unsigned long) obs->count, nthreads);
+
+	/* merge the partial aggregates of all threads */
+	merged = work[0].table;
+	failed = work[0].failed;
+	for (t = 1; t < nthreads; t++) {
+		failed |= work[t].failed;
+		for (i = 0; !failed && i < work[t].table.size; i++) {
+			if (!work[t].table.used[i]) continue;
+			agg = table_get(&merged, work[t].table.slots[i].station, work[t].table.slots[i].bucket);
+			if (agg == NULL) failed = 1;
+			else agg_merge(agg, &work[t].table.slots[i]);
+		}
+		table_free(&work[t].table);
+	}
+
+	n = 0;
+	rows = failed ? NULL : malloc((merged.count ? merged.count : 1) * sizeof(agg_t));
+	if (rows != NULL) {
+		for (i = 0, j = 0; i < merged.size; i++)
+			if (merged.used[i]) rows[j++] = merged.slots[i];
+		n = j;
+		qsort(rows, n, sizeof(agg_t), compare_agg);
+	}
+
+	table_free(&merged);
+	free(work);
+	free(threads);
+
+	if (rows == NULL) {
+		fprintf(stderr, "Out of memory aggregating observations\n");
+		return -1;
+	}
+	*result = rows;
+	return (long) n;
+}
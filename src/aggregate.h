@@ -0,0 +1,75 @@
+/* aggregate.h -- per-station statistics over decoded observations
+   Copyright 2016 Andrew Walton <dwalton64@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef Already_included_aggregate_h
+#define Already_included_aggregate_h 1
+
+#include <stdint.h>
+#include <stddef.h>
+#include "store.h"
+#include "station.h"
+
+/* the hours in which a bucket was at IFR or worse are kept as a bit mask,
+ * so a bucket can be at most 64 hours long.
+ */
+#define AGG_MAX_BUCKET_HOURS 64
+
+/* statistics of one station over one time bucket. Partial aggregates computed
+ * over different parts of the input are combined with agg_merge().
+ */
+typedef struct {
+	station_id_t station;
+	int64_t  bucket;        // start of the bucket, seconds since the epoch
+	int      count;         // number of observations
+	int      temp_count;    // number of observations with a temperature
+	int      temp_min;
+	int      temp_max;
+	long     temp_sum;
+	int      wind_max;      // knots
+	int      gust_max;      // knots
+	uint64_t ifr_hours;     // bit n is set if hour n of the bucket had an IFR or LIFR observation
+} agg_t;
+
+/* a growable array of observations to aggregate */
+typedef struct {
+	obs_record_t *recs;
+	size_t count;
+	size_t size;
+} obs_array_t;
+
+/* append a copy of rec to the array. Returns 0 for success, 1 if out of memory */
+int obs_array_add(obs_array_t *array, const obs_record_t *rec);
+
+/* free the observations in the array */
+void obs_array_free(obs_array_t *array);
+
+/* combine the partial aggregate src into dst (same station and bucket) */
+void agg_merge(agg_t *dst, const agg_t *src);
+
+/* number of hours in the bucket with an IFR or LIFR observation */
+int agg_ifr_hours(const agg_t *agg);
+
+/* Aggregate the observations per station and per bucket of bucket_hours hours.
+ * The input is split over nthreads threads which each reduce their part to
+ * partial aggregates; these are merged at the end. The result is sorted by
+ * station and time and must be released with free().
+ *
+ * Returns the number of aggregates in *result, or -1 for an error.
+ */
+long aggregate(const obs_array_t *obs, int bucket_hours, int nthreads, agg_t **result);
+
+#endif  /* End Include Guard - don't add code below */
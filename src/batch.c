@@ -0,0 +1,210 @@
+/* batch.c -- decoding many reports into columns
+   Copyright 2016 Andrew Walton <dwalton64@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "batch.h"
+
+
+/* resize a column to n entries of size bytes
+ * returns 0 for success, 1 if out of memory */
+static int resize(void *column, size_t size, size_t n) {
+	void **col = column;
+	void *p = realloc(*col, size * n);
+
+	if (p == NULL)
+		return 1;
+	*col = p;
+	return 0;
+}
+
+/* make room for capacity reports */
+static int reserve_reports(metar_batch_t *batch, size_t capacity) {
+	size_t n = batch->capacity ? batch->capacity : 64;
+
+	if (capacity <= batch->capacity)
+		return 0;
+	while (n < capacity)
+		n *= 2;
+	if (resize(&batch->station, sizeof(station_id_t), n) ||
+		resize(&batch->day, sizeof(int32_t), n) ||
+		resize(&batch->time, sizeof(int32_t), n) ||
+		resize(&batch->winddir, sizeof(int32_t), n) ||
+		resize(&batch->windstr, sizeof(int32_t), n) ||
+		resize(&batch->windgust, sizeof(int32_t), n) ||
+		resize(&batch->vis, sizeof(int32_t), n) ||
+		resize(&batch->visfrac, sizeof(int32_t), n) ||
+		resize(&batch->qnh, sizeof(int32_t), n) ||
+		resize(&batch->temp, sizeof(int32_t), n) ||
+		resize(&batch->dewp, sizeof(int32_t), n) ||
+		resize(&batch->ceiling, sizeof(int32_t), n) ||
+		resize(&batch->category, sizeof(uint8_t), n) ||
+		resize(&batch->flags, sizeof(uint8_t), n) ||
+		resize(&batch->cloud_offset, sizeof(uint32_t), n + 1) ||
+		resize(&batch->weather_offset, sizeof(uint32_t), n + 1))
+		return 1;
+	batch->capacity = n;
+	return 0;
+}
+
+static int reserve_clouds(metar_batch_t *batch, size_t capacity) {
+	size_t n = batch->cloud_capacity ? batch->cloud_capacity : 256;
+
+	if (capacity <= batch->cloud_capacity)
+		return 0;
+	while (n < capacity)
+		n *= 2;
+	if (resize(&batch->cloud_amount, sizeof(int8_t), n) ||
+		resize(&batch->cloud_modifier, sizeof(int8_t), n) ||
+		resize(&batch->cloud_altitude, sizeof(int32_t), n))
+		return 1;
+	batch->cloud_capacity = n;
+	return 0;
+}
+
+static int reserve_weather(metar_batch_t *batch, size_t capacity) {
+	size_t n = batch->weather_capacity ? batch->weather_capacity : 256;
+
+	if (capacity <= batch->weather_capacity)
+		return 0;
+	while (n < capacity)
+		n *= 2;
+	if (resize(&batch->weather_intensity, sizeof(int8_t), n) ||
+		resize(&batch->weather_codes, sizeof(uint32_t), n))
+		return 1;
+	batch->weather_capacity = n;
+	return 0;
+}
+
+/* append the cloud layers and weather groups of a report
+ * returns 0 for success, 1 if out of memory */
+static int append_groups(metar_batch_t *batch, const metar_t *metar) {
+	cloud_list_t *cloud;
+	phenomena_list_t *phenomenon;
+	size_t i;
+
+	for (cloud = metar->clouds; cloud != NULL; cloud = cloud->next) {
+		if (reserve_clouds(batch, batch->num_clouds + 1))
+			return 1;
+		i = batch->num_clouds++;
+		batch->cloud_amount[i] = (int8_t) cloud->cloud->amount_code;
+		batch->cloud_modifier[i] = (int8_t) cloud->cloud->modifier_code;
+		batch->cloud_altitude[i] = cloud->cloud->layer_altitude;
+	}
+	for (phenomenon = metar->phenomena; phenomenon != NULL; phenomenon = phenomenon->next) {
+		if (reserve_weather(batch, batch->num_weather + 1))
+			return 1;
+		i = batch->num_weather++;
+		batch->weather_intensity[i] = (int8_t) phenomenon->intensity;
+		batch->weather_codes[i] = phenomenon->codes;
+	}
+	return 0;
+}
+
+
+/* PUBLIC--
+ * Initialise an empty batch.
+ */
+void metar_batch_init(metar_batch_t *batch) {
+	memset(batch, 0, sizeof(metar_batch_t));
+}
+
+/* PUBLIC--
+ * Empty a batch.
+ */
+void metar_batch_clear(metar_batch_t *batch) {
+	batch->count = 0;
+	batch->num_clouds = 0;
+	batch->num_weather = 0;
+}
+
+/* PUBLIC--
+ * Free the columns of a batch.
+ */
+void metar_batch_free(metar_batch_t *batch) {
+	free(batch->station);
+	free(batch->day);
+	free(batch->time);
+	free(batch->winddir);
+	free(batch->windstr);
+	free(batch->windgust);
+	free(batch->vis);
+	free(batch->visfrac);
+	free(batch->qnh);
+	free(batch->temp);
+	free(batch->dewp);
+	free(batch->ceiling);
+	free(batch->category);
+	free(batch->flags);
+	free(batch->cloud_offset);
+	free(batch->cloud_amount);
+	free(batch->cloud_modifier);
+	free(batch->cloud_altitude);
+	free(batch->weather_offset);
+	free(batch->weather_intensity);
+	free(batch->weather_codes);
+	metar_batch_init(batch);
+}
+
+/* PUBLIC--
+ * Decode reports into the columns of a batch.
+ */
+int parse_Metar_batch(const span_t *reports, size_t num_reports, metar_batch_t *batch) {
+	size_t count = batch->count, num_clouds = batch->num_clouds, num_weather = batch->num_weather;
+	size_t i, j;
+	metar_t metar;
+
+	/* every column is resized once for the whole batch */
+	if (reserve_reports(batch, count + num_reports))
+		return 1;
+	batch->cloud_offset[count] = (uint32_t) num_clouds;
+	batch->weather_offset[count] = (uint32_t) num_weather;
+
+	for (i = 0; i < num_reports; i++) {
+		j = count + i;
+		parse_Metar_n(reports[i].ptr, reports[i].len, &metar);
+
+		batch->station[j] = metar.station;
+		batch->day[j] = metar.day;
+		batch->time[j] = metar.time;
+		batch->winddir[j] = metar.winddir;
+		batch->windstr[j] = metar.windstr;
+		batch->windgust[j] = metar.windgust;
+		batch->vis[j] = metar.vis;
+		batch->visfrac[j] = metar.visfrac;
+		batch->qnh[j] = metar.qnh;
+		batch->temp[j] = metar.temp;
+		batch->dewp[j] = metar.dewp;
+		batch->ceiling[j] = metar.ceiling;
+		batch->category[j] = (uint8_t) metar.category;
+		batch->flags[j] = (strncmp(metar.visunit, "SM", 2) == 0 ? BATCH_VIS_SM : 0) |
+						  (metar.qnhunit[0] == '"' ? BATCH_QNH_INHG : 0) |
+						  (metar.maintenance_needed == MAINTENANCE_NEEDED ? BATCH_MAINTENANCE : 0);
+
+		if (append_groups(batch, &metar)) {
+			free_Metar(&metar);
+			batch->num_clouds = num_clouds;
+			batch->num_weather = num_weather;
+			return 1;
+		}
+		batch->cloud_offset[j + 1] = (uint32_t) batch->num_clouds;
+		batch->weather_offset[j + 1] = (uint32_t) batch->num_weather;
+		free_Metar(&metar);
+	}
+	batch->count = count + num_reports;
+	return 0;
+}
@@ -0,0 +1,88 @@
+/* batch.h -- decoding many reports into columns
+   Copyright 2016 Andrew Walton <dwalton64@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef Already_included_batch_h
+#define Already_included_batch_h 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include "metar.h"
+
+/* A batch holds decoded reports as a struct of arrays: every field is a
+ * column with one entry per report, so code working on one field (e.g. the
+ * temperatures of all reports) reads contiguous memory.
+ *
+ * A report has any number of cloud layers and weather groups. They are kept
+ * in flat columns of their own; those of report i are the entries from
+ * cloud_offset[i] up to cloud_offset[i + 1] (and likewise for weather), so
+ * the offset columns hold count + 1 entries.
+ */
+
+/* bits of the flags column */
+#define BATCH_VIS_SM       0x01   // vis is in statute miles, otherwise meters
+#define BATCH_QNH_INHG     0x02   // qnh is in hundredths of inches of mercury, otherwise hPa
+#define BATCH_MAINTENANCE  0x04   // the station reported that maintenance is needed
+
+typedef struct {
+	size_t count;             // reports in the batch
+	size_t capacity;          // reports the columns have room for
+
+	station_id_t *station;
+	int32_t *day;
+	int32_t *time;            // hhmm
+	int32_t *winddir;         // -1 signifies variable winds
+	int32_t *windstr;         // knots
+	int32_t *windgust;        // knots
+	int32_t *vis;
+	int32_t *visfrac;         // sixteenths of a statute mile
+	int32_t *qnh;
+	int32_t *temp;            // degrees Celsius
+	int32_t *dewp;
+	int32_t *ceiling;         // hundreds of feet, NO_CEILING if there is none
+	uint8_t *category;        // FLIGHT_CATEGORY_*
+	uint8_t *flags;           // BATCH_*
+
+	uint32_t *cloud_offset;
+	size_t num_clouds;
+	size_t cloud_capacity;
+	int8_t *cloud_amount;     // CLOUD_SKC to CLOUD_VV
+	int8_t *cloud_modifier;   // CLOUD_TCU to CLOUD_CLD or CLOUD_NONE
+	int32_t *cloud_altitude;  // hundreds of feet, -1 if not applicable
+
+	uint32_t *weather_offset;
+	size_t num_weather;
+	size_t weather_capacity;
+	int8_t *weather_intensity;   // -1 light, 0 moderate, 1 heavy
+	uint32_t *weather_codes;     // as the codes of phenomena_list_t
+} metar_batch_t;
+
+/* initialise an empty batch */
+void metar_batch_init(metar_batch_t *batch);
+
+/* empty the batch, keeping its memory for the next reports */
+void metar_batch_clear(metar_batch_t *batch);
+
+/* free the columns */
+void metar_batch_free(metar_batch_t *batch);
+
+/* Decode num_reports reports and append them to the batch. The reports need
+ * not be NUL terminated and are not referred to afterwards.
+ * Returns 0 for success, 1 if out of memory (the batch is then unchanged).
+ */
+int parse_Metar_batch(const span_t *reports, size_t num_reports, metar_batch_t *batch);
+
+#endif  /* End Include Guard - don't add code below */
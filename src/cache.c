@@ -0,0 +1,260 @@
+/* cache.c -- cache of decoded METARs, keyed by the raw report
+   Copyright 2016 Andrew Walton <dwalton64@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cache.h"
+
+extern int verbose;
+
+struct metar_cache_entry {
+	uint64_t hash;
+	char *report;
+	size_t len;
+	metar_t metar;
+	metar_cache_entry_t *chain;    // next entry in the same bucket
+	metar_cache_entry_t *newer;    // LRU list
+	metar_cache_entry_t *older;
+};
+
+
+/* xxHash64 primes */
+#define PRIME64_1 11400714785074694791ULL
+#define PRIME64_2 14029467366897019727ULL
+#define PRIME64_3  1609587929392839161ULL
+#define PRIME64_4  9650029242287828579ULL
+#define PRIME64_5  2870177450012600261ULL
+
+#define ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+static uint64_t read64(const unsigned char *p) {
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint32_t read32(const unsigned char *p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint64_t xxh_round(uint64_t acc, uint64_t input) {
+	acc += input * PRIME64_2;
+	acc = ROTL64(acc, 31);
+	return acc * PRIME64_1;
+}
+
+static uint64_t xxh_merge_round(uint64_t acc, uint64_t val) {
+	acc ^= xxh_round(0, val);
+	return acc * PRIME64_1 + PRIME64_4;
+}
+
+/* PUBLIC--
+ * xxHash64 of len bytes at data. Reads are done in host byte order, which is
+ * fine since the hashes never leave the process.
+ */
+uint64_t xxhash64(const void *data, size_t len, uint64_t seed) {
+	const unsigned char *p = data;
+	const unsigned char *end = p + len;
+	uint64_t h;
+
+	if (len >= 32) {
+		const unsigned char *limit = end - 32;
+		uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+		uint64_t v2 = seed + PRIME64_2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - PRIME64_1;
+
+		do {
+			v1 = xxh_round(v1, read64(p));
+			v2 = xxh_round(v2, read64(p + 8));
+			v3 = xxh_round(v3, read64(p + 16));
+			v4 = xxh_round(v4, read64(p + 24));
+			p += 32;
+		} while (p <= limit);
+
+		h = ROTL64(v1, 1) + ROTL64(v2, 7) + ROTL64(v3, 12) + ROTL64(v4, 18);
+		h = xxh_merge_round(h, v1);
+		h = xxh_merge_round(h, v2);
+		h = xxh_merge_round(h, v3);
+		h = xxh_merge_round(h, v4);
+	} else {
+		h = seed + PRIME64_5;
+	}
+
+	h += (uint64_t) len;
+
+	while (p + 8 <= end) {
+		h ^= xxh_round(0, read64(p));
+		h = ROTL64(h, 27) * PRIME64_1 + PRIME64_4;
+		p += 8;
+	}
+	if (p + 4 <= end) {
+		h ^= (uint64_t) read32(p) * PRIME64_1;
+		h = ROTL64(h, 23) * PRIME64_2 + PRIME64_3;
+		p += 4;
+	}
+	while (p < end) {
+		h ^= (*p) * PRIME64_5;
+		h = ROTL64(h, 11) * PRIME64_1;
+		p++;
+	}
+
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+
+/* PUBLIC--
+ * Create a cache holding at most capacity decoded reports.
+ */
+metar_cache_t *metar_cache_new(size_t capacity) {
+	metar_cache_t *cache = calloc(1, sizeof(metar_cache_t));
+
+	if (cache == NULL) return NULL;
+	cache->capacity = capacity;
+
+	/* keep the chains short: at least twice as many buckets as entries */
+	cache->num_buckets = 16;
+	while (cache->num_buckets < capacity * 2)
+		cache->num_buckets *= 2;
+	cache->buckets = calloc(cache->num_buckets, sizeof(metar_cache_entry_t *));
+	if (cache->buckets == NULL) {
+		free(cache);
+		return NULL;
+	}
+	return cache;
+}
+
+static void lru_unlink(metar_cache_t *cache, metar_cache_entry_t *entry) {
+	if (entry->newer) entry->newer->older = entry->older;
+	else cache->newest = entry->older;
+	if (entry->older) entry->older->newer = entry->newer;
+	else cache->oldest = entry->newer;
+	entry->newer = entry->older = NULL;
+}
+
+static void lru_push(metar_cache_t *cache, metar_cache_entry_t *entry) {
+	entry->older = cache->newest;
+	entry->newer = NULL;
+	if (cache->newest) cache->newest->newer = entry;
+	cache->newest = entry;
+	if (cache->oldest == NULL) cache->oldest = entry;
+}
+
+static void free_entry(metar_cache_entry_t *entry) {
+	free_Metar(&entry->metar);
+	free(entry->report);
+	free(entry);
+}
+
+static void evict_oldest(metar_cache_t *cache) {
+	metar_cache_entry_t *victim = cache->oldest;
+	metar_cache_entry_t **link;
+
+	link = &cache->buckets[victim->hash & (cache->num_buckets - 1)];
+	while (*link != victim)
+		link = &(*link)->chain;
+	*link = victim->chain;
+
+	lru_unlink(cache, victim);
+	free_entry(victim);
+	cache->count--;
+	cache->evictions++;
+}
+
+
+/* PUBLIC--
+ * Return the decoded report of len characters, calling parse_Metar_n() only
+ * if it is not cached.
+ */
+const metar_t *metar_cache_decode_n(metar_cache_t *cache, const char *report, size_t len) {
+	uint64_t hash = xxhash64(report, len, 0);
+	metar_cache_entry_t *entry;
+
+	for (entry = cache->buckets[hash & (cache->num_buckets - 1)]; entry != NULL; entry = entry->chain) {
+		if (entry->hash == hash && entry->len == len && memcmp(entry->report, report, len) == 0) {
+			cache->hits++;
+			lru_unlink(cache, entry);
+			lru_push(cache, entry);
+			return &entry->metar;
+		}
+	}
+	cache->misses++;
+
+	if (cache->capacity == 0) {
+		free_Metar(&cache->scratch);
+		parse_Metar_n(report, len, &cache->scratch);
+		return &cache->scratch;
+	}
+
+	/* the entry keeps its own copy of the report, which its spans point into */
+	entry = calloc(1, sizeof(metar_cache_entry_t));
+	if (entry == NULL || (entry->report = malloc(len + 1)) == NULL) {
+		free(entry);
+		return NULL;
+	}
+	memcpy(entry->report, report, len);
+	entry->report[len] = 0;
+	entry->len = len;
+	parse_Metar_n(entry->report, len, &entry->metar);
+	entry->hash = hash;
+
+	if (cache->count == cache->capacity)
+		evict_oldest(cache);
+
+	entry->chain = cache->buckets[hash & (cache->num_buckets - 1)];
+	cache->buckets[hash & (cache->num_buckets - 1)] = entry;
+	lru_push(cache, entry);
+	cache->count++;
+
+	return &entry->metar;
+}
+
+/* PUBLIC--
+ * metar_cache_decode_n() for a NUL terminated report.
+ */
+const metar_t *metar_cache_decode(metar_cache_t *cache, const char *report) {
+	return metar_cache_decode_n(cache, report, strlen(report));
+}
+
+
+/* PUBLIC--
+ * Free the cache and every decoded report in it.
+ */
+void metar_cache_free(metar_cache_t *cache) {
+	metar_cache_entry_t *entry, *older;
+
+	if (cache == NULL) return;
+	if (verbose)
+		printf("Decode cache: %lu hits, %lu misses, %lu evictions\n",
+			   cache->hits, cache->misses, cache->evictions);
+
+	for (entry = cache->newest; entry != NULL; entry = older) {
+		older = entry->older;
+		free_entry(entry);
+	}
+	free_Metar(&cache->scratch);
+	free(cache->buckets);
+	free(cache);
+}
@@ -0,0 +1,69 @@
+/* cache.h -- cache of decoded METARs, keyed by the raw report
+   Copyright 2016 Andrew Walton <dwalton64@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef Already_included_cache_h
+#define Already_included_cache_h 1
+
+#include <stdint.h>
+#include <stddef.h>
+#include "metar.h"
+
+/* default number of decoded reports kept in the cache */
+#define METAR_CACHE_SIZE 1024
+
+typedef struct metar_cache_entry metar_cache_entry_t;
+
+/* A station's METAR does not change until the next one is issued, so polling
+ * and archives decode the same report many times. The cache maps the xxHash64
+ * of a raw report to its decoded metar_t and evicts the least recently used
+ * entry when it is full.
+ */
+typedef struct {
+	metar_cache_entry_t **buckets;
+	size_t num_buckets;           // a power of two
+	metar_cache_entry_t *newest;  // most recently used entry
+	metar_cache_entry_t *oldest;  // least recently used entry, evicted first
+	size_t count;
+	size_t capacity;              // 0 disables caching
+	metar_t scratch;              // result when caching is disabled
+
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long evictions;
+} metar_cache_t;
+
+/* xxHash64 of len bytes at data */
+uint64_t xxhash64(const void *data, size_t len, uint64_t seed);
+
+/* create a cache holding at most capacity decoded reports. Returns NULL if out of memory */
+metar_cache_t *metar_cache_new(size_t capacity);
+
+/* Return the decoded report of len characters, calling parse_Metar_n() only
+ * if it is not cached. The report itself is not modified and need not be NUL
+ * terminated. The result belongs to the cache and is only valid until the
+ * next call; it must not be freed. With caching disabled its spans point
+ * into report.
+ */
+const metar_t *metar_cache_decode_n(metar_cache_t *cache, const char *report, size_t len);
+
+/* metar_cache_decode_n() for a NUL terminated report */
+const metar_t *metar_cache_decode(metar_cache_t *cache, const char *report);
+
+/* free the cache and every decoded report in it */
+void metar_cache_free(metar_cache_t *cache);
+
+#endif  /* End Include Guard - don't add code below */
@@ -0,0 +1,359 @@
+/* codec.c -- compact binary encoding of observation streams
+   Copyright 2016 Andrew Walton <dwalton64@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "codec.h"
+
+/* what the stream remembers about a station: its previous observation */
+struct codec_station {
+	station_id_t id;
+	obs_record_t prev;
+	char *report;          // previous report, report_size bytes
+	size_t report_len;
+	size_t report_size;
+};
+
+/* reports are usually a few hundred bytes; the buffer of a station grows
+ * from this to fit longer ones */
+#define CODEC_REPORT_SIZE 128
+
+/* the fields of obs_record_t that are delta encoded, in mask bit order */
+static const struct {
+	size_t offset;
+	size_t size;
+	int is_signed;
+} fields[] = {
+	{ offsetof(obs_record_t, obs_time), sizeof(int64_t), 1 },
+	{ offsetof(obs_record_t, winddir),  sizeof(int32_t), 1 },
+	{ offsetof(obs_record_t, windstr),  sizeof(int32_t), 1 },
+	{ offsetof(obs_record_t, windgust), sizeof(int32_t), 1 },
+	{ offsetof(obs_record_t, vis),      sizeof(int32_t), 1 },
+	{ offsetof(obs_record_t, visfrac),  sizeof(int32_t), 1 },
+	{ offsetof(obs_record_t, qnh),      sizeof(int32_t), 1 },
+	{ offsetof(obs_record_t, qnhfp),    sizeof(int32_t), 1 },
+	{ offsetof(obs_record_t, temp),     sizeof(int32_t), 1 },
+	{ offsetof(obs_record_t, dewp),     sizeof(int32_t), 1 },
+	{ offsetof(obs_record_t, ceiling),  sizeof(int32_t), 1 },
+	{ offsetof(obs_record_t, category), sizeof(uint8_t), 0 },
+	{ offsetof(obs_record_t, flags),    sizeof(uint8_t), 0 },
+};
+
+#define NUM_FIELDS (sizeof(fields) / sizeof(fields[0]))
+
+
+static int64_t get_field(const obs_record_t *rec, int i) {
+	const char *p = (const char *) rec + fields[i].offset;
+	int64_t v64;
+	int32_t v32;
+	uint8_t v8;
+
+	switch (fields[i].size) {
+		case sizeof(int64_t): memcpy(&v64, p, sizeof(v64)); return v64;
+		case sizeof(int32_t): memcpy(&v32, p, sizeof(v32)); return v32;
+		default:              memcpy(&v8, p, sizeof(v8));   return v8;
+	}
+}
+
+static void set_field(obs_record_t *rec, int i, int64_t value) {
+	char *p = (char *) rec + fields[i].offset;
+	int32_t v32 = (int32_t) value;
+	uint8_t v8 = (uint8_t) value;
+
+	switch (fields[i].size) {
+		case sizeof(int64_t): memcpy(p, &value, sizeof(value)); break;
+		case sizeof(int32_t): memcpy(p, &v32, sizeof(v32)); break;
+		default:              memcpy(p, &v8, sizeof(v8)); break;
+	}
+}
+
+
+/* LEB128 variable length integers: 7 bits per byte, high bit set on all but the last */
+static int put_varint(codec_t *codec, uint64_t v) {
+	unsigned char buf[10];
+	int n = 0;
+
+	do {
+		buf[n] = (unsigned char) (v & 0x7f);
+		v >>= 7;
+		if (v) buf[n] |= 0x80;
+		n++;
+	} while (v);
+	codec->bytes += (unsigned long) n;
+	return fwrite(buf, 1, (size_t) n, codec->fp) == (size_t) n ? 0 : 1;
+}
+
+/* returns 1 if a varint was read, 0 at the end of the stream, -1 for an error */
+static int get_varint(codec_t *codec, uint64_t *v) {
+	int c, shift = 0;
+
+	*v = 0;
+	while ((c = getc(codec->fp)) != EOF) {
+		if (shift > 63) return -1;
+		*v |= (uint64_t) (c & 0x7f) << shift;
+		if (!(c & 0x80)) return 1;
+		shift += 7;
+	}
+	/* EOF is only clean before the first byte */
+	return shift == 0 ? 0 : -1;
+}
+
+static uint64_t zigzag(int64_t v) {
+	return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v) {
+	return (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+}
+
+
+static codec_t *codec_new(FILE *fp) {
+	codec_t *codec = calloc(1, sizeof(codec_t));
+
+	if (codec == NULL) return NULL;
+	codec->fp = fp;
+	return codec;
+}
+
+static codec_station_t *add_station(codec_t *codec, station_id_t id) {
+	codec_station_t *station;
+
+	if (codec->count == codec->size) {
+		size_t size = codec->size ? codec->size * 2 : 64;
+		codec_station_t *stations = realloc(codec->stations, size * sizeof(codec_station_t));
+		if (stations == NULL) return NULL;
+		codec->stations = stations;
+		codec->size = size;
+	}
+	station = &codec->stations[codec->count];
+	memset(station, 0x0, sizeof(codec_station_t));
+	station->id = id;
+	station->prev.station = id;
+	station->report = malloc(CODEC_REPORT_SIZE);
+	if (station->report == NULL) return NULL;
+	station->report_size = CODEC_REPORT_SIZE;
+	codec->count++;
+	return station;
+}
+
+/* remember the report of a station to encode the next one against */
+static int keep_report(codec_station_t *station, const char *report, size_t len) {
+	size_t size = station->report_size;
+	char *buf;
+
+	if (len > size) {
+		while (size < len) size *= 2;
+		if ((buf = realloc(station->report, size)) == NULL)
+			return 1;
+		station->report = buf;
+		station->report_size = size;
+	}
+	memcpy(station->report, report, len);
+	station->report_len = len;
+	return 0;
+}
+
+/* find the number of a station in the encoder, or add it. *is_new is set for new stations */
+static long encoder_station(codec_t *codec, station_id_t id, int *is_new) {
+	size_t i;
+
+	*is_new = 0;
+	if ((codec->count + 1) * 2 > codec->num_slots) {
+		size_t num_slots = codec->num_slots ? codec->num_slots * 2 : 128;
+		uint32_t *slots = calloc(num_slots, sizeof(uint32_t));
+		if (slots == NULL) return -1;
+		for (i = 0; i < codec->count; i++) {
+			size_t j = station_hash(codec->stations[i].id) & (num_slots - 1);
+			while (slots[j]) j = (j + 1) & (num_slots - 1);
+			slots[j] = (uint32_t) i + 1;
+		}
+		free(codec->slots);
+		codec->slots = slots;
+		codec->num_slots = num_slots;
+	}
+
+	i = station_hash(id) & (codec->num_slots - 1);
+	while (codec->slots[i]) {
+		if (codec->stations[codec->slots[i] - 1].id == id)
+			return (long) codec->slots[i] - 1;
+		i = (i + 1) & (codec->num_slots - 1);
+	}
+	if (add_station(codec, id) == NULL)
+		return -1;
+	codec->slots[i] = (uint32_t) codec->count;
+	*is_new = 1;
+	return (long) codec->count - 1;
+}
+
+
+/* PUBLIC--
+ * Start encoding to fp and write the stream header.
+ */
+codec_t *codec_encoder_new(FILE *fp) {
+	codec_t *codec = codec_new(fp);
+
+	if (codec == NULL) return NULL;
+	if (fwrite(CODEC_MAGIC, 1, CODEC_MAGIC_SIZE, fp) != CODEC_MAGIC_SIZE) {
+		codec_free(codec);
+		return NULL;
+	}
+	codec->bytes = CODEC_MAGIC_SIZE;
+	return codec;
+}
+
+/* PUBLIC--
+ * Append an observation and its raw report to the stream.
+ */
+int codec_encode(codec_t *codec, const obs_record_t *rec, const char *report) {
+	codec_station_t *station;
+	char name[STATION_NAME_SIZE];
+	size_t len = rec->report_len, prefix = 0, suffix = 0, name_len;
+	uint64_t mask = 0;
+	long number;
+	int is_new, i, err = 0;
+
+	number = encoder_station(codec, rec->station, &is_new);
+	if (number < 0)
+		return 1;
+	station = &codec->stations[number];
+
+	err |= put_varint(codec, (uint64_t) number);
+	if (is_new) {
+		station_name(rec->station, name);
+		name_len = strlen(name);
+		err |= put_varint(codec, name_len);
+		err |= fwrite(name, 1, name_len, codec->fp) != name_len;
+		codec->bytes += (unsigned long) name_len;
+	}
+
+	for (i = 0; i < (int) NUM_FIELDS; i++)
+		if (get_field(rec, i) != get_field(&station->prev, i))
+			mask |= 1u << i;
+	err |= put_varint(codec, mask);
+	for (i = 0; i < (int) NUM_FIELDS; i++)
+		if (mask & (1u << i))
+			err |= put_varint(codec, zigzag(get_field(rec, i) - get_field(&station->prev, i)));
+
+	/* only the part of the report that differs from the previous one is written */
+	while (prefix < len && prefix < station->report_len && report[prefix] == station->report[prefix])
+		prefix++;
+	while (suffix < len - prefix && suffix < station->report_len - prefix &&
+		   report[len - 1 - suffix] == station->report[station->report_len - 1 - suffix])
+		suffix++;
+	err |= put_varint(codec, prefix);
+	err |= put_varint(codec, suffix);
+	err |= put_varint(codec, len - prefix - suffix);
+	err |= fwrite(report + prefix, 1, len - prefix - suffix, codec->fp) != len - prefix - suffix;
+	codec->bytes += (unsigned long) (len - prefix - suffix);
+
+	station->prev = *rec;
+	err |= keep_report(station, report, len);
+	codec->records++;
+
+	return err ? 1 : 0;
+}
+
+
+/* PUBLIC--
+ * Start decoding from fp and check the stream header.
+ */
+codec_t *codec_decoder_new(FILE *fp) {
+	char magic[CODEC_MAGIC_SIZE];
+	codec_t *codec;
+
+	if (fread(magic, 1, CODEC_MAGIC_SIZE, fp) != CODEC_MAGIC_SIZE ||
+		memcmp(magic, CODEC_MAGIC, CODEC_MAGIC_SIZE) != 0) {
+		fprintf(stderr, "Not an encoded observation stream\n");
+		return NULL;
+	}
+	codec = codec_new(fp);
+	if (codec != NULL) codec->bytes = CODEC_MAGIC_SIZE;
+	return codec;
+}
+
+/* PUBLIC--
+ * Read the next observation from the stream.
+ */
+int codec_decode(codec_t *codec, obs_record_t *rec, char *report) {
+	codec_station_t *station;
+	char name[STATION_NAME_SIZE];
+	uint64_t number, mask, v, prefix, suffix, middle;
+	int i, res;
+
+	res = get_varint(codec, &number);
+	if (res <= 0)
+		return res;
+
+	if (number == codec->count) {
+		/* first observation of a station: its name follows */
+		if (get_varint(codec, &v) <= 0 || v == 0 || v >= STATION_NAME_SIZE ||
+			fread(name, 1, (size_t) v, codec->fp) != (size_t) v)
+			return -1;
+		name[v] = 0;
+		if (add_station(codec, station_id_n(name, (size_t) v)) == NULL)
+			return -1;
+	} else if (number > codec->count) {
+		return -1;
+	}
+	station = &codec->stations[number];
+
+	*rec = station->prev;
+	if (get_varint(codec, &mask) <= 0 || mask >> NUM_FIELDS)
+		return -1;
+	for (i = 0; i < (int) NUM_FIELDS; i++) {
+		if (mask & (1u << i)) {
+			if (get_varint(codec, &v) <= 0)
+				return -1;
+			set_field(rec, i, get_field(&station->prev, i) + unzigzag(v));
+		}
+	}
+
+	if (get_varint(codec, &prefix) <= 0 || get_varint(codec, &suffix) <= 0 ||
+		get_varint(codec, &middle) <= 0 ||
+		prefix + suffix > station->report_len || prefix + suffix + middle > CODEC_MAX_REPORT)
+		return -1;
+	memcpy(report, station->report, (size_t) prefix);
+	if (fread(report + prefix, 1, (size_t) middle, codec->fp) != (size_t) middle)
+		return -1;
+	memcpy(report + prefix + middle, station->report + station->report_len - suffix, (size_t) suffix);
+
+	rec->report_len = (uint16_t) (prefix + middle + suffix);
+	report[rec->report_len] = 0;
+
+	station->prev = *rec;
+	if (keep_report(station, report, rec->report_len))
+		return -1;
+	codec->records++;
+	return 1;
+}
+
+
+/* PUBLIC--
+ * Free the codec state.
+ */
+void codec_free(codec_t *codec) {
+	size_t i;
+
+	if (codec == NULL) return;
+	for (i = 0; i < codec->count; i++)
+		free(codec->stations[i].report);
+	free(codec->stations);
+	free(codec->slots);
+	free(codec);
+}
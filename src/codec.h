@@ -0,0 +1,78 @@
+/* codec.h -- compact binary encoding of observation streams
+   Copyright 2016 Andrew Walton <dwalton64@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef Already_included_codec_h
+#define Already_included_codec_h 1
+
+#include <stdio.h>
+#include <stdint.h>
+#include "store.h"
+
+/* Consecutive observations of a station differ in only a few fields, so each
+ * one is encoded against the previous observation of the same station:
+ *
+ *   varint  station number in the stream; a station that was not seen before
+ *           gets the next number and is followed by its name (length + bytes)
+ *   varint  mask with a bit per field of obs_record_t that changed
+ *   varint  for every changed field, the zigzag encoded difference
+ *   varint  length of the start of the report shared with the previous report
+ *   varint  length of the end of the report shared with the previous report
+ *   varint  length of the rest of the report, followed by its bytes
+ *
+ * A stream starts with CODEC_MAGIC.
+ */
+#define CODEC_MAGIC "METARDC1"
+#define CODEC_MAGIC_SIZE 8
+
+/* longest report that can be encoded (the size of obs_record_t.report_len) */
+#define CODEC_MAX_REPORT UINT16_MAX
+
+typedef struct codec_station codec_station_t;
+
+typedef struct {
+	FILE *fp;
+	codec_station_t *stations;     // indexed by station number
+	size_t count;
+	size_t size;
+	uint32_t *slots;               // hash of station id to station number + 1
+	size_t num_slots;
+
+	unsigned long records;
+	unsigned long bytes;           // encoded size, including the header
+} codec_t;
+
+/* start encoding to fp and write the stream header. Returns NULL for an error */
+codec_t *codec_encoder_new(FILE *fp);
+
+/* append an observation and its raw report (report_len bytes) to the stream.
+ * Returns 0 for success, 1 for an error.
+ */
+int codec_encode(codec_t *codec, const obs_record_t *rec, const char *report);
+
+/* start decoding from fp and check the stream header. Returns NULL for an error */
+codec_t *codec_decoder_new(FILE *fp);
+
+/* read the next observation. The report is NUL terminated and must hold
+ * CODEC_MAX_REPORT + 1 bytes. Returns 1 if an observation was read, 0 at the
+ * end of the stream and -1 for an error.
+ */
+int codec_decode(codec_t *codec, obs_record_t *rec, char *report);
+
+/* free the codec state; the file is not closed */
+void codec_free(codec_t *codec);
+
+#endif  /* End Include Guard - don't add code below */
@@ -0,0 +1,283 @@
+/* codeccheck.c -- check that observations survive encoding and decoding
+   Copyright 2016 Andrew Walton <dwalton64@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* Encodes the reports of a file (e.g. written by metargen -t) with codec.c,
+ * decodes the stream again and compares every record and report byte for
+ * byte. Besides the reports of the file the stream holds a repeated
+ * observation (no field changed), stations with interned ids and a report
+ * longer than any seen before. Then the stream is decoded cut short and
+ * with bytes changed, which must end in an error or the end of the stream
+ * without returning anything that was not encoded.
+ *
+ * Exits with 0 if every check passed, 1 otherwise (reported on stderr).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "codec.h"
+
+/* read by metar.c and store.c */
+int verbose = 0;
+
+/* a long report, to grow the buffers of the codec */
+#define LONG_REPORT_SIZE 1000
+
+/* places the stream is cut at, spread over its length */
+#define NUM_CUTS 256
+
+/* streams decoded with changed bytes */
+#define NUM_CORRUPTIONS 256
+
+typedef struct {
+	obs_record_t rec;
+	char *report;
+} observation_t;
+
+static observation_t *obs = NULL;
+static size_t num_obs = 0, size_obs = 0;
+static size_t repeat_at;          // the observation repeating the one before it
+static int failures = 0;
+
+static void fail(const char *what, size_t i) {
+	fprintf(stderr, "codeccheck: %s (observation %lu)\n", what, (unsigned long) i);
+	failures++;
+}
+
+/* add an observation of the report to the ones encoded; station overrides the
+ * station of the report unless it is STATION_ID_NONE */
+static int add_observation(const char *report, size_t len, time_t obs_time, station_id_t station) {
+	metar_t metar;
+	observation_t *o;
+
+	if (num_obs == size_obs) {
+		size_obs = size_obs ? size_obs * 2 : 1024;
+		if ((o = realloc(obs, size_obs * sizeof(observation_t))) == NULL)
+			return 1;
+		obs = o;
+	}
+	o = &obs[num_obs];
+	if ((o->report = malloc(len + 1)) == NULL)
+		return 1;
+	memcpy(o->report, report, len);
+	o->report[len] = 0;
+
+	parse_Metar_n(o->report, len, &metar);
+	obs_from_metar(&o->rec, &metar, obs_time, len);
+	free_Metar(&metar);
+	if (station != STATION_ID_NONE)
+		o->rec.station = station;
+	num_obs++;
+	return 0;
+}
+
+/* read the reports of filename, with or without a date in front */
+static int read_reports(const char *filename) {
+	FILE *fp;
+	char line[CODEC_MAX_REPORT + 64];
+	const char *text, *p;
+	time_t obs_time, t = 1475280000L;
+	size_t len;
+
+	if ((fp = fopen(filename, "r")) == NULL) {
+		perror(filename);
+		return 1;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		len = strcspn(line, "\r\n");
+		text = line;
+		obs_time = t += 60;
+		if (isdigit((unsigned char) line[0]) && (obs_time = parse_date_n(line, len)) != -1 &&
+			(p = memchr(line, ' ', len)) != NULL && (p = memchr(p + 1, ' ', len - (size_t) (p + 1 - line))) != NULL) {
+			text = p + 1;
+			len -= (size_t) (text - line);
+		}
+		if (len > 0 && add_observation(text, len, obs_time, STATION_ID_NONE)) {
+			fclose(fp);
+			return 1;
+		}
+	}
+	fclose(fp);
+	return 0;
+}
+
+/* the observations the file does not have: an unchanged repeat, interned
+ * stations, and a long report */
+static int add_special(void) {
+	static const char *interned[] = { "E1G", "X2", "ABCDE", "K9", "TEST12345" };
+	char report[LONG_REPORT_SIZE + 1];
+	obs_record_t last;
+	size_t i, len;
+
+	if (num_obs == 0) {
+		fprintf(stderr, "codeccheck: no reports\n");
+		return 1;
+	}
+	last = obs[num_obs - 1].rec;
+	repeat_at = num_obs;
+	if (add_observation(obs[num_obs - 1].report, last.report_len, (time_t) last.obs_time, STATION_ID_NONE))
+		return 1;
+
+	for (i = 0; i < sizeof(interned) / sizeof(interned[0]); i++) {
+		/* twice, so the second is encoded against the first */
+		snprintf(report, sizeof(report), "%s 011250Z 27010KT 9999 FEW020 12/08 Q1013", interned[i]);
+		if (add_observation(report, strlen(report), (time_t) last.obs_time + 60, station_id(interned[i])))
+			return 1;
+		snprintf(report, sizeof(report), "%s 011320Z 28012KT 9999 SCT025 13/08 Q1012", interned[i]);
+		if (add_observation(report, strlen(report), (time_t) last.obs_time + 1800, station_id(interned[i])))
+			return 1;
+	}
+
+	len = (size_t) snprintf(report, sizeof(report), "%s RMK", obs[0].report);
+	while (len + 4 <= LONG_REPORT_SIZE)
+		len += (size_t) snprintf(report + len, sizeof(report) - len, " AO2");
+	if (add_observation(report, len, (time_t) last.obs_time + 3600, obs[0].rec.station))
+		return 1;
+	return 0;
+}
+
+/* encode every observation into a buffer */
+static char *encode(size_t *size, unsigned long *repeat_bytes) {
+	char *buf = NULL;
+	FILE *fp;
+	codec_t *codec;
+	unsigned long before;
+	size_t i;
+
+	if ((fp = open_memstream(&buf, size)) == NULL || (codec = codec_encoder_new(fp)) == NULL) {
+		perror("codeccheck");
+		return NULL;
+	}
+	for (i = 0; i < num_obs; i++) {
+		before = codec->bytes;
+		if (codec_encode(codec, &obs[i].rec, obs[i].report))
+			fail("cannot encode", i);
+		if (i == repeat_at)
+			*repeat_bytes = codec->bytes - before;
+	}
+	if (codec->records != num_obs)
+		fail("encoder miscounted the observations", num_obs);
+	codec_free(codec);
+	fclose(fp);
+	return buf;
+}
+
+/* Decode size bytes of stream. Every observation decoded must be the one
+ * encoded. Returns the number decoded and sets *res to the last result
+ * of codec_decode().
+ */
+static size_t decode(const char *stream, size_t size, int *res, int must_match) {
+	char report[CODEC_MAX_REPORT + 1];
+	char name[STATION_NAME_SIZE], expected[STATION_NAME_SIZE];
+	obs_record_t rec, want;
+	codec_t *codec;
+	FILE *fp;
+	size_t n = 0;
+
+	*res = -1;
+	if ((fp = fmemopen((void *) stream, size, "rb")) == NULL)
+		return 0;
+	if ((codec = codec_decoder_new(fp)) == NULL) {
+		fclose(fp);
+		return 0;
+	}
+	while ((*res = codec_decode(codec, &rec, report)) > 0) {
+		if (rec.report_len > CODEC_MAX_REPORT || report[rec.report_len] != 0) {
+			fail("report is not terminated at its length", n);
+			break;
+		}
+		if (n >= num_obs) {
+			if (must_match) fail("more observations decoded than encoded", n);
+			break;
+		}
+		/* interned ids are made again by the decoder, compare the names */
+		want = obs[n].rec;
+		if (strcmp(station_name(rec.station, name), station_name(want.station, expected)) != 0) {
+			if (must_match) fail("station differs", n);
+		} else {
+			rec.station = want.station;
+			if (memcmp(&rec, &want, sizeof(obs_record_t)) != 0 && must_match)
+				fail("record differs", n);
+			if (memcmp(report, obs[n].report, want.report_len + 1) != 0 && must_match)
+				fail("report differs", n);
+		}
+		n++;
+	}
+	codec_free(codec);
+	fclose(fp);
+	return n;
+}
+
+int main(int argc, char **argv) {
+	char *stream, *copy;
+	unsigned long repeat_bytes = 0;
+	size_t size, n, cut, i, j;
+	int res;
+
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s FILE\n", argv[0]);
+		return 2;
+	}
+	if (read_reports(argv[1]) || add_special())
+		return 1;
+	if ((stream = encode(&size, &repeat_bytes)) == NULL)
+		return 1;
+
+	/* station number, empty mask, prefix, suffix and an empty middle */
+	if (repeat_bytes > 8)
+		fail("unchanged observation takes too many bytes", repeat_at);
+
+	n = decode(stream, size, &res, 1);
+	if (res != 0 || n != num_obs)
+		fail("stream did not decode to its end", n);
+
+	/* a stream cut short decodes what it holds in full, then fails or ends */
+	for (i = 0; i <= NUM_CUTS; i++) {
+		cut = i < NUM_CUTS ? CODEC_MAGIC_SIZE + (size - CODEC_MAGIC_SIZE) * i / NUM_CUTS : size - 1;
+		n = decode(stream, cut, &res, 1);
+		if (res > 0 || n >= num_obs)
+			fail("truncated stream decoded in full", n);
+	}
+	/* without the header it is no stream at all */
+	if (decode(stream + 1, size - 1, &res, 1) != 0 || res != -1)
+		fail("stream without its magic was decoded", 0);
+
+	/* changed bytes may decode to anything, but must not crash or overrun */
+	if ((copy = malloc(size)) == NULL)
+		return 1;
+	srand(1);
+	for (i = 0; i < NUM_CORRUPTIONS; i++) {
+		memcpy(copy, stream, size);
+		for (j = 0; j < 1 + i % 4; j++)
+			copy[CODEC_MAGIC_SIZE + (size_t) rand() % (size - CODEC_MAGIC_SIZE)] ^= (char) (1 + rand() % 255);
+		decode(copy, size, &res, 0);
+	}
+	free(copy);
+	free(stream);
+
+	for (i = 0; i < num_obs; i++)
+		free(obs[i].report);
+	free(obs);
+
+	if (failures)
+		return 1;
+	printf("%lu observations encoded and decoded\n", (unsigned long) num_obs);
+	return 0;
+}
+
+// EOF
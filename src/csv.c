@@ -0,0 +1,221 @@
+/* csv.c -- reading the CSV responses of the aviation weather dataserver
+   Copyright 2016 Andrew Walton <dwalton64@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "csv.h"
+
+extern int verbose;
+
+/* the dataserver sends about 45 columns */
+#define CSV_MAX_FIELDS 64
+
+/* the columns copied into noaa_t */
+enum {
+	COL_RAW_TEXT,
+	COL_OBSERVATION_TIME,
+	COL_LATITUDE,
+	COL_LONGITUDE,
+	COL_ELEVATION,
+	COL_FLIGHT_CATEGORY,
+	NUM_COLUMNS
+};
+
+static const char *column_names[NUM_COLUMNS] = {
+	"raw_text", "observation_time", "latitude", "longitude", "elevation_m", "flight_category"
+};
+
+
+static int field_is(const span_t *field, const char *name) {
+	return field->len == strlen(name) && memcmp(field->ptr, name, field->len) == 0;
+}
+
+/* copy a field into a NUL terminated string of size bytes, truncating it if needed */
+static void copy_field(char *dst, size_t size, const span_t *field) {
+	size_t len = field->len < size - 1 ? field->len : size - 1;
+
+	if (len > 0) memcpy(dst, field->ptr, len);
+	dst[len] = 0;
+}
+
+static double number_field(const span_t *field) {
+	char tmp[32];
+
+	copy_field(tmp, sizeof(tmp), field);
+	return strtod(tmp, NULL);
+}
+
+/* fill report from a line of n fields, col holding the field number of every column or -1 */
+static void fill_report(noaa_span_t *report, const span_t *fields, int n, const int *col) {
+	memset(report, 0, sizeof(noaa_span_t));
+	if (col[COL_RAW_TEXT] >= 0 && col[COL_RAW_TEXT] < n)
+		report->report = fields[col[COL_RAW_TEXT]];
+	if (col[COL_OBSERVATION_TIME] >= 0 && col[COL_OBSERVATION_TIME] < n)
+		report->date = fields[col[COL_OBSERVATION_TIME]];
+	if (col[COL_LATITUDE] >= 0 && col[COL_LATITUDE] < n)
+		report->latitude = number_field(&fields[col[COL_LATITUDE]]);
+	if (col[COL_LONGITUDE] >= 0 && col[COL_LONGITUDE] < n)
+		report->longitude = number_field(&fields[col[COL_LONGITUDE]]);
+	if (col[COL_ELEVATION] >= 0 && col[COL_ELEVATION] < n)
+		report->elevation_m = number_field(&fields[col[COL_ELEVATION]]);
+	if (col[COL_FLIGHT_CATEGORY] >= 0 && col[COL_FLIGHT_CATEGORY] < n)
+		report->category = fields[col[COL_FLIGHT_CATEGORY]];
+}
+
+
+/* PUBLIC--
+ * Split the line at *pos into fields and move *pos to the next line.
+ */
+int csv_split(char **pos, char *end, span_t *fields, int max_fields) {
+	char *p = *pos, *start, *w;
+	size_t len;
+	int n = 0;
+
+	if (p >= end)
+		return -1;
+
+	for (;;) {
+		if (p < end && *p == '"') {
+			/* remove the quotes and undouble the quotes inside, moving the text
+			 * back over the removed characters */
+			start = w = ++p;
+			while (p < end) {
+				if (*p == '"') {
+					if (p + 1 < end && p[1] == '"') {
+						*w++ = '"';
+						p += 2;
+						continue;
+					}
+					p++;
+					break;
+				}
+				*w++ = *p++;
+			}
+			len = (size_t) (w - start);
+			while (p < end && *p != ',' && *p != '\n')
+				p++;
+		} else {
+			start = p;
+			while (p < end && *p != ',' && *p != '\n')
+				p++;
+			len = (size_t) (p - start);
+			if (len > 0 && start[len - 1] == '\r')
+				len--;
+		}
+
+		if (n < max_fields) {
+			fields[n].ptr = start;
+			fields[n].len = len;
+		}
+		n++;
+
+		if (p >= end || *p == '\n')
+			break;
+		p++;   // the comma
+	}
+
+	if (p < end)
+		p++;   // the newline
+	*pos = p;
+	return n;
+}
+
+/* PUBLIC--
+ * True if the response is CSV rather than XML.
+ */
+int is_NOAA_csv(const char *data, size_t len) {
+	size_t i;
+
+	for (i = 0; i < len && isspace((unsigned char) data[i]); i++)
+		;
+	return i < len && data[i] != '<';
+}
+
+/* PUBLIC--
+ * Parse a CSV response from the dataserver. The fields are located in place
+ * and nothing is copied.
+ */
+int parse_NOAA_csv_spans(char *data, size_t len, noaa_span_t *reports, int max_reports) {
+	span_t fields[CSV_MAX_FIELDS];
+	int col[NUM_COLUMNS];
+	char *pos = data;
+	char *end = data + len;
+	int n, i, j, header = 0, count = 0;
+
+	while ((n = csv_split(&pos, end, fields, CSV_MAX_FIELDS)) >= 0) {
+		if (n > CSV_MAX_FIELDS)
+			n = CSV_MAX_FIELDS;
+
+		if (!header) {
+			/* skip the status lines before the column names */
+			if (!field_is(&fields[0], "raw_text"))
+				continue;
+			for (i = 0; i < NUM_COLUMNS; i++) {
+				col[i] = -1;
+				for (j = 0; j < n; j++)
+					if (field_is(&fields[j], column_names[i]))
+						col[i] = j;
+			}
+			header = 1;
+			continue;
+		}
+
+		if (n == 1 && fields[0].len == 0)
+			continue;   // empty line
+		if (count < max_reports)
+			fill_report(&reports[count], fields, n, col);
+		count++;
+	}
+
+	if (!header) {
+		if (verbose) printf("Unable to find the column names in the CSV data from NOAA.\n");
+		return 0;
+	}
+	if (verbose) printf("num_results = %i\n", count);
+	return count ? count : -1;
+}
+
+/* PUBLIC--
+ * Parse a CSV response from the dataserver into noaa_t structs.
+ */
+int parse_NOAA_csv(char *data, size_t len, noaa_t *noaa, int max_reports) {
+	noaa_span_t one, *reports = &one;
+	char *t;
+	int count, i;
+
+	if (max_reports > 1 && (reports = malloc((size_t) max_reports * sizeof(noaa_span_t))) == NULL)
+		return 0;
+
+	count = parse_NOAA_csv_spans(data, len, reports, max_reports);
+	for (i = 0; i < count && i < max_reports; i++) {
+		memset(&noaa[i], 0, sizeof(noaa_t));
+		copy_field(noaa[i].report, sizeof(noaa[i].report), &reports[i].report);
+		copy_field(noaa[i].date, sizeof(noaa[i].date), &reports[i].date);
+		/* 2016-09-24T21:35:00Z is printed as 2016-09-24 21:35:00Z, as for the XML */
+		if ((t = strchr(noaa[i].date, 'T')) != NULL) *t = ' ';
+		copy_field(noaa[i].category, sizeof(noaa[i].category), &reports[i].category);
+		noaa[i].latitude = reports[i].latitude;
+		noaa[i].longitude = reports[i].longitude;
+		noaa[i].elevation_m = reports[i].elevation_m;
+	}
+
+	if (reports != &one)
+		free(reports);
+	return count;
+}
@@ -0,0 +1,70 @@
+/* csv.h -- reading the CSV responses of the aviation weather dataserver
+   Copyright 2016 Andrew Walton <dwalton64@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef Already_included_csv_h
+#define Already_included_csv_h 1
+
+#include <stddef.h>
+#include "metar.h"
+
+/* With format=csv the dataserver answers with a few lines of status, a
+ * header line naming the columns (starting with raw_text) and one line per
+ * report:
+ *
+ *   No errors
+ *   No warnings
+ *   4 ms
+ *   data source=metars
+ *   2 results
+ *   raw_text,station_id,observation_time,latitude,longitude,...
+ *   KJFK 141751Z 33017G22KT ...,KJFK,2016-10-14T17:51:00Z,40.65,-73.78,...
+ *
+ * The columns are looked up by name, so their order does not matter.
+ */
+
+/* a report of a CSV response; the text fields point into the response */
+typedef struct {
+	span_t date;        // 2016-09-24T21:35:00Z
+	span_t report;
+	span_t category;
+	double latitude;
+	double longitude;
+	double elevation_m;
+} noaa_span_t;
+
+/* Split the line at *pos (before end) into at most max_fields fields and
+ * move *pos to the start of the next line. Quoted fields may contain commas,
+ * newlines and doubled quotes; the quotes are removed in place, which is the
+ * only change made to the buffer. Returns the number of fields on the line,
+ * which may be more than max_fields, or -1 at the end of the buffer.
+ */
+int csv_split(char **pos, char *end, span_t *fields, int max_fields);
+
+/* true if the response in data is CSV rather than XML */
+int is_NOAA_csv(const char *data, size_t len);
+
+/* Parse a CSV response of len bytes in data, filling at most max_reports
+ * entries of reports without copying any text. Returns the number of reports
+ * in the response (which may be more than max_reports), -1 if it contains no
+ * reports and 0 if it could not be interpreted.
+ */
+int parse_NOAA_csv_spans(char *data, size_t len, noaa_span_t *reports, int max_reports);
+
+/* parse_NOAA_csv_spans(), copying the reports into noaa */
+int parse_NOAA_csv(char *data, size_t len, noaa_t *noaa, int max_reports);
+
+#endif  /* End Include Guard - don't add code below */
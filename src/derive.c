@@ -0,0 +1,343 @@
+/* derive.c -- quantities derived from batches of decoded reports
+   Copyright 2016 Andrew Walton <dwalton64@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <string.h>
+#include <math.h>
+#include "derive.h"
+
+/* Magnus formula, over water (Alduchov and Eskridge) */
+#define MAGNUS_B 17.625f
+#define MAGNUS_C 243.04f
+
+/* standard atmosphere */
+#define STD_QNH      1013.25f    // hPa
+#define PA_SCALE     145366.45f  // feet
+#define PA_EXPONENT  0.190284f
+#define ISA_SEA      15.0f       // degrees Celsius at sea level
+#define ISA_LAPSE    0.0019812f  // degrees Celsius per foot
+#define DA_PER_DEGREE 118.8f     // feet of density altitude per degree above ISA
+
+#define HPA_PER_HUNDREDTH_INHG 0.338639f
+#define FEET_PER_METER 3.28084f
+
+#define PI       3.14159265f
+#define HALF_PI  1.57079633f
+#define RADIANS_PER_DEGREE 0.0174532925f
+
+/* exp() and log() as in the Cephes library */
+#define LOG2E    1.44269504f
+#define LN2_HI   0.693359375f
+#define LN2_LO   -2.12194440e-4f
+#define SQRT_HALF 0.707106781f
+#define EXP_MAX  88.0f
+#define EXP_MIN  -87.0f
+
+
+/* e^x, for x within EXP_MIN to EXP_MAX */
+static float exp_approx(float x) {
+	float fx, n, r, y, scale;
+	int32_t bits;
+
+	if (x > EXP_MAX) x = EXP_MAX;
+	if (x < EXP_MIN) x = EXP_MIN;
+
+	/* x = n ln 2 + r with |r| <= ln 2 / 2 */
+	fx = x * LOG2E + 0.5f;
+	n = (float) (int32_t) fx;
+	if (n > fx) n -= 1.0f;
+	r = x - n * LN2_HI - n * LN2_LO;
+
+	y = ((((1.9875691500e-4f * r + 1.3981999507e-3f) * r + 8.3334519073e-3f) * r +
+		  4.1665795894e-2f) * r + 1.6666665459e-1f) * r + 5.0000001201e-1f;
+	y = y * r * r + r + 1.0f;
+
+	bits = ((int32_t) n + 127) << 23;
+	memcpy(&scale, &bits, sizeof(scale));
+	return y * scale;
+}
+
+/* natural logarithm of x > 0 */
+static float log_approx(float x) {
+	float m, z, y;
+	int32_t bits, e;
+
+	/* x = m 2^e with m within sqrt(1/2) to sqrt(2) */
+	memcpy(&bits, &x, sizeof(bits));
+	e = ((bits >> 23) & 0xff) - 126;
+	bits = (bits & 0x007fffff) | 0x3f000000;
+	memcpy(&m, &bits, sizeof(m));
+	if (m < SQRT_HALF) {
+		e--;
+		m = m + m - 1.0f;
+	} else {
+		m = m - 1.0f;
+	}
+
+	z = m * m;
+	y = (((((((7.0376836292e-2f * m - 1.1514610310e-1f) * m + 1.1676998740e-1f) * m -
+			 1.2420140846e-1f) * m + 1.4249322787e-1f) * m - 1.6668057665e-1f) * m +
+		  2.0000714765e-1f) * m - 2.4999993993e-1f) * m + 3.3333331174e-1f;
+	y = y * m * z + (float) e * LN2_LO - 0.5f * z;
+	return m + y + (float) e * LN2_HI;
+}
+
+/* sine of x within -pi to pi */
+static float sin_approx(float x) {
+	float z;
+
+	/* sin(x) = sin(pi - x) brings x within -pi/2 to pi/2 */
+	if (x > HALF_PI) x = PI - x;
+	else if (x < -HALF_PI) x = -PI - x;
+	z = x * x;
+	return x * (1.0f + z * (-1.0f / 6 + z * (1.0f / 120 + z * (-1.0f / 5040 + z * (1.0f / 362880)))));
+}
+
+/* the kernels for the reports from first on, one at a time */
+static void humidity_tail(const metar_batch_t *batch, float *humidity, size_t first) {
+	float t, td;
+	size_t i;
+
+	for (i = first; i < batch->count; i++) {
+		t = (float) batch->temp[i];
+		td = (float) batch->dewp[i];
+		humidity[i] = 100.0f * exp_approx(MAGNUS_B * td / (MAGNUS_C + td) - MAGNUS_B * t / (MAGNUS_C + t));
+	}
+}
+
+static void altitudes_tail(const metar_batch_t *batch, const float *elevation_m,
+						   float *pressure_alt, float *density_alt, size_t first) {
+	float qnh, pa;
+	size_t i;
+
+	for (i = first; i < batch->count; i++) {
+		if (batch->qnh[i] <= 0) {
+			pressure_alt[i] = density_alt[i] = NAN;
+			continue;
+		}
+		qnh = (float) batch->qnh[i];
+		if (batch->flags[i] & BATCH_QNH_INHG)
+			qnh *= HPA_PER_HUNDREDTH_INHG;
+		pa = PA_SCALE * (1.0f - exp_approx(PA_EXPONENT * log_approx(qnh / STD_QNH)));
+		if (elevation_m != NULL)
+			pa += elevation_m[i] * FEET_PER_METER;
+		pressure_alt[i] = pa;
+		density_alt[i] = pa + DA_PER_DEGREE * ((float) batch->temp[i] - (ISA_SEA - ISA_LAPSE * pa));
+	}
+}
+
+static void wind_tail(const metar_batch_t *batch, const float *runway,
+					  float *headwind, float *crosswind, size_t first) {
+	float angle, turns, speed;
+	size_t i;
+
+	for (i = first; i < batch->count; i++) {
+		speed = (float) batch->windstr[i];
+		if (batch->winddir[i] < 0) {
+			headwind[i] = 0;
+			crosswind[i] = speed;
+			continue;
+		}
+		/* the angle off the runway, within -180 to 180 degrees */
+		angle = (float) batch->winddir[i] - runway[i];
+		turns = angle / 360.0f;
+		angle -= 360.0f * (float) (int32_t) (turns + (turns >= 0 ? 0.5f : -0.5f));
+		angle *= RADIANS_PER_DEGREE;
+		headwind[i] = speed * sin_approx(HALF_PI - fabsf(angle));
+		crosswind[i] = speed * sin_approx(angle);
+	}
+}
+
+
+#if defined(__GNUC__) && (__GNUC__ >= 9 || defined(__clang__))
+/* __builtin_convertvector() is needed */
+#define DERIVE_VECTOR 1
+
+typedef float vfloat __attribute__((vector_size(DERIVE_WIDTH * sizeof(float))));
+typedef int32_t vint __attribute__((vector_size(DERIVE_WIDTH * sizeof(int32_t))));
+typedef uint8_t vbyte __attribute__((vector_size(DERIVE_WIDTH)));
+
+/* every element x */
+static inline vfloat vsplat(float x) {
+	vfloat v = {0};
+
+	return v + x;
+}
+
+/* a where mask is set (-1), b elsewhere */
+static inline vfloat vselect(vint mask, vfloat a, vfloat b) {
+	return (vfloat) (((vint) a & mask) | ((vint) b & ~mask));
+}
+
+static inline vfloat load_ints(const int32_t *p) {
+	vint v;
+
+	memcpy(&v, p, sizeof(v));
+	return __builtin_convertvector(v, vfloat);
+}
+
+static inline vfloat load_floats(const float *p) {
+	vfloat v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline void store_floats(float *p, vfloat v) {
+	memcpy(p, &v, sizeof(v));
+}
+
+/* exp_approx() of every element */
+static inline vfloat vexp(vfloat x) {
+	vfloat fx, n, r, y;
+	vint ni;
+
+	x = vselect(x > EXP_MAX, vsplat(EXP_MAX), x);
+	x = vselect(x < EXP_MIN, vsplat(EXP_MIN), x);
+
+	fx = x * LOG2E + 0.5f;
+	ni = __builtin_convertvector(fx, vint);
+	n = __builtin_convertvector(ni, vfloat);
+	ni += n > fx;            // -1 where truncation rounded up
+	n = __builtin_convertvector(ni, vfloat);
+	r = x - n * LN2_HI - n * LN2_LO;
+
+	y = ((((1.9875691500e-4f * r + 1.3981999507e-3f) * r + 8.3334519073e-3f) * r +
+		  4.1665795894e-2f) * r + 1.6666665459e-1f) * r + 5.0000001201e-1f;
+	y = y * r * r + r + 1.0f;
+	return y * (vfloat) ((ni + 127) << 23);
+}
+
+/* log_approx() of every element */
+static inline vfloat vlog(vfloat x) {
+	vfloat m, z, y, e;
+	vint bits = (vint) x, small;
+
+	e = __builtin_convertvector(((bits >> 23) & 0xff) - 126, vfloat);
+	m = (vfloat) ((bits & 0x007fffff) | 0x3f000000);
+	small = m < SQRT_HALF;
+	e = vselect(small, e - 1.0f, e);
+	m = vselect(small, m + m - 1.0f, m - 1.0f);
+
+	z = m * m;
+	y = (((((((7.0376836292e-2f * m - 1.1514610310e-1f) * m + 1.1676998740e-1f) * m -
+			 1.2420140846e-1f) * m + 1.4249322787e-1f) * m - 1.6668057665e-1f) * m +
+		  2.0000714765e-1f) * m - 2.4999993993e-1f) * m + 3.3333331174e-1f;
+	y = y * m * z + e * LN2_LO - 0.5f * z;
+	return m + y + e * LN2_HI;
+}
+
+/* sin_approx() of every element */
+static inline vfloat vsin(vfloat x) {
+	vfloat z;
+
+	x = vselect(x > HALF_PI, PI - x, x);
+	x = vselect(x < -HALF_PI, -PI - x, x);
+	z = x * x;
+	return x * (1.0f + z * (-1.0f / 6 + z * (1.0f / 120 + z * (-1.0f / 5040 + z * (1.0f / 362880)))));
+}
+#endif
+
+
+/* PUBLIC--
+ * Relative humidity of every report.
+ */
+void derive_humidity(const metar_batch_t *batch, float *humidity) {
+	size_t i = 0;
+#ifdef DERIVE_VECTOR
+	vfloat t, td;
+
+	for (; i + DERIVE_WIDTH <= batch->count; i += DERIVE_WIDTH) {
+		t = load_ints(batch->temp + i);
+		td = load_ints(batch->dewp + i);
+		store_floats(humidity + i, 100.0f * vexp(MAGNUS_B * td / (MAGNUS_C + td) - MAGNUS_B * t / (MAGNUS_C + t)));
+	}
+#endif
+	humidity_tail(batch, humidity, i);
+}
+
+void derive_humidity_scalar(const metar_batch_t *batch, float *humidity) {
+	humidity_tail(batch, humidity, 0);
+}
+
+/* PUBLIC--
+ * Pressure and density altitude of every report.
+ */
+void derive_altitudes(const metar_batch_t *batch, const float *elevation_m,
+					  float *pressure_alt, float *density_alt) {
+	size_t i = 0;
+#ifdef DERIVE_VECTOR
+	vfloat qnh, pa, nan = vsplat(NAN);
+	vint inhg, missing;
+	vbyte flags;
+
+	for (; i + DERIVE_WIDTH <= batch->count; i += DERIVE_WIDTH) {
+		qnh = load_ints(batch->qnh + i);
+		memcpy(&flags, batch->flags + i, sizeof(flags));
+		inhg = __builtin_convertvector(flags & BATCH_QNH_INHG, vint) != 0;
+		missing = qnh <= 0;
+		qnh = vselect(inhg, qnh * HPA_PER_HUNDREDTH_INHG, qnh);
+		/* log() of the missing ones is garbage, which is replaced below */
+		qnh = vselect(missing, vsplat(STD_QNH), qnh);
+
+		pa = PA_SCALE * (1.0f - vexp(PA_EXPONENT * vlog(qnh / STD_QNH)));
+		if (elevation_m != NULL)
+			pa += load_floats(elevation_m + i) * FEET_PER_METER;
+		store_floats(pressure_alt + i, vselect(missing, nan, pa));
+		pa += DA_PER_DEGREE * (load_ints(batch->temp + i) - (ISA_SEA - ISA_LAPSE * pa));
+		store_floats(density_alt + i, vselect(missing, nan, pa));
+	}
+#endif
+	altitudes_tail(batch, elevation_m, pressure_alt, density_alt, i);
+}
+
+void derive_altitudes_scalar(const metar_batch_t *batch, const float *elevation_m,
+							 float *pressure_alt, float *density_alt) {
+	altitudes_tail(batch, elevation_m, pressure_alt, density_alt, 0);
+}
+
+/* PUBLIC--
+ * Headwind and crosswind of every report.
+ */
+void derive_wind(const metar_batch_t *batch, const float *runway,
+				 float *headwind, float *crosswind) {
+	size_t i = 0;
+#ifdef DERIVE_VECTOR
+	vfloat angle, turns, speed, zero = {0};
+	vint variable;
+
+	for (; i + DERIVE_WIDTH <= batch->count; i += DERIVE_WIDTH) {
+		speed = load_ints(batch->windstr + i);
+		angle = load_ints(batch->winddir + i);
+		variable = angle < 0;
+
+		angle -= load_floats(runway + i);
+		turns = angle / 360.0f;
+		turns += vselect(turns >= 0, vsplat(0.5f), vsplat(-0.5f));
+		angle -= 360.0f * __builtin_convertvector(__builtin_convertvector(turns, vint), vfloat);
+		angle *= RADIANS_PER_DEGREE;
+
+		store_floats(headwind + i, vselect(variable, zero, speed * vsin(HALF_PI - vselect(angle < 0, -angle, angle))));
+		store_floats(crosswind + i, vselect(variable, speed, speed * vsin(angle)));
+	}
+#endif
+	wind_tail(batch, runway, headwind, crosswind, i);
+}
+
+void derive_wind_scalar(const metar_batch_t *batch, const float *runway,
+						float *headwind, float *crosswind) {
+	wind_tail(batch, runway, headwind, crosswind, 0);
+}
@@ -0,0 +1,62 @@
+/* derive.h -- quantities derived from batches of decoded reports
+   Copyright 2016 Andrew Walton <dwalton64@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef Already_included_derive_h
+#define Already_included_derive_h 1
+
+#include "batch.h"
+
+/* Every function fills one float per report of the batch into its output
+ * columns. The kernels work on DERIVE_WIDTH reports at a time with the
+ * vector extensions of GCC and clang, which the compiler maps to the 128 bit
+ * SIMD instructions of the target (SSE2 on any x86-64, NEON on arm64); other
+ * compilers, and the tail of a batch, use the scalar versions. Both use the
+ * same single precision approximations of exp() and log(), which are within
+ * a few units in the last place, so they agree closely with each other.
+ *
+ * A report without a temperature has a temperature and dew point of 0, which
+ * cannot be told apart from a real 0/00.
+ */
+#define DERIVE_WIDTH 4
+
+/* relative humidity in percent, from temp and dewp (Magnus formula) */
+void derive_humidity(const metar_batch_t *batch, float *humidity);
+void derive_humidity_scalar(const metar_batch_t *batch, float *humidity);
+
+/* Pressure altitude and density altitude in feet, from the QNH (hPa or
+ * inches of mercury), the temperature and the elevation of the station in
+ * meters (elevation_m may be NULL for stations at sea level). Both are NaN
+ * for a report without QNH.
+ *   pressure altitude = elevation + 145366.45 (1 - (QNH / 1013.25)^0.190284)
+ *   density altitude  = pressure altitude + 118.8 (temp - ISA temperature)
+ */
+void derive_altitudes(const metar_batch_t *batch, const float *elevation_m,
+					  float *pressure_alt, float *density_alt);
+void derive_altitudes_scalar(const metar_batch_t *batch, const float *elevation_m,
+							 float *pressure_alt, float *density_alt);
+
+/* Headwind and crosswind components in knots of the wind relative to the
+ * heading of a runway (runway[i] in degrees, for report i). The crosswind is
+ * positive from the right; a tailwind is a negative headwind. A variable wind
+ * counts as a crosswind of its full speed, the worst case. Gusts are left out.
+ */
+void derive_wind(const metar_batch_t *batch, const float *runway,
+				 float *headwind, float *crosswind);
+void derive_wind_scalar(const metar_batch_t *batch, const float *runway,
+						float *headwind, float *crosswind);
+
+#endif  /* End Include Guard - don't add code below */
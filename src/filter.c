@@ -0,0 +1,644 @@
+/* filter.c -- selecting reports with --where expressions
+   Copyright 2016 Andrew Walton <dwalton64@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include "filter.h"
+
+/* instructions; the program is in postfix order */
+#define FILTER_OP_AND         0   // pop two values, push their conjunction
+#define FILTER_OP_OR          1
+#define FILTER_OP_NOT         2
+#define FILTER_OP_COMPARE     3   // push field cmp value
+#define FILTER_OP_WEATHER     4   // push whether a weather group holds codes
+#define FILTER_OP_CLOUD       5   // push whether a cloud layer has the cloud code
+#define FILTER_OP_MAINTENANCE 6
+
+#define FILTER_FIELD_WIND     0
+#define FILTER_FIELD_GUST     1
+#define FILTER_FIELD_DIR      2
+#define FILTER_FIELD_VIS      3
+#define FILTER_FIELD_CEILING  4
+#define FILTER_FIELD_TEMP     5
+#define FILTER_FIELD_DEWP     6
+#define FILTER_FIELD_QNH      7
+#define FILTER_FIELD_CATEGORY 8
+#define FILTER_FIELD_STATION  9
+
+#define FILTER_CMP_LT 0
+#define FILTER_CMP_LE 1
+#define FILTER_CMP_GT 2
+#define FILTER_CMP_GE 3
+#define FILTER_CMP_EQ 4
+#define FILTER_CMP_NE 5
+
+#define INHG_TO_HPA 33.8639
+#define METERS_PER_SM 1609.344
+
+/* intensity of a weather group matching any */
+#define ANY_INTENSITY 2
+
+static const struct {
+	const char *name;
+	int field;
+	int part;              // the part of the report holding the field
+} fields[] = {
+	{"WIND", FILTER_FIELD_WIND, METAR_PART_WIND},
+	{"GUST", FILTER_FIELD_GUST, METAR_PART_WIND},
+	{"DIR", FILTER_FIELD_DIR, METAR_PART_WIND},
+	{"VIS", FILTER_FIELD_VIS, METAR_PART_VIS},
+	{"CEILING", FILTER_FIELD_CEILING, METAR_PART_CLOUDS},
+	{"TEMP", FILTER_FIELD_TEMP, METAR_PART_TEMP},
+	{"DEWP", FILTER_FIELD_DEWP, METAR_PART_TEMP},
+	{"QNH", FILTER_FIELD_QNH, METAR_PART_QNH},
+	{"CATEGORY", FILTER_FIELD_CATEGORY, METAR_PART_CLOUDS},
+	{"STATION", FILTER_FIELD_STATION, METAR_PART_STATION}
+};
+#define NUM_FIELDS (sizeof(fields) / sizeof(fields[0]))
+
+/* tokens of an expression */
+#define TOK_END    0
+#define TOK_WORD   1
+#define TOK_NUMBER 2
+#define TOK_CMP    3
+#define TOK_AND    4
+#define TOK_OR     5
+#define TOK_NOT    6
+#define TOK_LPAREN 7
+#define TOK_RPAREN 8
+
+#define WORD_SIZE 32
+
+typedef struct {
+	const char *pos;           // the rest of the expression
+	const char *start;         // the current token
+	int type;                  // TOK_*
+	int cmp;                   // of TOK_CMP
+	double number;             // of TOK_NUMBER
+	char word[WORD_SIZE];      // upper case; the unit of TOK_NUMBER
+	filter_t *filter;
+	int error;
+} compiler_t;
+
+
+/* report an error in the expression at the current token */
+static void syntax_error(compiler_t *c, const char *message) {
+	if (c->error)
+		return;
+	if (c->type == TOK_END) fprintf(stderr, "--where: %s at the end of the expression\n", message);
+	else fprintf(stderr, "--where: %s at `%s'\n", message, c->start);
+	c->error = 1;
+}
+
+/* read the word at p into word, upper cased; returns the end of the word */
+static const char *read_word(const char *p, char *word) {
+	size_t n = 0;
+
+	while (isalnum((unsigned char) *p) || *p == '$' || *p == '+' || *p == '-') {
+		if (n < WORD_SIZE - 1)
+			word[n++] = (char) toupper((unsigned char) *p);
+		p++;
+		/* a sign only starts a word */
+		if (isalnum((unsigned char) p[-1]) && (*p == '+' || *p == '-'))
+			break;
+	}
+	word[n] = 0;
+	return p;
+}
+
+/* the units a number may have, which may also follow it after blanks */
+static const char *units[] = {"SM", "M", "KM", "FT", "KT", "C", "HPA", "INHG"};
+#define NUM_UNITS (sizeof(units) / sizeof(units[0]))
+
+/* read the unit following a number after blanks into word, as in 30 KT;
+ * returns the end of the unit, or p if no unit follows */
+static const char *read_unit(const char *p, char *word) {
+	const char *q = p, *end;
+	size_t i;
+
+	while (isspace((unsigned char) *q))
+		q++;
+	if (!isalpha((unsigned char) *q))
+		return p;
+	end = read_word(q, word);
+	for (i = 0; i < NUM_UNITS; i++)
+		if (strcmp(word, units[i]) == 0)
+			return end;
+	word[0] = 0;
+	return p;
+}
+
+/* move to the next token */
+static void next_token(compiler_t *c) {
+	const char *p = c->pos;
+	char *end;
+
+	while (isspace((unsigned char) *p))
+		p++;
+	c->start = p;
+	c->word[0] = 0;
+
+	if (*p == 0) {
+		c->type = TOK_END;
+	} else if (*p == '(' || *p == ')') {
+		c->type = *p++ == '(' ? TOK_LPAREN : TOK_RPAREN;
+	} else if (p[0] == '&' && p[1] == '&') {
+		c->type = TOK_AND;
+		p += 2;
+	} else if (p[0] == '|' && p[1] == '|') {
+		c->type = TOK_OR;
+		p += 2;
+	} else if (*p == '<' || *p == '>' || *p == '=' || (p[0] == '!' && p[1] == '=')) {
+		c->type = TOK_CMP;
+		if (p[0] == '!') c->cmp = FILTER_CMP_NE;
+		else if (p[0] == '=') c->cmp = FILTER_CMP_EQ;
+		else if (p[1] == '=') c->cmp = p[0] == '<' ? FILTER_CMP_LE : FILTER_CMP_GE;
+		else c->cmp = p[0] == '<' ? FILTER_CMP_LT : FILTER_CMP_GT;
+		p += (p[1] == '=') ? 2 : 1;
+	} else if (*p == '!') {
+		c->type = TOK_NOT;
+		p++;
+	} else if (isdigit((unsigned char) *p) || (*p == '.' && isdigit((unsigned char) p[1])) ||
+			   ((*p == '-' || *p == 'M') && isdigit((unsigned char) p[1]))) {
+		/* a number such as 30, -5, M05 (as temperatures are reported), 1.5 or 1/2, with its unit */
+		c->type = TOK_NUMBER;
+		c->number = strtod(*p == 'M' ? p + 1 : p, &end);
+		if (*p == 'M') c->number = -c->number;
+		p = end;
+		if (*p == '/' && isdigit((unsigned char) p[1])) {
+			double denominator = strtod(p + 1, &end);
+			if (denominator != 0) c->number /= denominator;
+			p = end;
+		}
+		p = read_word(p, c->word);
+		if (c->word[0] == 0)
+			p = read_unit(p, c->word);
+	} else if (isalnum((unsigned char) *p) || *p == '$' || *p == '+' || *p == '-') {
+		p = read_word(p, c->word);
+		if (strcmp(c->word, "AND") == 0) c->type = TOK_AND;
+		else if (strcmp(c->word, "OR") == 0) c->type = TOK_OR;
+		else if (strcmp(c->word, "NOT") == 0) c->type = TOK_NOT;
+		else c->type = TOK_WORD;
+	} else {
+		c->type = TOK_WORD;
+		syntax_error(c, "unexpected character");
+		p++;
+	}
+	c->pos = p;
+}
+
+/* append an instruction to the program */
+static filter_insn_t *emit(compiler_t *c, int op) {
+	filter_insn_t *insn;
+
+	if (c->filter->length == FILTER_MAX_PROGRAM) {
+		syntax_error(c, "expression too long");
+		return NULL;
+	}
+	insn = &c->filter->program[c->filter->length++];
+	memset(insn, 0, sizeof(filter_insn_t));
+	insn->op = (uint8_t) op;
+	insn->intensity = ANY_INTENSITY;
+	return insn;
+}
+
+/* compile the value a field is compared with */
+static void compile_value(compiler_t *c, filter_insn_t *insn) {
+	const char *unit = c->word;
+	int category;
+
+	if (insn->field == FILTER_FIELD_STATION) {
+		if (c->type != TOK_WORD || (insn->codes = station_id(c->word)) == STATION_ID_NONE ||
+			(insn->cmp != FILTER_CMP_EQ && insn->cmp != FILTER_CMP_NE))
+			syntax_error(c, "a station can only be compared (= or !=) with an ICAO code");
+		return;
+	}
+	if (insn->field == FILTER_FIELD_CATEGORY) {
+		for (category = FLIGHT_CATEGORY_VFR; category <= FLIGHT_CATEGORY_LIFR; category++)
+			if (c->type == TOK_WORD && strcmp(c->word, flight_category_name(category)) == 0)
+				insn->value = category;
+		if (insn->value == 0)
+			syntax_error(c, "a flight category (VFR, MVFR, IFR or LIFR) is expected");
+		return;
+	}
+	if (c->type != TOK_NUMBER) {
+		syntax_error(c, "a number is expected");
+		return;
+	}
+
+	/* convert to the unit the field is kept in */
+	insn->value = c->number;
+	if (*unit == 0)
+		return;
+	if (insn->field == FILTER_FIELD_VIS && strcmp(unit, "SM") == 0)
+		return;
+	if (insn->field == FILTER_FIELD_VIS && strcmp(unit, "M") == 0)
+		insn->value = c->number / METERS_PER_SM;
+	else if (insn->field == FILTER_FIELD_VIS && strcmp(unit, "KM") == 0)
+		insn->value = c->number * 1000 / METERS_PER_SM;
+	else if (insn->field == FILTER_FIELD_CEILING && strcmp(unit, "FT") == 0)
+		return;
+	else if ((insn->field == FILTER_FIELD_WIND || insn->field == FILTER_FIELD_GUST) && strcmp(unit, "KT") == 0)
+		return;
+	else if ((insn->field == FILTER_FIELD_TEMP || insn->field == FILTER_FIELD_DEWP) && strcmp(unit, "C") == 0)
+		return;
+	else if (insn->field == FILTER_FIELD_QNH && strcmp(unit, "HPA") == 0)
+		return;
+	else if (insn->field == FILTER_FIELD_QNH && strcmp(unit, "INHG") == 0)
+		insn->value = c->number * INHG_TO_HPA;
+	else
+		syntax_error(c, "unknown unit");
+}
+
+/* compile a weather group such as +TSRA; returns 0 if word is not one */
+static int compile_weather(compiler_t *c, const char *word) {
+	filter_insn_t *insn;
+	int intensity = ANY_INTENSITY, n, code;
+	unsigned codes = 0;
+	char letters[3];
+
+	if (*word == '-' || *word == '+')
+		intensity = *word++ == '-' ? -1 : 1;
+	if ((strlen(word) % 2) != 0 || strlen(word) == 0 || strlen(word) > 8)
+		return 0;
+	for (n = 0; word[2 * n] != 0; n++) {
+		letters[0] = word[2 * n];
+		letters[1] = word[2 * n + 1];
+		letters[2] = 0;
+		for (code = 1; *weather_code_name(code) != 0; code++)
+			if (strcmp(weather_code_name(code), letters) == 0)
+				break;
+		if (*weather_code_name(code) == 0)
+			return 0;
+		codes |= (unsigned) code << (8 * n);
+	}
+	if ((insn = emit(c, FILTER_OP_WEATHER)) != NULL) {
+		insn->codes = codes;
+		insn->intensity = (int8_t) intensity;
+	}
+	return 1;
+}
+
+/* compile a term that is not a comparison */
+static void compile_term(compiler_t *c) {
+	filter_insn_t *insn;
+	int code;
+
+	if (strcmp(c->word, "$") == 0 || strcmp(c->word, "MAINTENANCE") == 0) {
+		emit(c, FILTER_OP_MAINTENANCE);
+		return;
+	}
+	if (strcmp(c->word, "CAVOK") == 0) {
+		if ((insn = emit(c, FILTER_OP_WEATHER)) != NULL)
+			insn->codes = WEATHER_CAVOK;
+		return;
+	}
+	for (code = CLOUD_FEW; code <= CLOUD_CLD; code++) {
+		if (strcmp(c->word, cloud_code_name(code)) == 0) {
+			if ((insn = emit(c, FILTER_OP_CLOUD)) != NULL)
+				insn->codes = (unsigned) code;
+			return;
+		}
+	}
+	if (!compile_weather(c, c->word))
+		syntax_error(c, "unknown field or weather");
+}
+
+static void compile_or(compiler_t *c);
+
+/* primary: ( or ) | field cmp value | term */
+static void compile_primary(compiler_t *c) {
+	filter_insn_t *insn;
+	size_t i;
+
+	if (c->type == TOK_LPAREN) {
+		next_token(c);
+		compile_or(c);
+		if (c->type != TOK_RPAREN)
+			syntax_error(c, "`)' is expected");
+		next_token(c);
+		return;
+	}
+	if (c->type != TOK_WORD) {
+		syntax_error(c, "a field or weather is expected");
+		return;
+	}
+	for (i = 0; i < NUM_FIELDS; i++)
+		if (strcmp(c->word, fields[i].name) == 0)
+			break;
+	if (i == NUM_FIELDS) {
+		compile_term(c);
+		next_token(c);
+		return;
+	}
+
+	next_token(c);
+	if (c->type != TOK_CMP) {
+		syntax_error(c, "a comparison is expected");
+		return;
+	}
+	if ((insn = emit(c, FILTER_OP_COMPARE)) == NULL)
+		return;
+	insn->field = (uint8_t) fields[i].field;
+	insn->cmp = (uint8_t) c->cmp;
+	next_token(c);
+	compile_value(c, insn);
+	next_token(c);
+}
+
+/* not: ! not | primary */
+static void compile_not(compiler_t *c) {
+	if (c->type == TOK_NOT) {
+		next_token(c);
+		compile_not(c);
+		emit(c, FILTER_OP_NOT);
+	} else {
+		compile_primary(c);
+	}
+}
+
+/* and: not { && not } */
+static void compile_and(compiler_t *c) {
+	compile_not(c);
+	while (!c->error && c->type == TOK_AND) {
+		next_token(c);
+		compile_not(c);
+		emit(c, FILTER_OP_AND);
+	}
+}
+
+/* or: and { || and } */
+static void compile_or(compiler_t *c) {
+	compile_and(c);
+	while (!c->error && c->type == TOK_OR) {
+		next_token(c);
+		compile_and(c);
+		emit(c, FILTER_OP_OR);
+	}
+}
+
+
+/* PUBLIC--
+ * Compile a --where expression.
+ */
+filter_t *filter_compile(const char *expression) {
+	compiler_t c;
+	int i, depth = 0;
+
+	memset(&c, 0, sizeof(c));
+	if ((c.filter = calloc(1, sizeof(filter_t))) == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return NULL;
+	}
+	c.pos = expression;
+	next_token(&c);
+	compile_or(&c);
+	if (c.type != TOK_END)
+		syntax_error(&c, "`and' or `or' is expected");
+
+	/* the values the program keeps on the stack at the same time */
+	for (i = 0; !c.error && i < c.filter->length; i++) {
+		if (c.filter->program[i].op == FILTER_OP_AND || c.filter->program[i].op == FILTER_OP_OR)
+			depth--;
+		else if (c.filter->program[i].op != FILTER_OP_NOT && ++depth > FILTER_MAX_DEPTH)
+			syntax_error(&c, "expression too deeply nested");
+	}
+	if (c.error) {
+		free(c.filter);
+		return NULL;
+	}
+	return c.filter;
+}
+
+
+/* the value of a field, which may not be known yet
+ * returns FILTER_TRUE if it is known, FILTER_FALSE if the report lacks it
+ * and FILTER_UNKNOWN if it has not been decoded yet */
+static int field_value(const metar_t *metar, int field, int part, unsigned found, double *value) {
+	size_t i;
+
+	for (i = 0; i < NUM_FIELDS && fields[i].field != field; i++)
+		;
+	if (part <= fields[i].part && part != METAR_PART_END)
+		return FILTER_UNKNOWN;
+
+	switch (field) {
+		case FILTER_FIELD_WIND:
+			*value = metar->windstr;
+			return (found & (1u << METAR_PART_WIND)) != 0;
+		case FILTER_FIELD_GUST:
+			*value = metar->windgust;
+			return (found & (1u << METAR_PART_WIND)) != 0;
+		case FILTER_FIELD_DIR:
+			*value = metar->winddir;
+			return (found & (1u << METAR_PART_WIND)) != 0 && metar->winddir != -1;
+		case FILTER_FIELD_VIS:
+			if (strncmp(metar->visunit, "SM", 2) == 0) *value = metar->vis + metar->visfrac / 16.0;
+			else *value = metar->vis / METERS_PER_SM;
+			return metar->visunit[0] != 0;
+		case FILTER_FIELD_CEILING:
+			*value = metar->ceiling == NO_CEILING ? INFINITY : metar->ceiling * 100.0;
+			return 1;
+		case FILTER_FIELD_TEMP:
+			*value = metar->temp;
+			return (found & (1u << METAR_PART_TEMP)) != 0;
+		case FILTER_FIELD_DEWP:
+			*value = metar->dewp;
+			return (found & (1u << METAR_PART_TEMP)) != 0;
+		case FILTER_FIELD_QNH:
+			*value = metar->qnh;
+			if (metar->qnhunit[0] == '"') *value = metar->qnh / 100.0 * INHG_TO_HPA;
+			return (found & (1u << METAR_PART_QNH)) != 0;
+		case FILTER_FIELD_CATEGORY:
+			*value = flight_category(metar);
+			return *value != FLIGHT_CATEGORY_UNKNOWN;
+		case FILTER_FIELD_STATION:
+			*value = metar->station;
+			return metar->station != STATION_ID_NONE;
+	}
+	return 0;
+}
+
+/* true if the weather group has the phenomena of the instruction */
+static int weather_matches(const filter_insn_t *insn, const phenomena_list_t *group) {
+	unsigned want, have;
+	int i, j;
+
+	if (insn->intensity != ANY_INTENSITY && insn->intensity != group->intensity)
+		return 0;
+	if (insn->codes == WEATHER_CAVOK)
+		return group->codes == WEATHER_CAVOK;
+	for (i = 0; i < 4 && (want = (insn->codes >> (8 * i)) & 0xff) != 0; i++) {
+		for (j = 0; j < 4; j++)
+			if ((have = (group->codes >> (8 * j)) & 0xff) == want)
+				break;
+		if (j == 4)
+			return 0;
+	}
+	return 1;
+}
+
+/* value of a leaf instruction; *final is set if it cannot change any more */
+static int leaf_value(const filter_insn_t *insn, const metar_t *metar, int part, unsigned found, int *final) {
+	const phenomena_list_t *group;
+	const cloud_list_t *layer;
+	double value = 0;
+	int known;
+
+	*final = 1;
+	switch (insn->op) {
+		case FILTER_OP_COMPARE:
+			if ((known = field_value(metar, insn->field, part, found, &value)) != FILTER_TRUE) {
+				/* a comparison with a field the report lacks is unknown */
+				*final = known == FILTER_FALSE;
+				return FILTER_UNKNOWN;
+			}
+			if (insn->field == FILTER_FIELD_STATION)
+				return (insn->cmp == FILTER_CMP_EQ) == ((unsigned) value == insn->codes);
+			switch (insn->cmp) {
+				case FILTER_CMP_LT: return value < insn->value;
+				case FILTER_CMP_LE: return value <= insn->value;
+				case FILTER_CMP_GT: return value > insn->value;
+				case FILTER_CMP_GE: return value >= insn->value;
+				case FILTER_CMP_EQ: return value == insn->value;
+				default:            return value != insn->value;
+			}
+		case FILTER_OP_WEATHER:
+			for (group = metar->phenomena; group != NULL; group = group->next)
+				if (weather_matches(insn, group))
+					return FILTER_TRUE;
+			/* weather found later may still match */
+			*final = part > METAR_PART_CLOUDS || part == METAR_PART_END ||
+					 (insn->codes != WEATHER_CAVOK && part > METAR_PART_WEATHER);
+			return *final ? FILTER_FALSE : FILTER_UNKNOWN;
+		case FILTER_OP_CLOUD:
+			for (layer = metar->clouds; layer != NULL; layer = layer->next)
+				if (layer->cloud->amount_code == (int) insn->codes || layer->cloud->modifier_code == (int) insn->codes)
+					return FILTER_TRUE;
+			*final = part > METAR_PART_CLOUDS;
+			return *final ? FILTER_FALSE : FILTER_UNKNOWN;
+		default:
+			/* the $ is the last token of a report */
+			*final = part == METAR_PART_END || metar->maintenance_needed == MAINTENANCE_NEEDED;
+			if (metar->maintenance_needed == MAINTENANCE_NEEDED)
+				return FILTER_TRUE;
+			return *final ? FILTER_FALSE : FILTER_UNKNOWN;
+	}
+}
+
+/* the progress of a report through filter_match() */
+typedef struct {
+	const filter_t *filter;
+	int8_t values[FILTER_MAX_PROGRAM];   // of the leaves that cannot change any more, -1 if not known
+	int result;
+} match_t;
+
+/* run the program on the report decoded so far; also the progress callback
+ * of parse_Metar_until(), which stops once the value is known */
+static int evaluate(const metar_t *metar, int part, unsigned found, void *ctx) {
+	match_t *match = ctx;
+	const filter_insn_t *insn;
+	int stack[FILTER_MAX_DEPTH + 1];
+	int sp = 0, i, a, b, final;
+
+	for (i = 0; i < match->filter->length; i++) {
+		insn = &match->filter->program[i];
+		switch (insn->op) {
+			case FILTER_OP_AND:
+				b = stack[--sp];
+				a = stack[sp - 1];
+				if (a == FILTER_FALSE || b == FILTER_FALSE) stack[sp - 1] = FILTER_FALSE;
+				else if (a == FILTER_TRUE && b == FILTER_TRUE) stack[sp - 1] = FILTER_TRUE;
+				else stack[sp - 1] = FILTER_UNKNOWN;
+				break;
+			case FILTER_OP_OR:
+				b = stack[--sp];
+				a = stack[sp - 1];
+				if (a == FILTER_TRUE || b == FILTER_TRUE) stack[sp - 1] = FILTER_TRUE;
+				else if (a == FILTER_FALSE && b == FILTER_FALSE) stack[sp - 1] = FILTER_FALSE;
+				else stack[sp - 1] = FILTER_UNKNOWN;
+				break;
+			case FILTER_OP_NOT:
+				if (stack[sp - 1] != FILTER_UNKNOWN)
+					stack[sp - 1] = !stack[sp - 1];
+				break;
+			default:
+				/* a leaf keeps its value once it is final, e.g. the clouds
+				 * of a trend forecast do not count as observed */
+				if (match->values[i] < 0) {
+					stack[sp] = leaf_value(insn, metar, part, found, &final);
+					if (final) match->values[i] = (int8_t) stack[sp];
+				} else {
+					stack[sp] = match->values[i];
+				}
+				sp++;
+				break;
+		}
+	}
+	match->result = stack[0];
+	return match->result != FILTER_UNKNOWN;
+}
+
+/* the progress callback of filter_decode(), which only stops for a report
+ * that does not satisfy the filter */
+static int evaluate_until_rejected(const metar_t *metar, int part, unsigned found, void *ctx) {
+	match_t *match = ctx;
+
+	/* once accepted, the rest of the report is only decoded */
+	if (match->result == FILTER_TRUE)
+		return 0;
+	return evaluate(metar, part, found, ctx) && match->result == FILTER_FALSE;
+}
+
+
+/* PUBLIC--
+ * Decode a report as far as needed to know whether it satisfies the filter.
+ */
+int filter_match(const filter_t *filter, const char *report, size_t len) {
+	match_t match;
+	metar_t metar;
+
+	match.filter = filter;
+	match.result = FILTER_UNKNOWN;
+	memset(match.values, 0xff, sizeof(match.values));
+	parse_Metar_until(report, len, &metar, evaluate, &match);
+	free_Metar(&metar);
+	return match.result == FILTER_TRUE;
+}
+
+/* PUBLIC--
+ * filter_match(), decoding a report that satisfies the filter in full.
+ */
+int filter_decode(const filter_t *filter, const char *report, size_t len, metar_t *metar) {
+	match_t match;
+
+	match.filter = filter;
+	match.result = FILTER_UNKNOWN;
+	memset(match.values, 0xff, sizeof(match.values));
+	parse_Metar_until(report, len, metar, evaluate_until_rejected, &match);
+	if (match.result == FILTER_TRUE)
+		return 1;
+	free_Metar(metar);
+	return 0;
+}
+
+void filter_free(filter_t *filter) {
+	free(filter);
+}
@@ -0,0 +1,94 @@
+/* filter.h -- selecting reports with --where expressions
+   Copyright 2016 Andrew Walton <dwalton64@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef Already_included_filter_h
+#define Already_included_filter_h 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include "metar.h"
+
+/* An expression such as
+ *
+ *   gust > 30 or TS or vis < 3SM
+ *
+ * is compiled once into a program for a small stack machine, which is run
+ * while a report is decoded. Its value is true, false or unknown, the last
+ * while a part of the report it depends on has not been decoded yet (or is
+ * missing from the report). Decoding stops as soon as the value is known.
+ *
+ * Comparisons (< <= > >= = !=) take one of the fields
+ *   wind, gust      knots (gust is the wind speed if there are no gusts)
+ *   dir             degrees, unknown for variable winds
+ *   vis             statute miles, or with a unit: 5000M, 5KM, 3SM
+ *   ceiling         feet, infinite without a BKN, OVC or VV layer
+ *   temp, dewp      degrees Celsius
+ *   qnh             hPa, or inches of mercury with the unit INHG
+ *   category        VFR, MVFR, IFR or LIFR; worse conditions are greater
+ *   station         an ICAO code (only = and !=)
+ * A weather group such as TS, +RA or SHRA is true if a group of the report
+ * holds those phenomena (at that intensity); a cloud amount or type such as
+ * OVC or CB if a layer has it; CAVOK if the report says so and $ (or
+ * maintenance) if the station needs maintenance. Terms are combined with
+ * and, or, not (or &&, ||, !) and parentheses. Words are not case sensitive.
+ */
+
+/* values of an expression */
+#define FILTER_FALSE   0
+#define FILTER_TRUE    1
+#define FILTER_UNKNOWN 2
+
+/* limits of an expression */
+#define FILTER_MAX_PROGRAM 128
+#define FILTER_MAX_DEPTH   32
+
+/* an instruction of the program */
+typedef struct {
+	uint8_t op;          // FILTER_OP_*, see filter.c
+	uint8_t field;       // FILTER_FIELD_*
+	uint8_t cmp;         // FILTER_CMP_*
+	int8_t intensity;    // of a weather group, 2 for any
+	unsigned codes;      // of a weather group, a cloud code or a station id
+	double value;        // compared with the field
+} filter_insn_t;
+
+typedef struct {
+	filter_insn_t program[FILTER_MAX_PROGRAM];
+	int length;
+} filter_t;
+
+/* Compile an expression. Returns NULL if it is not valid, after printing why
+ * to stderr.
+ */
+filter_t *filter_compile(const char *expression);
+
+/* true if the len characters of report satisfy the filter. The report is
+ * decoded only as far as needed to know.
+ */
+int filter_match(const filter_t *filter, const char *report, size_t len);
+
+/* filter_match() for a report that is used further: if it satisfies the
+ * filter it is decoded in full into metar, as parse_Metar_n() would, and 1
+ * is returned; free_Metar() it when done. Otherwise decoding stops as soon as
+ * the report is known not to satisfy the filter, metar is freed already and
+ * 0 is returned.
+ */
+int filter_decode(const filter_t *filter, const char *report, size_t len, metar_t *metar);
+
+void filter_free(filter_t *filter);
+
+#endif  /* End Include Guard - don't add code below */
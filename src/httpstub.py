@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+# httpstub.py -- a stand-in for the weather server, for the checks of make check
+#
+# Usage: httpstub.py PORTFILE LOGFILE
+#
+# Listens on a free port of 127.0.0.1, which it writes to PORTFILE, and
+# answers GET /MODE/STATION with a report of STATION. MODE is one of
+#   ok     always answer
+#   fail   always answer 503
+#   gone   answer 404 with an HTML page for KNOP, answer otherwise
+#   pause  answer 503 with Retry-After: 2 the first time, then answer
+#   slow   take 3 seconds the first time for KSLO, answer at once otherwise
+# Every request is logged to LOGFILE as "SECONDS /MODE/STATION STATUS", where
+# STATUS is "cancelled" for a slow request the client gave up on.
+
+import http.server
+import os
+import select
+import socketserver
+import sys
+import threading
+import time
+
+REPORT = """<?xml version="1.0" encoding="UTF-8"?>
+<response version="1.2">
+  <data num_results="1">
+    <METAR>
+      <raw_text>%s 141751Z 33017KT 10SM FEW030 12/08 A3005</raw_text>
+      <station_id>%s</station_id>
+      <observation_time>2016-10-14T17:51:00Z</observation_time>
+      <flight_category>VFR</flight_category>
+    </METAR>
+  </data>
+</response>
+"""
+
+lock = threading.Lock()
+seen = {}
+
+
+def log(path, status):
+    with lock, open(sys.argv[2], "a") as f:
+        f.write("%.3f %s %s\n" % (time.time(), path, status))
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.0"
+
+    def log_message(self, *args):
+        pass
+
+    def respond(self, status, body=b"", headers=()):
+        self.send_response(status)
+        for name, value in headers:
+            self.send_header(name, value)
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+        log(self.path, status)
+
+    # wait, returning False as soon as the client closes the connection
+    def linger(self, seconds):
+        end = time.time() + seconds
+        while time.time() < end:
+            if select.select([self.connection], [], [], 0.02)[0]:
+                if self.connection.recv(1) == b"":
+                    return False
+        return True
+
+    def do_GET(self):
+        mode, _, station = self.path.strip("/").partition("/")
+        station = station.upper()
+        with lock:
+            first = self.path not in seen
+            seen[self.path] = True
+        body = (REPORT % (station, station)).encode()
+
+        if mode == "fail":
+            self.respond(503)
+        elif mode == "gone" and station == "KNOP":
+            self.respond(404, b"<html><body><h1>Not Found</h1></body></html>\n")
+        elif mode == "pause" and first:
+            self.respond(503, headers=[("Retry-After", "2")])
+        elif mode == "slow" and station == "KSLO" and first and not self.linger(3):
+            log(self.path, "cancelled")
+        else:
+            self.respond(200, body)
+
+
+class Server(socketserver.ThreadingMixIn, http.server.HTTPServer):
+    daemon_threads = True
+
+
+server = Server(("127.0.0.1", 0), Handler)
+with open(sys.argv[1] + ".tmp", "w") as f:
+    f.write("%d\n" % server.server_address[1])
+os.rename(sys.argv[1] + ".tmp", sys.argv[1])
+server.serve_forever()
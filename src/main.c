@@ -22,11 +22,30 @@
 #include <curl/curl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <limits.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <signal.h>
+#include <zlib.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "metar.h"
-
-/* global variable so we don't have to mess with parameter passing */
-char noaabuffer[METAR_MAXSIZE];
+#include "store.h"
+#include "aggregate.h"
+#include "cache.h"
+#include "codec.h"
+#include "queue.h"
+#include "csv.h"
+#include "shard.h"
+#include "shmtable.h"
+#include "schedule.h"
+#include "filter.h"
+#include "throttle.h"
+#include "trace.h"
 
 /* command line options */
 int decode=0;
@@ -35,16 +54,190 @@ int location=0;
 int datetime=0;
 int category=0;
 
-char *strupc(char *line) {
-   char *p;
-   for (p=line; *p; p++) *p= (char) toupper(*p);
-   return line;
-}
+/* store for decoded observations, NULL unless -s was given */
+store_t *store = NULL;
+
+/* observations collected for aggregation, aggregate_hours is 0 unless -a was given */
+int aggregate_hours = 0;
+int threads = 0;
+obs_array_t observations;
+
+/* decoded reports, so a report that did not change is not decoded again */
+metar_cache_t *cache = NULL;
+long cache_size = METAR_CACHE_SIZE;
+
+/* binary stream the observations are written to instead of printing them (-e) */
+codec_t *encoder = NULL;
+
+/* threads downloading, parsing the XML and decoding the reports of the stations (-p) */
+int fetch_threads = 16;
+int parse_threads = 1;
+int decode_threads = 1;
+
+/* the arguments are responses saved from the server instead of stations (-x) */
+int xml_files = 0;
+
+/* ask the server for CSV instead of XML (-C) */
+int request_csv = 0;
+
+/* seconds between polls of the stations, 0 unless -w was given */
+int watch = 0;
+volatile sig_atomic_t stop_watching = 0;
+
+/* worker processes the stations are split among (-n), and the command
+ * starting them instead of forking (-N) */
+int shards = 0;
+char *shard_command = NULL;
+
+/* the results are sent to the coordinator of a sharded sweep, NULL unless
+ * this process is a shard worker */
+FILE *shard_out = NULL;
+shard_stats_t shard_stats;
+
+/* shared memory table the newest report of every station is published to (-P) */
+shm_table_t *obs_table = NULL;
+
+/* query parameters selecting the stations of a region (--bbox, --radius),
+ * empty if the stations are given on the command line */
+char region[URL_MAXSIZE] = "";
+
+/* only the reports satisfying the expression (--where) are output, NULL for all */
+char *where = NULL;
+filter_t *filter = NULL;
+
+/* FROM,TO[,HOURS] of the history fetched with --backfill, and the file its
+ * progress is saved in (--checkpoint) */
+char *backfill = NULL;
+char *checkpoint = NULL;
+
+/* the stations known to the server (--stations); others are not requested */
+char *stations_file = NULL;
+station_set_t *known_stations = NULL;
+
+/* adapts the number of requests in flight (up to fetch_threads) to the
+ * servers, and limits their rate (--rate) */
+throttle_t *throttle = NULL;
+
+/* the spans of work of the threads are saved to this file (--trace), NULL if not traced */
+char *trace_file = NULL;
+
+/* seconds a request may take (--timeout, 0 for no limit), the times a
+ * request failing because of the server or the network is retried
+ * (--retries), and whether slow requests are sent again (--hedge) */
+double request_timeout = 60;
+int retries = 2;
+int hedge = 0;
+
+/* seconds before the first retry, and at most between retries */
+#define RETRY_BASE_DELAY 0.5
+#define RETRY_MAX_DELAY  30.0
+
+/* a request is hedged once it takes longer than this share of the recent ones */
+#define HEDGE_QUANTILE 0.95
+
+/* characters of an error message of a download */
+#define ERROR_SIZE (CURL_ERROR_SIZE + 128)
+
+/* hours of history fetched with a single request by default */
+#define BACKFILL_WINDOW_HOURS 24
+
+/* options without a short form */
+#define OPT_BBOX   256
+#define OPT_RADIUS 257
+#define OPT_WHERE  258
+#define OPT_BACKFILL   259
+#define OPT_CHECKPOINT 260
+#define OPT_STATIONS   261
+#define OPT_RATE       262
+#define OPT_TRACE      263
+#define OPT_TIMEOUT    264
+#define OPT_RETRIES    265
+#define OPT_HEDGE      266
+
+static struct option long_options[] = {
+	{"bbox", required_argument, NULL, OPT_BBOX},
+	{"radius", required_argument, NULL, OPT_RADIUS},
+	{"where", required_argument, NULL, OPT_WHERE},
+	{"backfill", required_argument, NULL, OPT_BACKFILL},
+	{"checkpoint", required_argument, NULL, OPT_CHECKPOINT},
+	{"stations", required_argument, NULL, OPT_STATIONS},
+	{"rate", required_argument, NULL, OPT_RATE},
+	{"trace", required_argument, NULL, OPT_TRACE},
+	{"timeout", required_argument, NULL, OPT_TIMEOUT},
+	{"retries", required_argument, NULL, OPT_RETRIES},
+	{"hedge", no_argument, NULL, OPT_HEDGE},
+	{NULL, 0, NULL, 0}
+};
+
+/* statute miles in a nautical mile */
+#define STATUTE_MILES_PER_NM 1.150779
+
+/* a response of the server, growing as it is received */
+typedef struct {
+	char *data;        // NUL terminated
+	size_t len;
+	size_t size;
+	size_t max;        // largest response accepted, METAR_MAXSIZE if 0
+} buffer_t;
+
+/* states of a station passing through the pipeline */
+#define JOB_OK       0
+#define JOB_FAILED   1   // an error was already reported
+#define JOB_INVALID  2   // the server does not know the station
+#define JOB_UNCHANGED 3  // no report was issued since the last poll
+#define JOB_FILTERED 4   // the report does not satisfy --where
+
+/* newest observation time of a station that is not polled again */
+#define NEWEST_INVALID ((time_t) -2)
+
+/* a station passing through the pipeline. The result is rendered into output
+ * by the decode stage, so the output stage only has to write it in order.
+ */
+typedef struct {
+	unsigned long seq;         // position of the station on the command line
+	char *station_arg;
+	station_id_t station;
+	int status;                // JOB_*
+	time_t since;              // newest observation time seen before, -1 if none
+	time_t obs_time;           // observation time of the report
+	buffer_t response;
+	noaa_t noaa;
+	int have_rec;              // rec holds the decoded observation
+	obs_record_t rec;
+	char *output;
+	size_t output_len;
+} job_t;
+
+/* The stations are fetched, parsed and decoded by pools of threads connected
+ * by queues; main() writes the results in the order of the command line.
+ * Jobs are recycled through the free queue, so at most num_jobs stations are
+ * in the pipeline and a slow stage holds back the stages before it.
+ */
+typedef struct {
+	char **stations;
+	unsigned long num_stations;
+	time_t *newest;                 // newest observation time seen per station, -1 if none
+	atomic_ulong next_seq;          // next station to fetch
+
+	job_t *jobs;
+	unsigned long num_jobs;
+	queue_t free;
+	queue_t fetched;
+	queue_t parsed;
+	queue_t decoded;
+
+	atomic_int fetching;            // threads still running in each stage
+	atomic_int parsing;
+	atomic_int decoding;
+} pipeline_t;
 
 /* show brief usage info */
 void usage(char *name) {
 	printf("$Id: main.c,v 1.9 2006/04/05 20:30:28 kees-guest Exp $\n");
 	printf("Usage: %s [OPTION]... STATION... \n", name);
+	printf("  or:  %s [OPTION]... --bbox MINLAT,MINLON,MAXLAT,MAXLON\n", name);
+	printf("  or:  %s [OPTION]... --radius LAT,LON,NM\n", name);
+	printf("  or:  %s [OPTION]... --backfill FROM,TO[,HOURS] STATION...\n", name);
     printf("Print meteorological reports (METARS) for STATIONs.\n");
     printf("Where STATIONs are one or more ICAO airport codes (e.x. ksfo).\n\n");
 	printf("Options\n");
@@ -52,224 +245,2178 @@ void usage(char *name) {
     printf("   -l        print location of the phenomenon\n");
     printf("   -t        print the time and date of the phenomenon\n");
     printf("   -c        print flight category (VFR, MVFR, IFR, LIFR)\n");
+    printf("   -f FILE   read raw METARs from FILE, one per line, instead of downloading\n");
+    printf("             them ('-' reads from standard input)\n");
+    printf("   -s DIR    append decoded observations to the store in DIR\n");
+    printf("   -q FROM,TO  print the observations of STATIONs kept in the store (-s)\n");
+    printf("             between FROM and TO (YYYY-MM-DDTHH:MM:SSZ or seconds since 1970)\n");
+    printf("   -a HOURS  instead of printing the reports read with -f or -q, print statistics\n");
+    printf("             per station and per HOURS hours (24 for daily statistics)\n");
+    printf("   -j N      use N threads for -a (default: number of processors)\n");
+    printf("   -m N      keep up to N decoded reports in memory (default: %d, 0 disables)\n", METAR_CACHE_SIZE);
+    printf("   -e FILE   write the observations to FILE as a compact binary stream\n");
+    printf("             instead of printing them\n");
+    printf("   -r FILE   read the observations from a binary stream written with -e\n");
+    printf("   -p F[,P[,D]]  use F threads to download, P to parse the XML and D to decode\n");
+    printf("             the reports of STATIONs (default: 16,1,1). Fewer downloads run at\n");
+    printf("             once while the server is slow or overloaded\n");
+    printf("   -w SECS   poll STATIONs and print only new reports. A station is polled when\n");
+    printf("             its next report is expected, and at least every SECS seconds\n");
+    printf("   -C        ask the server for CSV instead of XML, which is cheaper to read\n");
+    printf("   -x        the arguments are XML or CSV responses saved from the server (which\n");
+    printf("             may be gzip compressed) instead of STATIONs\n");
+    printf("   -n N      split STATIONs among N worker processes\n");
+    printf("   -N CMD    start the workers of -n with the shell command CMD (e.g.\n");
+    printf("             'ssh host metar') instead of forking\n");
+    printf("   -W        work for a sharded sweep, writing the results to standard output\n");
+    printf("   -P NAME   publish the newest report of every station in the shared memory\n");
+    printf("             table NAME, for local readers\n");
+    printf("   -R NAME   print the reports of STATIONs published in the table NAME\n");
+    printf("   --bbox MINLAT,MINLON,MAXLAT,MAXLON  print the reports of every station in\n");
+    printf("             the box, fetched with a single request\n");
+    printf("   --radius LAT,LON,NM  print the reports of every station within NM nautical\n");
+    printf("             miles of LAT,LON, fetched with a single request\n");
+    printf("   --backfill FROM,TO[,HOURS]  print every report of STATIONs observed between\n");
+    printf("             FROM and TO, fetched HOURS (default: %d) at a time\n", BACKFILL_WINDOW_HOURS);
+    printf("   --checkpoint FILE  save the progress of --backfill in FILE and resume from it\n");
+    printf("   --stations FILE  request only the STATIONs listed in FILE (one per line,\n");
+    printf("             e.g. the station list of the server); others are reported invalid\n");
+    printf("   --rate [HOST=]N[,BURST]  send at most N requests per second to HOST (every\n");
+    printf("             host if not given), with bursts of up to BURST requests\n");
+    printf("   --timeout SECS  give up a request after SECS seconds (default: 60, 0 for none)\n");
+    printf("   --retries N  retry a request failing because of the server or the network\n");
+    printf("             up to N times, waiting longer every time (default: 2)\n");
+    printf("   --hedge   send a request again once it is slower than 95%% of the recent\n");
+    printf("             ones, and take the first answer\n");
+    printf("   --trace FILE  save when every download, parse, decode and output of the\n");
+    printf("             threads ran to FILE, for chrome://tracing or ui.perfetto.dev\n");
+    printf("   --where EXPR  print only the reports satisfying EXPR, e.g. 'gust > 30 or TS\n");
+    printf("             or vis < 3SM' (see the manual page for the fields and weather)\n");
 	printf("   -h        show this help\n");
 	printf("   -v        be verbose\n");
 	printf("Example: %s -d ehgr\n", name);
+	printf("         %s -c -f metars.txt\n", name);
+	printf("         %s -s history -q 2016-10-01,2016-10-15T12:00Z kjfk\n", name);
+	printf("         %s -a 24 -f metars.txt\n", name);
+	printf("         %s -e metars.bin -f metars.txt\n", name);
+	printf("         %s -w 300 -s history kjfk ehgr\n", name);
+	printf("         %s -n 4 -s history $(cat stations.txt)\n", name);
+	printf("         %s -w 300 -P metar kjfk ehgr & %s -R metar -d kjfk\n", name, name);
+	printf("         %s -c --bbox 51,3,54,7.5\n", name);
+	printf("         %s --where 'category >= IFR' -f metars.txt\n", name);
+	printf("         %s -s history --backfill 2016-10-01,2016-10-15 --checkpoint bf kjfk\n", name);
 }
 
 
-/* place NOAA data in buffer */
-int cpReceivedData(void *buffer, size_t size, size_t nmemb, void *stream) {
+/* append NOAA data to the buffer of the request */
+size_t cpReceivedData(void *data, size_t size, size_t nmemb, void *stream) {
+	buffer_t *buf = stream;
+	size_t grow;
+	char *p;
+
 	size *= nmemb;
-	size = (size <= METAR_MAXSIZE) ? size : METAR_MAXSIZE;
-	strncpy(noaabuffer, buffer, size);
-	return (int) size;
+	/* A response that does not fit METAR_MAXSIZE cannot be the report of a single station */
+	if (buf->len + size >= (buf->max ? buf->max : METAR_MAXSIZE))
+		return 0;
+	if (buf->len + size >= buf->size) {
+		grow = buf->size ? buf->size : 1024;
+		while (grow <= buf->len + size)
+			grow *= 2;
+		if ((p = realloc(buf->data, grow)) == NULL)
+			return 0;
+		buf->data = p;
+		buf->size = grow;
+	}
+	memcpy(buf->data + buf->len, data, size);
+	buf->len += size;
+	buf->data[buf->len] = 0;
+	return size;
 }
 
 
-/* fetch NOAA report
- * returns 0 for success, 1 for an error*/
-int download_Metar(char *station) {
-    CURL *curlhandle = NULL;
-	CURLcode res;
-    char url[URL_MAXSIZE];
-	char tmp[URL_MAXSIZE];
-    int retval = 0;
-
-    curlhandle = curl_easy_init();
-	if (!curlhandle) return 1;
+/* copy the URL reports are fetched from into url, which holds URL_MAXSIZE characters */
+void base_Url(char *url) {
+	char *format;
 
-	memset(tmp, 0x0, URL_MAXSIZE);
+	memset(url, 0x0, URL_MAXSIZE);
 	if (getenv("METARURL") == NULL) {
-		strncpy(tmp, METARURL, URL_MAXSIZE);
-        tmp[URL_MAXSIZE-1]=0;
+		strncpy(url, METARURL, URL_MAXSIZE);
+        url[URL_MAXSIZE-1]=0;
 	} else {
-		strncpy(tmp, getenv("METARURL"), URL_MAXSIZE);
-        tmp[URL_MAXSIZE-1]=0;
-        if (verbose) printf("Using environment variable METARURL: %s\n", tmp);
+		strncpy(url, getenv("METARURL"), URL_MAXSIZE);
+        url[URL_MAXSIZE-1]=0;
+        if (verbose) printf("Using environment variable METARURL: %s\n", url);
 	}
 
-    if (snprintf(url, URL_MAXSIZE, "%s%s", tmp, strupc(station)) < 0)
+    if (request_csv && (format = strstr(url, "format=xml")) != NULL)
+        memcpy(format + strlen("format="), "csv", 3);
+}
+
+
+/* remove the query parameter name= (e.g. "stationString=") from url */
+void remove_Param(char *url, const char *name) {
+    char *param, *end;
+
+    if ((param = strstr(url, name)) != NULL) {
+        end = param + strcspn(param, "&");
+        if (*end == '&') end++;
+        memmove(param, end, strlen(end) + 1);
+    }
+}
+
+
+/* Narrow down a query to the time window, unless it has one already.
+ * Other URLs, such as files, cannot be narrowed down. */
+void add_Window(char *url, time_t since) {
+    size_t len = strlen(url);
+
+    if (strchr(url, '?') != NULL && strstr(url, "hoursBeforeNow") == NULL && strstr(url, "startTime") == NULL) {
+        if (since == -1)
+            snprintf(url + len, URL_MAXSIZE - len, METARURL_WINDOW);
+        else
+            snprintf(url + len, URL_MAXSIZE - len, METARURL_SINCE, (long) since + 1, (long) time(NULL));
+    }
+}
+
+
+/* tell whether a failed transfer is a sign of an overloaded server */
+int curl_Outcome(CURLcode res) {
+    switch (res) {
+        case CURLE_OPERATION_TIMEDOUT:
+        case CURLE_COULDNT_CONNECT:
+        case CURLE_SEND_ERROR:
+        case CURLE_RECV_ERROR:
+        case CURLE_GOT_NOTHING:
+        case CURLE_PARTIAL_FILE:
+            return THROTTLE_OVERLOAD;
+        default:
+            return THROTTLE_NEUTRAL;
+    }
+}
+
+
+/* a transfer of download_Once(): the request, or the hedge sent after it */
+typedef struct {
+    CURL *handle;
+    throttle_ticket_t ticket;
+    int running;
+    CURLcode res;
+    long status;
+} transfer_t;
+
+/* start fetching url into buf on multi
+ * returns 0 for success, 1 for an error */
+int start_Transfer(CURLM *multi, transfer_t *tr, const char *url, buffer_t *buf) {
+    buf->len = 0;
+    if (buf->data != NULL) buf->data[0] = 0;
+    tr->res = CURLE_OK;
+    tr->status = 0;
+
+    if ((tr->handle = curl_easy_init()) == NULL)
         return 1;
-	if (verbose) printf("Retrieving URL %s\n", url);
+    curl_easy_setopt(tr->handle, CURLOPT_URL, url);
+	curl_easy_setopt(tr->handle, CURLOPT_FOLLOWLOCATION, 1);
+	curl_easy_setopt(tr->handle, CURLOPT_NOSIGNAL, 1);   // several downloads run in parallel
+	/* offer every encoding curl supports; it decompresses while receiving */
+	curl_easy_setopt(tr->handle, CURLOPT_ACCEPT_ENCODING, "");
+	curl_easy_setopt(tr->handle, CURLOPT_WRITEFUNCTION, cpReceivedData);
+	curl_easy_setopt(tr->handle, CURLOPT_WRITEDATA, buf);
+	curl_easy_setopt(tr->handle, CURLOPT_PRIVATE, (char *) tr);
+	if (request_timeout > 0)
+		curl_easy_setopt(tr->handle, CURLOPT_TIMEOUT_MS, (long) (request_timeout * 1000));
+    if (curl_multi_add_handle(multi, tr->handle) != CURLM_OK) {
+        curl_easy_cleanup(tr->handle);
+        return 1;
+    }
+    tr->running = 1;
+    return 0;
+}
 
-    curl_easy_setopt(curlhandle, CURLOPT_URL, url);
-	curl_easy_setopt(curlhandle, CURLOPT_FOLLOWLOCATION, 1);
-	curl_easy_setopt(curlhandle, CURLOPT_WRITEFUNCTION, cpReceivedData);
-	memset(noaabuffer, 0x0, METAR_MAXSIZE);
 
-	res = curl_easy_perform(curlhandle);
-    if (res == CURLE_WRITE_ERROR) {
+/* what a finished transfer tells about the load of the server (THROTTLE_*);
+ * a transfer that is THROTTLE_OK has the answer */
+int transfer_Outcome(const transfer_t *tr) {
+    if (tr->res == CURLE_OK)
+        return tr->status == 429 || tr->status >= 500 ? THROTTLE_OVERLOAD : THROTTLE_OK;
+    /* a response too large for the buffer is an answer too, see download_Once() */
+    if (tr->res == CURLE_WRITE_ERROR)
+        return THROTTLE_OK;
+    return curl_Outcome(tr->res);
+}
+
+
+/* seconds on the clock of the throttle */
+double clock_Seconds(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/* Fetch url into buf once. With --hedge, a request taking longer than
+ * HEDGE_QUANTILE of the recent ones is sent again, if the throttle lets it,
+ * and the first answer is taken. An error is written into error (holding
+ * ERROR_SIZE characters), and retryable tells whether it may pass.
+ * returns JOB_OK for success, JOB_INVALID if the response is too large, JOB_FAILED for an error */
+int download_Once(const char *url, const char *what, buffer_t *buf, int may_hedge,
+                  char *error, int *retryable) {
+    transfer_t tr[2];       // the request and its hedge
+    transfer_t *t, *answer = NULL, *failed = NULL;
+    buffer_t hedge_buf, swap;
+    CURLM *multi;
+    CURLMsg *msg;
+    curl_off_t retry_after;
+    double hedge_after = 0, elapsed;
+    uint64_t wait;
+    int started = 0, running, msgs, outcome, timeout_ms, i;
+    int retval = JOB_OK;
+
+    *retryable = 0;
+    memset(tr, 0, sizeof(tr));
+    memset(&hedge_buf, 0, sizeof(hedge_buf));
+    hedge_buf.max = buf->max;
+    if ((multi = curl_multi_init()) == NULL) {
+        snprintf(error, ERROR_SIZE, "Unable to start a transfer for %s", what);
+        return JOB_FAILED;
+    }
+
+	wait = trace_begin();
+	throttle_acquire(throttle, url, &tr[0].ticket);
+	trace_end("throttle", what, wait);
+    if (start_Transfer(multi, &tr[0], url, buf)) {
+        throttle_release(throttle, &tr[0].ticket, THROTTLE_NEUTRAL, 0);
+        curl_multi_cleanup(multi);
+        snprintf(error, ERROR_SIZE, "Unable to start a transfer for %s", what);
+        return JOB_FAILED;
+    }
+    started = 1;
+    if (hedge && may_hedge)
+        hedge_after = throttle_latency(throttle, HEDGE_QUANTILE);
+
+    for (;;) {
+        curl_multi_perform(multi, &running);
+        while ((msg = curl_multi_info_read(multi, &msgs)) != NULL) {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **) &t);
+            t->running = 0;
+            t->res = msg->data.result;
+            curl_easy_getinfo(t->handle, CURLINFO_RESPONSE_CODE, &t->status);
+            retry_after = 0;
+#if LIBCURL_VERSION_NUM >= 0x074200
+            if (t->res == CURLE_OK && (t->status == 429 || t->status >= 500))
+                curl_easy_getinfo(t->handle, CURLINFO_RETRY_AFTER, &retry_after);
+#endif
+            outcome = transfer_Outcome(t);
+            throttle_release(throttle, &t->ticket, outcome, (double) retry_after);
+            if (outcome == THROTTLE_OK && answer == NULL) answer = t;
+            else if (failed == NULL) failed = t;
+        }
+        /* done once there is an answer, or nothing is left running */
+        if (answer != NULL || (!tr[0].running && !tr[1].running))
+            break;
+
+        timeout_ms = 1000;
+        if (hedge_after > 0 && started == 1) {
+            elapsed = clock_Seconds() - tr[0].ticket.start;
+            if (elapsed < hedge_after) {
+                timeout_ms = (int) ((hedge_after - elapsed) * 1000) + 1;
+            } else if (throttle_try_acquire(throttle, url, &tr[1].ticket) == 0) {
+                if (start_Transfer(multi, &tr[1], url, &hedge_buf) == 0) {
+                    started = 2;
+                    if (verbose) printf("Hedging the request for %s after %.3f seconds\n", what, elapsed);
+                    continue;
+                }
+                throttle_release(throttle, &tr[1].ticket, THROTTLE_NEUTRAL, 0);
+                hedge_after = 0;
+            } else {
+                timeout_ms = 10;     // the throttle has no room yet
+            }
+        }
+        curl_multi_wait(multi, NULL, 0, timeout_ms, NULL);
+    }
+
+    /* the transfer that lost is abandoned */
+    for (i = 0; i < started; i++) {
+        if (tr[i].running)
+            throttle_release(throttle, &tr[i].ticket, THROTTLE_NEUTRAL, 0);
+        curl_multi_remove_handle(multi, tr[i].handle);
+        curl_easy_cleanup(tr[i].handle);
+    }
+    curl_multi_cleanup(multi);
+
+    if (answer == &tr[1]) {
+        /* the hedge answered first; its response goes to the caller */
+        swap = *buf;
+        buf->data = hedge_buf.data;
+        buf->len = hedge_buf.len;
+        buf->size = hedge_buf.size;
+        hedge_buf = swap;
+    }
+    free(hedge_buf.data);
+
+    t = answer != NULL ? answer : failed;
+    if (t->res == CURLE_WRITE_ERROR) {
         /* If you pass a short ICAO airport code to NOAA such as "ED", the server will respond with all of the
-         * METARs for airports that begin with ED (EDDT, EDDP, EDNY ...) and will overflow the noaabuffer,
+         * METARs for airports that begin with ED (EDDT, EDDP, EDNY ...) and will overflow the buffer,
          * causing a write error.
          */
-        printf("%s is not a valid ICAO airport identifier.\n", station);
-        retval = 1;
-    } else if (res != CURLE_OK) {
-        fprintf(stderr, "ERROR #%i: %s getting data for station %s\n", res, curl_easy_strerror(res), station);
-        retval = 1;
+        retval = JOB_INVALID;
+    } else if (t->res != CURLE_OK) {
+        snprintf(error, ERROR_SIZE, "ERROR #%i: %s getting data for %s", t->res, curl_easy_strerror(t->res), what);
+        retval = JOB_FAILED;
+        *retryable = curl_Outcome(t->res) == THROTTLE_OVERLOAD;
+    } else if (t->status >= 400) {
+        /* the body is an error page, no report; only Too Many Requests and
+         * server errors may pass */
+        snprintf(error, ERROR_SIZE, "ERROR: HTTP status %ld getting data for %s", t->status, what);
+        retval = JOB_FAILED;
+        *retryable = t->status == 429 || t->status >= 500;
+    }
+    return retval;
+}
+
+
+/* seconds to wait before the retry after attempt (from 0): growing
+ * exponentially up to RETRY_MAX_DELAY, of which a random half, so stations
+ * that failed together are not retried together. A Retry-After of the server
+ * is waited for by the throttle. */
+double backoff_Delay(int attempt) {
+    double ceiling = RETRY_BASE_DELAY * (double) (1u << (attempt < 16 ? attempt : 16));
+    unsigned seed = (unsigned) trace_clock();
+
+    if (ceiling > RETRY_MAX_DELAY)
+        ceiling = RETRY_MAX_DELAY;
+    return ceiling / 2 + ceiling / 2 * rand_r(&seed) / RAND_MAX;
+}
+
+
+/* fetch url into buf; what is named in error messages. A request failing
+ * because of the server or the network is retried up to retries times;
+ * may_hedge lets download_Once() hedge it.
+ * returns JOB_OK for success, JOB_INVALID if the response is too large, JOB_FAILED for an error */
+int download_Url(const char *url, const char *what, buffer_t *buf, int may_hedge) {
+    char error[ERROR_SIZE];
+    struct timespec ts;
+    uint64_t start = trace_begin();
+    double delay;
+    int attempt, retval, retryable;
+
+	if (verbose) printf("Retrieving URL %s\n", url);
+
+    for (attempt = 0; ; attempt++) {
+        retval = download_Once(url, what, buf, may_hedge, error, &retryable);
+        if (retval != JOB_FAILED || !retryable || attempt >= retries || stop_watching)
+            break;
+        delay = backoff_Delay(attempt);
+        if (verbose) printf("%s, retrying in %.1f seconds\n", error, delay);
+        ts.tv_sec = (time_t) delay;
+        ts.tv_nsec = (long) ((delay - (double) ts.tv_sec) * 1e9);
+        nanosleep(&ts, NULL);
     }
-	curl_easy_cleanup(curlhandle);
-	if (verbose) printf("Received XML:\n %s", noaabuffer);
+    if (retval == JOB_FAILED)
+        fprintf(stderr, "%s\n", error);
+	if (verbose && buf->data != NULL) printf("Received XML:\n %s", buf->data);
+	trace_end("download", what, start);
 
     return retval;
 }
 
 
+/* fetch NOAA report into buf, asking only for reports observed after since (unless -1)
+ * returns JOB_OK for success, JOB_INVALID if the station is not known, JOB_FAILED for an error */
+int download_Metar(station_id_t id, time_t since, buffer_t *buf) {
+    char station[STATION_NAME_SIZE];
+    char what[STATION_NAME_SIZE + 16];
+    char url[URL_MAXSIZE];
+	char tmp[URL_MAXSIZE];
+
+    station_name(id, station);
+    base_Url(tmp);
+    if (snprintf(url, URL_MAXSIZE, "%s%s", tmp, station) < 0)
+        return JOB_FAILED;
+    add_Window(url, since);
+
+    snprintf(what, sizeof(what), "station %s", station);
+    return download_Url(url, what, buf, 1);
+}
+
+
+/* fetch the reports of every station in the region into buf
+ * returns JOB_OK for success, JOB_FAILED for an error */
+int download_Region(buffer_t *buf) {
+    char url[URL_MAXSIZE];
+    size_t len;
+    int res;
+
+    base_Url(url);
+    if (strchr(url, '?') != NULL) {
+        /* the stations are selected by the region instead of by name */
+        remove_Param(url, "stationString=");
+        len = strlen(url);
+        if (snprintf(url + len, URL_MAXSIZE - len, "%s%s", url[len - 1] == '&' || url[len - 1] == '?' ? "" : "&",
+                     region) >= (int) (URL_MAXSIZE - len)) {
+            fprintf(stderr, "The URL for the region is too long\n");
+            return JOB_FAILED;
+        }
+        add_Window(url, -1);
+    }
+
+    buf->max = REGION_MAXSIZE;
+    if ((res = download_Url(url, "the region", buf, 0)) == JOB_INVALID) {
+        fprintf(stderr, "The response for the region is larger than %d bytes\n", REGION_MAXSIZE);
+        res = JOB_FAILED;
+    }
+    return res;
+}
+
+
+/* fetch every report of a station observed from start up to end into buf
+ * returns JOB_OK for success, JOB_FAILED for an error */
+int download_Window(station_id_t id, time_t start, time_t end, buffer_t *buf) {
+    char station[STATION_NAME_SIZE];
+    char what[STATION_NAME_SIZE + 16];
+    char url[URL_MAXSIZE];
+    char tmp[URL_MAXSIZE];
+    size_t len;
+    int res;
+
+    station_name(id, station);
+    base_Url(tmp);
+    /* all reports of the window rather than the newest one */
+    remove_Param(tmp, "mostRecentForEachStation=");
+    if (snprintf(url, URL_MAXSIZE, "%s%s", tmp, station) >= URL_MAXSIZE)
+        return JOB_FAILED;
+    len = strlen(url);
+    if (strchr(url, '?') != NULL)
+        snprintf(url + len, URL_MAXSIZE - len, METARURL_SINCE, (long) start, (long) end - 1);
+
+    snprintf(what, sizeof(what), "station %s", station);
+    buf->max = REGION_MAXSIZE;
+    if ((res = download_Url(url, what, buf, 0)) == JOB_INVALID) {
+        fprintf(stderr, "The response for station %s is larger than %d bytes\n", station, REGION_MAXSIZE);
+        res = JOB_FAILED;
+    }
+    return res;
+}
+
+
+/* read an XML or CSV response saved from the server into buf. The file may be gzip
+ * compressed; it is decompressed while reading.
+ * returns JOB_OK for success, JOB_INVALID if it is too large to hold one report, JOB_FAILED for an error */
+int read_Response(const char *filename, buffer_t *buf) {
+	char chunk[METAR_MAXSIZE];
+	gzFile gz;
+	int n;
+
+	buf->len = 0;
+	if (buf->data != NULL) buf->data[0] = 0;
+
+	if (strcmp(filename, "-") == 0) gz = gzdopen(dup(STDIN_FILENO), "rb");
+	else gz = gzopen(filename, "rb");
+	if (gz == NULL) {
+		perror(filename);
+		return JOB_FAILED;
+	}
+
+	while ((n = gzread(gz, chunk, sizeof(chunk))) > 0) {
+		if (cpReceivedData(chunk, 1, (size_t) n, buf) != (size_t) n) {
+			gzclose(gz);
+			return JOB_INVALID;
+		}
+	}
+	if (n < 0) {
+		fprintf(stderr, "%s: %s\n", filename, gzerror(gz, &n));
+		gzclose(gz);
+		return JOB_FAILED;
+	}
+	gzclose(gz);
+	if (verbose && buf->data != NULL) printf("Read XML:\n %s", buf->data);
+	return JOB_OK;
+}
+
+
 /* decode metar */
-// FIXME print flight category here also - may need to pass NOAA_t into the function.
-void decode_Metar(metar_t metar) {
+void decode_Metar(FILE *out, metar_t metar) {
 	cloud_list_t *curcloud;
 	phenomena_list_t   *curphenomenon;
 	int n = 0;
 	double qnh;
+	char station[STATION_NAME_SIZE];
 
-	printf("Station       : %s\n", metar.station);
-	printf("Day           : %i\n", metar.day);
-	printf("Time          : %02i:%02i UTC\n", metar.time/100, metar.time%100);
+	fprintf(out, "Station       : %s\n", station_name(metar.station, station));
+	fprintf(out, "Day           : %i\n", metar.day);
+	fprintf(out, "Time          : %02i:%02i UTC\n", metar.time/100, metar.time%100);
 	if (metar.winddir == -1) {
-		printf("Wind direction: Variable\n");
+		fprintf(out, "Wind direction: Variable\n");
 	} else {
 		static const char *winddirs[] = {
 			"N", "NNE", "NE", "ENE", "E", "ESE", "SE", "SSE",
 			"S", "SSW", "SW", "WSW", "W", "WNW", "NW", "NNW"
 	};
 	n = ((metar.winddir * 4 + 45) / 90) % 16;
-	printf("Wind direction: %i (%s)\n", metar.winddir, winddirs[n]);
+	fprintf(out, "Wind direction: %i (%s)\n", metar.winddir, winddirs[n]);
+	}
+	fprintf(out, "Wind speed    : %i %s\n", metar.windstr, metar.windunit);
+	fprintf(out, "Wind gust     : %i %s\n", metar.windgust, metar.windunit);
+	if (metar.visfrac) {
+		/* reduce the sixteenths to the fraction used in the report */
+		int num = metar.visfrac, den = 16;
+		while (num % 2 == 0 && den > 1) {
+			num /= 2;
+			den /= 2;
+		}
+		if (metar.vis) fprintf(out, "Visibility    : %i %i/%i %s\n", metar.vis, num, den, metar.visunit);
+		else fprintf(out, "Visibility    : %i/%i %s\n", num, den, metar.visunit);
+	} else {
+		fprintf(out, "Visibility    : %i %s\n", metar.vis, metar.visunit);
 	}
-	printf("Wind speed    : %i %s\n", metar.windstr, metar.windunit);
-	printf("Wind gust     : %i %s\n", metar.windgust, metar.windunit);
-	printf("Visibility    : %i %s\n", metar.vis, metar.visunit);
-	printf("Temperature   : %i C\n", metar.temp);
-	printf("Dewpoint      : %i C\n", metar.dewp);
+	fprintf(out, "Temperature   : %i C\n", metar.temp);
+	fprintf(out, "Dewpoint      : %i C\n", metar.dewp);
 
 	qnh = metar.qnh;
 	for (n = 0; n < metar.qnhfp; n++)
 		qnh /= 10.0;
-	printf("Pressure      : %.*f %s\n", metar.qnhfp, qnh, metar.qnhunit);
+	fprintf(out, "Pressure      : %.*f %s\n", metar.qnhfp, qnh, metar.qnhunit);
 		
-	printf("Clouds        : ");
+	fprintf(out, "Clouds        : ");
 	n = 0;
 	for (curcloud = metar.clouds; curcloud != NULL; curcloud=curcloud->next) {
 		if (n++ == 0) {
             // print the first cloud layer OR that no clouds were detected
             if(curcloud->cloud->print_altitude == PRINT_BASE) {
-                printf("%s at %d00 ft%s\n",
+                fprintf(out, "%s at %d00 ft%s\n",
                        curcloud->cloud->amount,
                        curcloud->cloud->layer_altitude,
                        curcloud->cloud->layer_modifier);
             } else {
                 // There were no clouds reported, don't print layer_altitude
-                printf("%s%s\n", curcloud->cloud->amount, curcloud->cloud->layer_modifier);
+                fprintf(out, "%s%s\n", curcloud->cloud->amount, curcloud->cloud->layer_modifier);
             }
         }
-		else printf("%15s %s at %d00 ft%s\n",
+		else fprintf(out, "%15s %s at %d00 ft%s\n",
 				" ",curcloud->cloud->amount, curcloud->cloud->layer_altitude, curcloud->cloud->layer_modifier);
 	}
-	if (!n) printf("\n");
+	if (!n) fprintf(out, "\n");
 
-	printf("Phenomena     : ");
+	if (metar.ceiling == NO_CEILING) fprintf(out, "Ceiling       : None\n");
+	else fprintf(out, "Ceiling       : %d ft\n", metar.ceiling * 100);
+
+	if (metar.category != FLIGHT_CATEGORY_UNKNOWN)
+		fprintf(out, "Category      : %s\n", flight_category_name(metar.category));
+
+	fprintf(out, "Phenomena     : ");
 	n = 0;
 	for (curphenomenon = metar.phenomena; curphenomenon != NULL; curphenomenon=curphenomenon->next) {
-		if (n++ == 0) printf("%s\n", curphenomenon->phenomena);
-		else printf("%15s %s\n", " ",curphenomenon->phenomena);
+		if (n++ == 0) fprintf(out, "%s\n", curphenomenon->phenomena);
+		else fprintf(out, "%15s %s\n", " ",curphenomenon->phenomena);
 	}
-	if (!n) printf("\n");
+	if (!n) fprintf(out, "\n");
 
     if (metar.maintenance_needed == MAINTENANCE_NEEDED){
-        printf("WARNING: Maintenance is needed on this station.\n");
+        fprintf(out, "WARNING: Maintenance is needed on this station.\n");
 
     }
-    printf("\n");
+    fprintf(out, "\n");
 }
 
 
-int main(int argc, char* argv[]) {
-	int  res=0;
-    char *station_id;
-	metar_t metar;
-	noaa_t  noaa;
+/* Print an observation, or pass it to the aggregation (-a) or the binary
+ * stream (-e). ctx is the decoded report if the caller has it, NULL to decode
+ * it for -d. This is also the callback for observations found in the store.
+ * returns 0 for success, 1 for an error */
+int output_Observation(const obs_record_t *rec, const char *report, void *ctx) {
+	char date[36];
+	time_t obs_time = (time_t) rec->obs_time;
+	struct tm tm;
+	const metar_t *metar = ctx;
 
-	/* get options */
-	opterr=0;
-	if (argc == 1) {
-		usage(argv[0]);
+	if (aggregate_hours)
+		return obs_array_add(&observations, rec);
+
+	if (encoder != NULL)
+		return codec_encode(encoder, rec, report);
+
+	if (datetime) {
+		gmtime_r(&obs_time, &tm);
+		strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%SZ", &tm);
+		printf("%s ", date);
+	}
+	printf("%.*s", (int) rec->report_len, report);
+	if (category && rec->category != FLIGHT_CATEGORY_UNKNOWN)
+		printf(" %s", flight_category_name(rec->category));
+	printf("\n");
+
+	if (decode) {
+		if (metar != NULL || (metar = metar_cache_decode_n(cache, report, rec->report_len)) != NULL)
+			decode_Metar(stdout, *metar);
+	}
+	return 0;
+}
+
+
+/* Decode one line of a file of raw METARs, which may start with the
+ * observation time as printed by the -t option. The line is not modified.
+ * returns 0 for success, 1 if the observation could not be stored and -1
+ * for an error that ends the file */
+int decode_Line(const char *line, size_t len) {
+	const char *text = line, *p;
+	time_t obs_time = -1;
+	const metar_t *metar;
+	metar_t filtered;
+	obs_record_t rec;
+	int retval = 0;
+
+	while (len > 0 && (line[len - 1] == '\r' || line[len - 1] == '\n'))
+		len--;
+	if (len == 0)
+		return 0;
+
+	/* skip the date and time (2016-10-14 17:51:00Z) in front of the report */
+	if (isdigit((unsigned char) line[0]) && (obs_time = parse_date_n(line, len)) != -1) {
+		if ((p = memchr(line, ' ', len)) == NULL ||
+			(p = memchr(p + 1, ' ', len - (size_t) (p + 1 - line))) == NULL)
+			return 0;
+		text = p + 1;
+		len -= (size_t) (text - line);
+	}
+	/* a report does not fit a record beyond this */
+	if (len >= sizeof(((noaa_t *)0)->report))
+		len = sizeof(((noaa_t *)0)->report) - 1;
+
+	/* a report satisfying --where is decoded only once, by the filter */
+	if (filter != NULL) {
+		if (!filter_decode(filter, text, len, &filtered))
+			return 0;
+		metar = &filtered;
+	} else if ((metar = metar_cache_decode_n(cache, text, len)) == NULL) {
+		return -1;
+	}
+
+	if (obs_time == -1)
+		obs_time = metar_time(metar, time(NULL));
+	obs_from_metar(&rec, metar, obs_time, len);
+
+	if (store != NULL && store_append(store, &rec, text))
+		retval = 1;
+
+	if (output_Observation(&rec, text, (void *) metar))
+		retval = -1;
+	if (metar == &filtered)
+		free_Metar(&filtered);
+	return retval;
+}
+
+
+/* Decode the raw METARs in a file, one report per line. No XML is involved,
+ * so the flight category is always computed locally. A regular file is
+ * mapped into memory and decoded in place, without copying the lines.
+ * returns 0 for success, 1 for an error */
+int decode_File(char *filename) {
+	FILE *fp;
+	char line[sizeof(((noaa_t *)0)->report)];
+	struct stat st;
+	const char *data, *p, *end, *eol;
+	int fd, res = 0, retval = 0;
+
+	if (strcmp(filename, "-") != 0) {
+		if ((fd = open(filename, O_RDONLY)) < 0) {
+			perror(filename);
+			return 1;
+		}
+		if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+			if (st.st_size == 0) {
+				close(fd);
+				return 0;
+			}
+			data = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			close(fd);
+			if (data == MAP_FAILED) {
+				perror(filename);
+				return 1;
+			}
+			madvise((void *) data, (size_t) st.st_size, MADV_SEQUENTIAL);
+
+			end = data + st.st_size;
+			for (p = data; p < end && res >= 0; p = eol + 1) {
+				if ((eol = memchr(p, '\n', (size_t) (end - p))) == NULL)
+					eol = end;
+				if ((res = decode_Line(p, (size_t) (eol - p))) != 0)
+					retval = 1;
+			}
+			munmap((void *) data, (size_t) st.st_size);
+			return retval;
+		}
+		/* pipes and the like are read line by line */
+		if ((fp = fdopen(fd, "r")) == NULL) {
+			perror(filename);
+			close(fd);
+			return 1;
+		}
+	} else {
+		fp = stdin;
+	}
+
+	while (res >= 0 && fgets(line, sizeof(line), fp) != NULL) {
+		if ((res = decode_Line(line, strlen(line))) != 0)
+			retval = 1;
+	}
+
+	if (fp != stdin)
+		fclose(fp);
+	return retval;
+}
+
+
+/* Read the observations from a binary stream written with -e.
+ * returns 0 for success, 1 for an error */
+int replay_File(char *filename) {
+	FILE *fp;
+	codec_t *decoder;
+	obs_record_t rec;
+	char report[CODEC_MAX_REPORT + 1];
+	metar_t filtered;
+	int res, failed, retval = 0;
+
+	if (strcmp(filename, "-") == 0) {
+		fp = stdin;
+	} else if ((fp = fopen(filename, "rb")) == NULL) {
+		perror(filename);
 		return 1;
 	}
 
-	while ((res = getopt(argc, argv, "hvdltc")) != -1) {
-		switch (res) {
-            case 'l':
-				location=1;
-				break;
-			case 't':
-                datetime=1;
-				break;
-			case 'd':
-				decode=1;
-				break;
-            case 'c':
-                category=1;
-                break;
-			case 'v':
-				verbose=1;
+	if ((decoder = codec_decoder_new(fp)) == NULL) {
+		retval = 1;
+	} else {
+		while ((res = codec_decode(decoder, &rec, report)) > 0) {
+			if (filter != NULL && !filter_decode(filter, report, rec.report_len, &filtered))
+				continue;
+			if (store != NULL && store_append(store, &rec, report))
+				retval = 1;
+			failed = output_Observation(&rec, report, filter != NULL ? &filtered : NULL);
+			if (filter != NULL)
+				free_Metar(&filtered);
+			if (failed) {
+				retval = 1;
 				break;
-            case '?':
-            case 'h':
-            default:
-                usage(argv[0]);
-                return 1;
+			}
 		}
+		if (res < 0) {
+			fprintf(stderr, "%s: corrupt observation stream after %lu observations\n", filename, decoder->records);
+			retval = 1;
+		}
+		codec_free(decoder);
 	}
-    
-    curl_global_init(CURL_GLOBAL_DEFAULT);
 
-	// clear out metar and noaa
-	memset(&metar, 0x0, sizeof(metar_t));
-	memset(&noaa, 0x0, sizeof(noaa_t));
-
-	while (optind < argc) {
-        station_id = argv[optind++];
-		res = download_Metar(station_id);
-        if (res == 0) {
-			if(!parse_NOAA_data(noaabuffer, &noaa)){
-                /* print spaces for the date and time if that option is enabled */
-                if(datetime) printf("                     ");
-                printf("%s is not a valid ICAO airport identifier.\n", station_id);
-                continue;
-            }
+	if (fp != stdin)
+		fclose(fp);
+	return retval;
+}
 
 
-			if(datetime){
-                printf("%s ", noaa.date);
-            }
+/* flush and close the binary stream, the store and the cache
+ * returns 0 for success, 1 for an error */
+int close_Outputs(FILE *encodefp) {
+	int retval = 0;
+
+	if (encoder != NULL) {
+		if (verbose) printf("Encoded %lu observations in %lu bytes\n", encoder->records, encoder->bytes);
+		codec_free(encoder);
+		encoder = NULL;
+	}
+	if (encodefp != NULL && fclose(encodefp) != 0) {
+		perror("encoded stream");
+		retval = 1;
+	}
+	metar_cache_free(cache);
+	cache = NULL;
+	store_close(store);
+	store = NULL;
+	filter_free(filter);
+	filter = NULL;
+	station_set_free(known_stations);
+	known_stations = NULL;
+	throttle_free(throttle);
+	throttle = NULL;
+	if (trace_file != NULL && trace_write(trace_file))
+		retval = 1;
+	return retval;
+}
 
-            printf("%s", noaa.report);
 
-            if(category){
-                printf(" %s", noaa.category); /* if selected, this is printed at the end of the raw METAR */
-            }
+/* aggregate the collected observations and print the statistics
+ * returns 0 for success, 1 for an error */
+int print_Aggregates(void) {
+	agg_t *rows;
+	long n, i;
+	char date[36];
+	char station[STATION_NAME_SIZE];
+	time_t bucket;
+	struct tm tm;
 
-            printf("\n");
+	n = aggregate(&observations, aggregate_hours, threads, &rows);
+	obs_array_free(&observations);
+	if (n < 0)
+		return 1;
 
-            if (decode) {
-                parse_Metar(noaa.report, &metar);
-                decode_Metar(metar);
-                //FIXME cleanup all the things that were malloc'ed in the metar struct (phenomena, clouds ...)
-            }
+	printf("Station Period            Count TempMin TempMax TempMean WindMax GustMax IFRHours\n");
+	for (i = 0; i < n; i++) {
+		bucket = (time_t) rows[i].bucket;
+		gmtime_r(&bucket, &tm);
+		strftime(date, sizeof(date), "%Y-%m-%d %H:%MZ", &tm);
+		printf("%-7s %s %5d ", station_name(rows[i].station, station), date, rows[i].count);
+		/* reports without a temperature group do not count for the temperatures */
+		if (rows[i].temp_count > 0)
+			printf("%7d %7d %8.1f", rows[i].temp_min, rows[i].temp_max, (double) rows[i].temp_sum / rows[i].temp_count);
+		else
+			printf("%7s %7s %8s", "-", "-", "-");
+		printf(" %7d %7d %8d\n", rows[i].wind_max, rows[i].gust_max, agg_ifr_hours(&rows[i]));
+	}
+	free(rows);
+	return 0;
+}
 
-            if(location) {
-                printf("Lat, Lon      : %.3f, %.3f\n", noaa.latitude, noaa.longitude);
-                printf("Elevation     : %.1f Meters, %.1f Feet\n",
-                       noaa.elevation_m,
-                       meters_to_feet(noaa.elevation_m));
-            }
 
+/* convert a command line time (a date or seconds since the epoch) */
+time_t parse_time_arg(const char *arg) {
+	char *end;
+	long seconds;
+
+	if (strchr(arg, '-') != NULL)
+		return parse_date(arg);
+	seconds = strtol(arg, &end, 10);
+	if (end == arg || *end != 0)
+		return -1;
+	return (time_t) seconds;
+}
+
+
+/* output_Observation() for the observations in the store satisfying --where */
+int filter_Observation(const obs_record_t *rec, const char *report, void *ctx) {
+	metar_t filtered;
+	int retval;
+
+	if (filter == NULL)
+		return output_Observation(rec, report, ctx);
+	if (!filter_decode(filter, report, rec->report_len, &filtered))
+		return 0;
+	retval = output_Observation(rec, report, &filtered);
+	free_Metar(&filtered);
+	return retval;
+}
+
+/* print the stored observations of the stations between the times given as FROM,TO
+ * returns 0 for success, 1 for an error */
+int query_Store(char *window, char **stations, int num_stations) {
+	char *comma = strchr(window, ',');
+	time_t from, to;
+	int i, retval = 0;
+
+	if (comma == NULL) {
+		fprintf(stderr, "Query window must be given as FROM,TO\n");
+		return 1;
+	}
+	*comma = 0;
+	from = parse_time_arg(window);
+	to = parse_time_arg(comma + 1);
+	if (from == -1 || to == -1) {
+		fprintf(stderr, "Invalid query window %s,%s\n", window, comma + 1);
+		return 1;
+	}
+
+	for (i = 0; i < num_stations; i++) {
+		station_id_t id = station_id(stations[i]);
+		if (id == STATION_ID_NONE) {
+			fprintf(stderr, "%s is not a valid station identifier.\n", stations[i]);
+			retval = 1;
+		} else if (store_query(store, id, from, to, filter_Observation, NULL)) {
+			retval = 1;
 		}
 	}
-    
-    return 0;
+	return retval;
+}
+
+
+/* download the stations in command line order until they are all taken */
+void *fetch_Worker(void *arg) {
+	pipeline_t *p = arg;
+	job_t *job;
+	unsigned long seq;
+	uint64_t start;
+
+	trace_thread("fetch");
+	/* take a free job before a station, so the stations in the pipeline are
+	 * always the oldest ones the output stage is waiting for */
+	while ((job = queue_pop(&p->free)) != NULL) {
+		seq = atomic_fetch_add(&p->next_seq, 1);
+		if (seq >= p->num_stations) {
+			queue_push(&p->free, job);
+			break;
+		}
+		job->seq = seq;
+		job->station_arg = p->stations[seq];
+		job->have_rec = 0;
+		job->since = p->newest[seq];
+		job->obs_time = -1;
+		job->response.len = 0;
+		if (job->since == NEWEST_INVALID)
+			job->status = JOB_UNCHANGED;   // reported as invalid by an earlier poll
+		else if (xml_files) {
+			start = trace_begin();
+			job->status = read_Response(job->station_arg, &job->response);
+			trace_end("read", job->station_arg, start);
+		}
+		else if ((job->station = station_id(job->station_arg)) == STATION_ID_NONE ||
+				 (known_stations != NULL && !station_set_contains(known_stations, job->station)))
+			job->status = JOB_INVALID;   // not worth a request
+		else
+			job->status = download_Metar(job->station, job->since, &job->response);
+		queue_push(&p->fetched, job);
+	}
+	if (atomic_fetch_sub(&p->fetching, 1) == 1)
+		queue_close(&p->fetched);
+	return NULL;
+}
+
+
+/* extract the report from the XML or CSV response
+ * returns 1 for success, -1 if the response holds no reports and 0 for other errors */
+int parse_Response(buffer_t *response, noaa_t *noaa) {
+	int res;
+
+	if (response->data == NULL)
+		return 0;
+	if (!is_NOAA_csv(response->data, response->len))
+		return parse_NOAA_data(response->data, noaa);
+
+	res = parse_NOAA_csv(response->data, response->len, noaa, 1);
+	if (res > 1) {
+		if (verbose) printf("Got %i results from NOAA. Check the ICAO airport code.\n", res);
+		return 0;
+	}
+	return res;
+}
+
+
+void *parse_Worker(void *arg) {
+	pipeline_t *p = arg;
+	job_t *job;
+	uint64_t start;
+	int res;
+
+	trace_thread("parse");
+	while ((job = queue_pop(&p->fetched)) != NULL) {
+		memset(&job->noaa, 0, sizeof(noaa_t));
+		start = trace_begin();
+		if (job->status == JOB_OK && (res = parse_Response(&job->response, &job->noaa)) != 1) {
+			/* a station that had reports before has no new one */
+			if (res < 0 && job->since != -1) job->status = JOB_UNCHANGED;
+			else job->status = JOB_INVALID;
+		}
+		trace_end("parse", job->station_arg, start);
+		queue_push(&p->parsed, job);
+	}
+	if (atomic_fetch_sub(&p->parsing, 1) == 1)
+		queue_close(&p->parsed);
+	return NULL;
+}
+
+
+/* Decode the report and render what is printed for the station into its
+ * output. Every thread has its own cache of decoded reports.
+ * returns 0 for success, 1 for an error */
+int render_Station(job_t *job, metar_cache_t *worker_cache) {
+	const metar_t *metar = NULL;
+	metar_t filtered;
+	noaa_t *noaa = &job->noaa;
+	uint64_t start;
+	FILE *out;
+
+	if ((out = open_memstream(&job->output, &job->output_len)) == NULL)
+		return 1;
+
+	if (job->status == JOB_INVALID) {
+		/* print spaces for the date and time if that option is enabled */
+		if (datetime) fprintf(out, "                     ");
+		if (xml_files) fprintf(out, "%s does not contain a single METAR report.\n", job->station_arg);
+		else fprintf(out, "%s is not a valid ICAO airport identifier.\n", job->station_arg);
+	}
+	if (job->status != JOB_OK)
+		return fclose(out) != 0;
+
+	/* the server may return the last report again if no new one was issued */
+	job->obs_time = parse_date(noaa->date);
+	if (job->since != -1 && job->obs_time != -1 && job->obs_time <= job->since) {
+		job->status = JOB_UNCHANGED;
+		return fclose(out) != 0;
+	}
+
+	/* a report not satisfying --where is dropped before it is fully decoded,
+	 * one satisfying it is decoded only once, by the filter */
+	if (filter != NULL) {
+		start = trace_begin();
+		if (filter_decode(filter, noaa->report, strlen(noaa->report), &filtered))
+			metar = &filtered;
+		else
+			job->status = JOB_FILTERED;
+		trace_end("filter", job->station_arg, start);
+		if (job->status == JOB_FILTERED)
+			return fclose(out) != 0;
+	}
+
+	if (metar == NULL && (decode || store != NULL || encoder != NULL || shard_out != NULL || obs_table != NULL ||
+		(category && noaa->category[0] == 0))) {
+		start = trace_begin();
+		metar = metar_cache_decode(worker_cache, noaa->report);
+		trace_end("decode", job->station_arg, start);
+		if (metar == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			job->status = JOB_FAILED;
+			fclose(out);
+			return 1;
+		}
+	}
+
+	if (job->obs_time == -1 && metar != NULL)
+		job->obs_time = metar_time(metar, time(NULL));
+
+	/* the coordinator of a shard worker decides whether to store it */
+	if (store != NULL || encoder != NULL || shard_out != NULL || obs_table != NULL) {
+		obs_from_metar(&job->rec, metar, job->obs_time, strlen(noaa->report));
+		job->have_rec = 1;
+	}
+
+	/* with -e the observation goes to the binary stream instead of the screen */
+	if (encoder != NULL)
+		goto done;
+
+	if (datetime) {
+		fprintf(out, "%s ", noaa->date);
+	}
+
+	fprintf(out, "%s", noaa->report);
+
+	if (category) {
+		/* if selected, this is printed at the end of the raw METAR. Fall back to
+		 * the locally computed category when NOAA did not provide one. */
+		if (noaa->category[0] != 0) fprintf(out, " %s", noaa->category);
+		else if (metar->category != FLIGHT_CATEGORY_UNKNOWN) fprintf(out, " %s", flight_category_name(metar->category));
+	}
+
+	fprintf(out, "\n");
+
+	if (decode) {
+		decode_Metar(out, *metar);
+	}
+
+	if (location) {
+		fprintf(out, "Lat, Lon      : %.3f, %.3f\n", noaa->latitude, noaa->longitude);
+		fprintf(out, "Elevation     : %.1f Meters, %.1f Feet\n",
+				noaa->elevation_m,
+				meters_to_feet(noaa->elevation_m));
+	}
+
+done:
+	if (metar == &filtered)
+		free_Metar(&filtered);
+	return fclose(out) != 0;
+}
+
+
+void *decode_Worker(void *arg) {
+	pipeline_t *p = arg;
+	metar_cache_t *worker_cache = metar_cache_new((size_t) cache_size);
+	job_t *job;
+	uint64_t start;
+
+	trace_thread("decode");
+	while ((job = queue_pop(&p->parsed)) != NULL) {
+		start = trace_begin();
+		if (worker_cache == NULL || render_Station(job, worker_cache))
+			job->status = JOB_FAILED;
+		trace_end("render", job->station_arg, start);
+		queue_push(&p->decoded, job);
+	}
+	metar_cache_free(worker_cache);
+	if (atomic_fetch_sub(&p->decoding, 1) == 1)
+		queue_close(&p->decoded);
+	return NULL;
+}
+
+
+/* write the output of a station, store or encode its observation and
+ * remember its time for the next poll */
+void write_Station(pipeline_t *p, job_t *job) {
+	uint64_t start = trace_begin();
+
+	if (job->status == JOB_INVALID)
+		p->newest[job->seq] = NEWEST_INVALID;
+	else if ((job->status == JOB_OK || job->status == JOB_FILTERED) && job->obs_time > p->newest[job->seq])
+		p->newest[job->seq] = job->obs_time;
+
+	if (shard_out != NULL) {
+		/* a shard worker leaves the output and the store to its coordinator */
+		shard_stats.bytes += job->response.len;
+		switch (job->status) {
+			case JOB_OK:
+			case JOB_FILTERED:  shard_stats.ok++; break;
+			case JOB_UNCHANGED: shard_stats.unchanged++; break;
+			case JOB_INVALID:   shard_stats.invalid++; break;
+			default:            shard_stats.failed++; break;
+		}
+		if (shard_write_result(shard_out, job->seq, job->status, job->output, job->output_len,
+							   job->have_rec ? &job->rec : NULL, job->noaa.report))
+			shard_stats.failed++;
+	} else if (job->output != NULL)
+		fwrite(job->output, 1, job->output_len, stdout);
+	if (job->have_rec && obs_table != NULL && job->rec.station != STATION_ID_NONE) {
+		char name[STATION_NAME_SIZE];
+		shm_table_publish(obs_table, station_name(job->rec.station, name), &job->noaa, &job->rec);
+	}
+	if (job->have_rec && shard_out == NULL) {
+		if (store != NULL)
+			store_append(store, &job->rec, job->noaa.report);
+		if (encoder != NULL)
+			codec_encode(encoder, &job->rec, job->noaa.report);
+	}
+	free(job->output);
+	job->output = NULL;
+	job->output_len = 0;
+	trace_end("output", job->station_arg, start);
+}
+
+
+/* start count threads running fn for a stage that feeds the out queue
+ * returns the number of threads started */
+int start_Workers(pthread_t *tids, int count, void *(*fn)(void *), pipeline_t *p,
+				  atomic_int *running, queue_t *out) {
+	int i;
+
+	atomic_store(running, count);
+	for (i = 0; i < count; i++) {
+		if (pthread_create(&tids[i], NULL, fn, p) != 0) {
+			fprintf(stderr, "Unable to start thread\n");
+			break;
+		}
+	}
+	/* the last thread of a stage closes its queue, also if not all were started */
+	if (i < count && atomic_fetch_sub(running, count - i) == count - i)
+		queue_close(out);
+	return i;
+}
+
+
+/* Fetch, parse and decode the stations in the pipeline and write the results
+ * in the order the stations were given. newest holds the time of the newest
+ * report seen of every station (-1 if none); only newer reports are printed
+ * and newest is updated.
+ * returns 0 for success, 1 for an error */
+int fetch_Stations(char **stations, int num_stations, time_t *newest) {
+	pipeline_t p;
+	pthread_t *tids;
+	job_t **pending;
+	job_t *job;
+	unsigned long next = 0, i;
+	int num_fetchers = fetch_threads, num_threads, started = 0, retval = 0;
+
+	if (num_stations <= 0)
+		return 0;
+	/* no more downloads than stations, for this call only: the next poll of
+	 * -w may have more stations due */
+	if (num_fetchers > num_stations)
+		num_fetchers = num_stations;
+
+	memset(&p, 0, sizeof(p));
+	p.stations = stations;
+	p.num_stations = (unsigned long) num_stations;
+	p.newest = newest;
+	atomic_init(&p.next_seq, 0);
+	num_threads = num_fetchers + parse_threads + decode_threads;
+	p.num_jobs = 2 * (unsigned long) num_threads;
+	if (p.num_jobs > p.num_stations) p.num_jobs = p.num_stations;
+
+	p.jobs = calloc(p.num_jobs, sizeof(job_t));
+	pending = calloc(p.num_jobs, sizeof(job_t *));
+	tids = calloc((size_t) num_threads, sizeof(pthread_t));
+	if (p.jobs == NULL || pending == NULL || tids == NULL ||
+		queue_init(&p.free, p.num_jobs) || queue_init(&p.fetched, p.num_jobs) ||
+		queue_init(&p.parsed, p.num_jobs) || queue_init(&p.decoded, p.num_jobs)) {
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < p.num_jobs; i++)
+		queue_push(&p.free, &p.jobs[i]);
+
+	started += start_Workers(tids + started, num_fetchers, fetch_Worker, &p, &p.fetching, &p.fetched);
+	started += start_Workers(tids + started, parse_threads, parse_Worker, &p, &p.parsing, &p.parsed);
+	started += start_Workers(tids + started, decode_threads, decode_Worker, &p, &p.decoding, &p.decoded);
+
+	/* A job is put at its position modulo num_jobs. The stations in the
+	 * pipeline are always the num_jobs following the next one to write, so
+	 * the positions never collide. */
+	while (next < p.num_stations) {
+		while (pending[next % p.num_jobs] == NULL) {
+			if ((job = queue_pop(&p.decoded)) == NULL)
+				break;
+			pending[job->seq % p.num_jobs] = job;
+		}
+		if ((job = pending[next % p.num_jobs]) == NULL) {
+			fprintf(stderr, "Not all stations could be retrieved\n");
+			retval = 1;
+			break;
+		}
+		pending[next % p.num_jobs] = NULL;
+		write_Station(&p, job);
+		next++;
+		queue_push(&p.free, job);
+	}
+	queue_close(&p.free);
+
+	for (i = 0; i < (unsigned long) started; i++)
+		pthread_join(tids[i], NULL);
+
+	for (i = 0; i < p.num_jobs; i++) {
+		free(p.jobs[i].response.data);
+		free(p.jobs[i].output);
+	}
+	queue_destroy(&p.free);
+	queue_destroy(&p.fetched);
+	queue_destroy(&p.parsed);
+	queue_destroy(&p.decoded);
+	free(p.jobs);
+	free(pending);
+	free(tids);
+	if (verbose) printf("Up to %d requests were sent at once\n", throttle_limit(throttle));
+	return retval;
+}
+
+
+/* reports collected from an XML response by parse_NOAA_stream() */
+typedef struct {
+	noaa_t *reports;
+	int count;
+	int size;
+} report_list_t;
+
+int collect_Report(const noaa_t *noaa, void *ctx) {
+	report_list_t *list = ctx;
+	noaa_t *grown;
+
+	if (list->count == list->size) {
+		list->size = list->size ? 2 * list->size : 256;
+		if ((grown = realloc(list->reports, (size_t) list->size * sizeof(noaa_t))) == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		list->reports = grown;
+	}
+	list->reports[list->count++] = *noaa;
+	return 0;
+}
+
+/* Parse every report of an XML or CSV response into a newly allocated array
+ * (*reports), which the caller frees. The response is modified.
+ * returns the number of reports, -1 if there are none and 0 for an error */
+int read_Reports(buffer_t *response, noaa_t **reports) {
+	report_list_t list;
+	const char *c, *end;
+	int max, n;
+
+	if (is_NOAA_csv(response->data, response->len)) {
+		/* every report takes a line at least */
+		end = response->data + response->len;
+		for (max = 1, c = response->data; (c = memchr(c, '\n', (size_t) (end - c))) != NULL; c++)
+			max++;
+		if ((*reports = malloc((size_t) max * sizeof(noaa_t))) == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		return parse_NOAA_csv(response->data, response->len, *reports, max);
+	}
+
+	memset(&list, 0, sizeof(list));
+	n = parse_NOAA_stream(response->data, response->len, collect_Report, &list);
+	*reports = list.reports;
+	return n;
+}
+
+
+/* order reports by their text, which starts with the station */
+int compare_Reports(const void *a, const void *b) {
+	return strcmp(((const noaa_t *) a)->report, ((const noaa_t *) b)->report);
+}
+
+
+/* Fetch the reports of every station in the region with a single request
+ * and write them in the order of the stations.
+ * returns 0 for success, 1 for an error */
+int fetch_Region(void) {
+	pipeline_t p;
+	buffer_t response;
+	noaa_t *reports = NULL;
+	job_t job;
+	char station[STATION_NAME_SIZE];
+	int n, i, retval = 0;
+
+	memset(&response, 0, sizeof(response));
+	if (download_Region(&response) != JOB_OK || response.data == NULL) {
+		free(response.data);
+		return 1;
+	}
+
+	n = read_Reports(&response, &reports);
+	free(response.data);
+
+	if (n == 0) {
+		fprintf(stderr, "Unable to interpret the reports of the region\n");
+		free(reports);
+		return 1;
+	}
+	if (n < 0) {
+		if (verbose) printf("No reports were found in the region\n");
+		n = 0;
+	}
+	qsort(reports, (size_t) n, sizeof(noaa_t), compare_Reports);
+
+	/* the reports are written like those of stations fetched one by one */
+	memset(&p, 0, sizeof(p));
+	p.num_stations = (unsigned long) n;
+	if ((p.newest = malloc(((size_t) n + 1) * sizeof(time_t))) == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < n; i++) {
+		memset(&job, 0, sizeof(job));
+		p.newest[i] = -1;
+		station[0] = 0;
+		sscanf(reports[i].report, "%9s", station);
+		job.seq = (unsigned long) i;
+		job.station_arg = station;
+		job.station = station_id(station);
+		job.status = JOB_OK;
+		job.since = -1;
+		job.noaa = reports[i];
+		if (render_Station(&job, cache))
+			retval = 1;
+		write_Station(&p, &job);
+	}
+	if (verbose) printf("Got %d reports for the region\n", n);
+
+	free(p.newest);
+	free(reports);
+	return retval;
+}
+
+
+/* order reports by their observation time, oldest first */
+int compare_Times(const void *a, const void *b) {
+	int res = strcmp(((const noaa_t *) a)->date, ((const noaa_t *) b)->date);
+
+	return res ? res : strcmp(((const noaa_t *) a)->report, ((const noaa_t *) b)->report);
+}
+
+/* Find where to resume a backfill from its checkpoint, which must have been
+ * written for the same stations and time range. Leaves *station and *start
+ * alone if there is no checkpoint yet.
+ * returns 0 for success, 1 for an error */
+int read_Checkpoint(time_t from, time_t to, char **stations, int num_stations,
+					int *station, time_t *start) {
+	FILE *fp;
+	char name[STATION_NAME_SIZE];
+	long saved_from, saved_to, next;
+	int index;
+
+	if ((fp = fopen(checkpoint, "r")) == NULL)
+		return 0;
+	if (fscanf(fp, "backfill %ld %ld %d %9s %ld", &saved_from, &saved_to, &index, name, &next) != 5 ||
+		saved_from != (long) from || saved_to != (long) to || index < 0 || index >= num_stations ||
+		strcasecmp(name, stations[index]) != 0) {
+		fprintf(stderr, "%s is not a checkpoint of this backfill\n", checkpoint);
+		fclose(fp);
+		return 1;
+	}
+	fclose(fp);
+	*station = index;
+	*start = (time_t) next;
+	if (verbose) printf("Resuming the backfill at %s from %ld\n", stations[index], next);
+	return 0;
+}
+
+/* Save the progress of a backfill: the reports of the stations before index,
+ * and those of station index observed before next, have been written. The
+ * file is replaced in one step, so an interruption leaves the old one.
+ * returns 0 for success, 1 for an error */
+int write_Checkpoint(time_t from, time_t to, int index, const char *station, time_t next) {
+	FILE *fp;
+	char tmp[1024];
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", checkpoint);
+	if ((fp = fopen(tmp, "w")) == NULL) {
+		perror(tmp);
+		return 1;
+	}
+	fprintf(fp, "backfill %ld %ld %d %s %ld\n", (long) from, (long) to, index, station, (long) next);
+	if (fclose(fp) != 0 || rename(tmp, checkpoint) != 0) {
+		perror(checkpoint);
+		return 1;
+	}
+	return 0;
+}
+
+/* Write the reports of a station observed from start up to end, oldest
+ * first, as they are written for a single poll.
+ * returns 0 for success, 1 for an error */
+int backfill_Window(pipeline_t *p, int index, char *station_arg, station_id_t id,
+					time_t start, time_t end) {
+	buffer_t response;
+	noaa_t *reports = NULL;
+	job_t job;
+	time_t obs_time;
+	int n, i, retval = 0;
+
+	memset(&response, 0, sizeof(response));
+	if (download_Window(id, start, end, &response) != JOB_OK) {
+		free(response.data);
+		return 1;
+	}
+	n = response.data != NULL ? read_Reports(&response, &reports) : -1;
+	free(response.data);
+	if (n == 0) {
+		fprintf(stderr, "Unable to interpret the reports of %s\n", station_arg);
+		free(reports);
+		return 1;
+	}
+
+	/* the store takes the reports of a station in time order */
+	if (n > 0)
+		qsort(reports, (size_t) n, sizeof(noaa_t), compare_Times);
+	for (i = 0; i < n; i++) {
+		/* the ends of the window may be returned twice, and a saved
+		 * response (file://) holds every window */
+		obs_time = parse_date(reports[i].date);
+		if (obs_time < start || obs_time >= end)
+			continue;
+		memset(&job, 0, sizeof(job));
+		job.seq = (unsigned long) index;
+		job.station_arg = station_arg;
+		job.station = id;
+		job.status = JOB_OK;
+		job.since = -1;
+		job.noaa = reports[i];
+		if (render_Station(&job, cache))
+			retval = 1;
+		write_Station(p, &job);
+	}
+	free(reports);
+	return retval;
+}
+
+/* Fetch the history of the stations between the times given as
+ * FROM,TO[,HOURS], HOURS at a time, resuming from the checkpoint if one was
+ * given. Stops after the window in progress when interrupted.
+ * returns 0 for success, 1 for an error */
+int backfill_Stations(char **stations, int num_stations) {
+	pipeline_t p;
+	char *arg, *to_arg, *hours_arg, *end;
+	time_t from, to, start, next, next_start;
+	station_id_t id;
+	long window = BACKFILL_WINDOW_HOURS * 3600L;
+	int i = 0, done, retval = 0;
+
+	if ((arg = strdup(backfill)) == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	if ((to_arg = strchr(arg, ',')) == NULL) {
+		fprintf(stderr, "--backfill requires FROM,TO[,HOURS]\n");
+		free(arg);
+		return 1;
+	}
+	*to_arg++ = 0;
+	if ((hours_arg = strchr(to_arg, ',')) != NULL) {
+		*hours_arg++ = 0;
+		window = (long) (strtod(hours_arg, &end) * 3600);
+		if (end == hours_arg || *end != 0 || window < 60) {
+			fprintf(stderr, "Invalid backfill window %s hours\n", hours_arg);
+			free(arg);
+			return 1;
+		}
+	}
+	from = parse_time_arg(arg);
+	to = parse_time_arg(to_arg);
+	if (from == -1 || to == -1 || to < from) {
+		fprintf(stderr, "Invalid backfill range %s,%s\n", arg, to_arg);
+		free(arg);
+		return 1;
+	}
+	free(arg);
+
+	start = from;
+	if (checkpoint != NULL && read_Checkpoint(from, to, stations, num_stations, &i, &start))
+		return 1;
+	done = i;
+
+	memset(&p, 0, sizeof(p));
+	p.num_stations = (unsigned long) num_stations;
+	if ((p.newest = malloc(((size_t) num_stations + 1) * sizeof(time_t))) == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	for (; i < num_stations && !stop_watching; i++, start = from) {
+		p.newest[i] = -1;
+		if ((id = station_id(stations[i])) == STATION_ID_NONE ||
+			(known_stations != NULL && !station_set_contains(known_stations, id))) {
+			fprintf(stderr, "%s is not a valid station identifier.\n", stations[i]);
+			retval = 1;
+			done = i + 1;
+			continue;
+		}
+		/* TO is included, like the end of a query (-q) */
+		for (; start <= to && !stop_watching; start = next) {
+			next = start + window <= to ? start + window : to + 1;
+			if (backfill_Window(&p, i, stations[i], id, start, next)) {
+				/* the checkpoint still points at this window */
+				free(p.newest);
+				return 1;
+			}
+			fflush(stdout);
+			/* where to go on from */
+			if (next > to) {
+				done = i + 1;
+				next_start = from;
+			} else {
+				done = i;
+				next_start = next;
+			}
+			if (checkpoint != NULL && done < num_stations &&
+				write_Checkpoint(from, to, done, stations[done], next_start)) {
+				free(p.newest);
+				return 1;
+			}
+		}
+	}
+	free(p.newest);
+
+	if (done < num_stations) {
+		if (checkpoint != NULL) fprintf(stderr, "Backfill interrupted, resume it with the same --checkpoint\n");
+		else fprintf(stderr, "Backfill interrupted\n");
+		return 1;
+	}
+	/* nothing is left to resume */
+	if (checkpoint != NULL)
+		unlink(checkpoint);
+	return retval;
+}
+
+
+/* Fetch the stations of a shard (-n or -W) and send the results to out,
+ * which is closed. Runs in a process of its own.
+ * returns 0 for success, 1 for an error */
+int shard_Worker(char **stations, int num_stations, FILE *out) {
+	char tracename[PATH_MAX];
+	time_t *newest;
+	int i, res;
+
+	curl_global_init(CURL_GLOBAL_DEFAULT);
+	xmlInitParser();
+
+	if ((newest = malloc((num_stations + 1) * sizeof(time_t))) == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	for (i = 0; i < num_stations; i++)
+		newest[i] = -1;
+
+	shard_out = out;
+	memset(&shard_stats, 0, sizeof(shard_stats));
+	shard_stats.stations = (uint32_t) num_stations;
+	res = shard_write_header(out);
+	if (fetch_Stations(stations, num_stations, newest)) res = 1;
+	if (shard_write_stats(out, &shard_stats)) res = 1;
+	if (fclose(out) != 0) res = 1;
+	shard_out = NULL;
+	free(newest);
+
+	/* every worker process has a trace of its own, next to that of the coordinator */
+	if (trace_file != NULL) {
+		snprintf(tracename, sizeof(tracename), "%s.%ld", trace_file, (long) getpid());
+		if (trace_write(tracename)) res = 1;
+	}
+
+	xmlCleanupParser();
+	curl_global_cleanup();
+	return res;
+}
+
+
+/* write a station received from a shard worker
+ * returns 0 for success, 1 for an error */
+int shard_Output(unsigned long index, const shard_result_t *res, void *ctx) {
+	char **stations = ctx;
+	uint64_t start = trace_begin();
+	int retval;
+
+	if (res == NULL) {
+		fprintf(stderr, "%s was lost with the worker fetching it\n", stations[index]);
+		return 1;
+	}
+	retval = res->status == JOB_FAILED;
+	/* with -e the observation goes to the binary stream instead of the screen */
+	if (encoder == NULL && res->output_len > 0)
+		fwrite(res->output, 1, res->output_len, stdout);
+	if (res->rec != NULL) {
+		if (store != NULL && store_append(store, res->rec, res->report))
+			retval = 1;
+		if (encoder != NULL && codec_encode(encoder, res->rec, res->report))
+			retval = 1;
+	}
+	trace_end("output", stations[index], start);
+	return retval;
+}
+
+
+/* copy arg into buf quoted for the shell, where ' becomes '\''; buf must
+ * hold 4 times the length of arg plus 3 characters */
+void quote_Arg(char *buf, const char *arg) {
+	*buf++ = '\'';
+	for (; *arg; arg++) {
+		if (*arg == '\'') buf += sprintf(buf, "'\\''");
+		else *buf++ = *arg;
+	}
+	strcpy(buf, "'");
+}
+
+/* Split the stations among shards worker processes and write their results
+ * in the order the stations were given.
+ * returns 0 for success, 1 for an error */
+int sweep_Shards(char **stations, int num_stations) {
+	shard_config_t cfg;
+	shard_stats_t total;
+	char *command = NULL, *rates;
+	int *shard_of;
+	int i, res;
+
+	if (num_stations <= 0)
+		return 0;
+	cfg.num_shards = shards < num_stations ? shards : num_stations;
+	/* the workers fetch at the same time, so each gets its share of the rates */
+	throttle_share(throttle, cfg.num_shards);
+	cfg.worker = shard_Worker;
+	cfg.command = NULL;
+	cfg.stats = calloc((size_t) cfg.num_shards, sizeof(shard_stats_t));
+	shard_of = malloc((size_t) num_stations * sizeof(int));
+	if (cfg.stats == NULL || shard_of == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	/* the same station always goes to the same worker; files are dealt out in turn */
+	for (i = 0; i < num_stations; i++) {
+		if (xml_files) shard_of[i] = i % cfg.num_shards;
+		else shard_of[i] = (int) (station_hash(station_id(stations[i])) % (uint32_t) cfg.num_shards);
+	}
+
+	if (shard_command != NULL) {
+		/* the options changing what a worker sends are passed on */
+		if ((rates = throttle_format_rates(throttle)) == NULL ||
+			(command = malloc(strlen(shard_command) + 160 + (where ? 4 * strlen(where) + 12 : 0) +
+							  (stations_file ? 4 * strlen(stations_file) + 16 : 0) + strlen(rates))) == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			return 1;
+		}
+		sprintf(command, "%s -W%s%s%s%s%s%s%s -p %d,%d,%d -m %ld --timeout %g --retries %d%s", shard_command,
+				decode ? " -d" : "", location ? " -l" : "", datetime ? " -t" : "",
+				category ? " -c" : "", verbose ? " -v" : "", xml_files ? " -x" : "",
+				request_csv ? " -C" : "", fetch_threads, parse_threads, decode_threads, cache_size,
+				request_timeout, retries, hedge ? " --hedge" : "");
+		if (stations_file != NULL) {
+			strcat(command, " --stations ");
+			quote_Arg(command + strlen(command), stations_file);
+		}
+		if (where != NULL) {
+			strcat(command, " --where ");
+			quote_Arg(command + strlen(command), where);
+		}
+		strcat(command, rates);
+		free(rates);
+		cfg.command = command;
+	}
+
+	res = shard_run(&cfg, stations, (unsigned long) num_stations, shard_of, shard_Output, stations);
+
+	if (verbose) {
+		memset(&total, 0, sizeof(total));
+		for (i = 0; i < cfg.num_shards; i++) {
+			printf("Shard %d: %u stations, %u new, %u invalid, %u failed, %llu bytes\n",
+				   i, cfg.stats[i].stations, cfg.stats[i].ok, cfg.stats[i].invalid, cfg.stats[i].failed, (unsigned long long) cfg.stats[i].bytes);
+			total.stations += cfg.stats[i].stations;
+			total.ok += cfg.stats[i].ok;
+			total.invalid += cfg.stats[i].invalid;
+			total.failed += cfg.stats[i].failed;
+			total.bytes += cfg.stats[i].bytes;
+		}
+		printf("All shards: %u stations, %u new, %u invalid, %u failed, %llu bytes\n",
+			   total.stations, total.ok, total.invalid, total.failed, (unsigned long long) total.bytes);
+	}
+
+	free(command);
+	free(shard_of);
+	free(cfg.stats);
+	return res;
+}
+
+
+/* print the stations published in the table name by another process
+ * returns 0 for success, 1 for an error */
+int read_Table(const char *name, char **stations, int num_stations) {
+	shm_table_t *reader;
+	shm_entry_t entry;
+	job_t job;
+	int i, res = 0;
+
+	if ((reader = shm_table_open(name)) == NULL)
+		return 1;
+	if (shm_table_retired(reader))
+		fprintf(stderr, "Warning: %s has been replaced by a larger table\n", name);
+
+	for (i = 0; i < num_stations; i++) {
+		switch (shm_table_read(reader, stations[i], &entry)) {
+			case 1:
+				break;
+			case 0:
+				fprintf(stderr, "%s has not been published in %s.\n", stations[i], name);
+				res = 1;
+				continue;
+			default:
+				fprintf(stderr, "The entry of %s in %s is being written.\n", stations[i], name);
+				res = 1;
+				continue;
+		}
+		/* printed like a report fetched from the server */
+		memset(&job, 0, sizeof(job));
+		job.station_arg = stations[i];
+		job.status = JOB_OK;
+		job.since = -1;
+		job.noaa = entry.noaa;
+		if (render_Station(&job, cache)) {
+			res = 1;
+		} else if (job.output != NULL) {
+			fwrite(job.output, 1, job.output_len, stdout);
+		}
+		free(job.output);
+	}
+	shm_table_close(reader);
+	return res;
+}
+
+
+/* feed the observations kept in the store to the schedule */
+typedef struct {
+	schedule_t *sched;
+	int station;
+} learn_ctx_t;
+
+int learn_Observation(const obs_record_t *rec, const char *report, void *ctx) {
+	learn_ctx_t *learn = ctx;
+
+	schedule_observed(learn->sched, learn->station, (time_t) rec->obs_time, -1);
+	return 0;
+}
+
+
+/* Poll the stations until a signal arrives. Every poll fetches the stations
+ * the schedule says are due; newest is updated as by fetch_Stations().
+ * returns 0 for success, 1 for an error */
+int watch_Stations(char **stations, int num_stations, time_t *newest) {
+	schedule_t *sched;
+	learn_ctx_t learn;
+	char **batch;
+	time_t *batch_newest;
+	time_t now, next;
+	station_id_t id;
+	int *due;
+	int i, n, res = 0;
+
+	sched = schedule_new(num_stations, watch);
+	batch = malloc((num_stations + 1) * sizeof(char *));
+	batch_newest = malloc((num_stations + 1) * sizeof(time_t));
+	due = malloc((num_stations + 1) * sizeof(int));
+	if (sched == NULL || batch == NULL || batch_newest == NULL || due == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* the issue times of the last two days are known from the store */
+	now = time(NULL);
+	learn.sched = sched;
+	for (i = 0; store != NULL && i < num_stations; i++) {
+		if ((id = station_id(stations[i])) == STATION_ID_NONE)
+			continue;
+		learn.station = i;
+		store_query(store, id, now - 2 * 24 * 3600, now, learn_Observation, &learn);
+	}
+
+	while (!stop_watching) {
+		now = time(NULL);
+		if ((n = schedule_due(sched, now, due)) > 0) {
+			for (i = 0; i < n; i++) {
+				batch[i] = stations[due[i]];
+				batch_newest[i] = newest[due[i]];
+			}
+			if (fetch_Stations(batch, n, batch_newest)) res = 1;
+			fflush(stdout);
+
+			now = time(NULL);
+			for (i = 0; i < n; i++) {
+				if (batch_newest[i] != NEWEST_INVALID && batch_newest[i] > newest[due[i]])
+					schedule_observed(sched, due[i], batch_newest[i], now);
+				newest[due[i]] = batch_newest[i];
+				schedule_polled(sched, due[i], now, newest[due[i]] == NEWEST_INVALID);
+			}
+		}
+
+		if ((next = schedule_next(sched)) == SCHED_NEVER)
+			break;   // none of the stations is valid
+		if (verbose)
+			printf("Polled %d of %d stations (%lu polls so far), next poll in %ld seconds\n",
+				   n, num_stations, sched->polls, (long) (next > now ? next - now : 0));
+		/* sleep() returns early when a signal arrives */
+		if (next > now && !stop_watching)
+			sleep((unsigned) (next - now));
+	}
+
+	schedule_free(sched);
+	free(batch);
+	free(batch_newest);
+	free(due);
+	return res;
+}
+
+
+/* signal handler ending -w */
+void stop_Watching(int sig) {
+    stop_watching = 1;
+}
+
+
+int main(int argc, char* argv[]) {
+	int  res=0;
+    char *filename = NULL;
+    char *encodefile = NULL;
+    char *replayfile = NULL;
+    FILE *encodefp = NULL;
+    char *storedir = NULL;
+    char *window = NULL;
+    time_t *newest;
+    int shard_worker = 0;
+    char *tablename = NULL;
+    char *readtable = NULL;
+    int i, fd;
+    FILE *fp;
+    double lat, lon, maxlat, maxlon, nm;
+    char extra;
+
+	/* get options */
+	opterr=0;
+	if (argc == 1) {
+		usage(argv[0]);
+		return 1;
+	}
+	if ((throttle = throttle_new()) == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	while ((res = getopt_long(argc, argv, "hvdltxcCWf:s:q:a:j:m:e:r:p:w:n:N:P:R:", long_options, NULL)) != -1) {
+		switch (res) {
+            case OPT_BBOX:
+                if (sscanf(optarg, "%lf,%lf,%lf,%lf%c", &lat, &lon, &maxlat, &maxlon, &extra) != 4 ||
+                    lat < -90 || maxlat > 90 || lat > maxlat || lon < -180 || maxlon > 180 || lon > maxlon) {
+                    fprintf(stderr, "--bbox requires MINLAT,MINLON,MAXLAT,MAXLON in degrees\n");
+                    return 1;
+                }
+                snprintf(region, sizeof(region), "minLat=%g&minLon=%g&maxLat=%g&maxLon=%g", lat, lon, maxlat, maxlon);
+                break;
+            case OPT_RADIUS:
+                if (sscanf(optarg, "%lf,%lf,%lf%c", &lat, &lon, &nm, &extra) != 3 ||
+                    lat < -90 || lat > 90 || lon < -180 || lon > 180 || nm <= 0) {
+                    fprintf(stderr, "--radius requires LAT,LON in degrees and a distance in nautical miles\n");
+                    return 1;
+                }
+                /* the server takes the distance in statute miles, then the longitude */
+                snprintf(region, sizeof(region), "radialDistance=%.1f;%g,%g", nm * STATUTE_MILES_PER_NM, lon, lat);
+                break;
+            case 'a':
+                aggregate_hours = atoi(optarg);
+                if (aggregate_hours < 1 || aggregate_hours > AGG_MAX_BUCKET_HOURS) {
+                    fprintf(stderr, "-a requires 1 to %d hours\n", AGG_MAX_BUCKET_HOURS);
+                    return 1;
+                }
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            case 'p':
+                if (sscanf(optarg, "%d,%d,%d", &fetch_threads, &parse_threads, &decode_threads) < 1 ||
+                    fetch_threads < 1 || parse_threads < 1 || decode_threads < 1) {
+                    fprintf(stderr, "-p requires one to three thread counts of at least 1\n");
+                    return 1;
+                }
+                break;
+            case 'w':
+                if ((watch = atoi(optarg)) < 1) {
+                    fprintf(stderr, "-w requires a number of seconds\n");
+                    return 1;
+                }
+                break;
+            case 'n':
+                if ((shards = atoi(optarg)) < 1) {
+                    fprintf(stderr, "-n requires a number of worker processes\n");
+                    return 1;
+                }
+                break;
+            case 'N':
+                shard_command = optarg;
+                break;
+            case 'W':
+                shard_worker = 1;
+                break;
+            case 'P':
+                tablename = optarg;
+                break;
+            case 'R':
+                readtable = optarg;
+                break;
+            case 'e':
+                encodefile = optarg;
+                break;
+            case 'r':
+                replayfile = optarg;
+                break;
+            case 'm':
+                cache_size = atol(optarg);
+                if (cache_size < 0) cache_size = 0;
+                break;
+            case 's':
+                storedir = optarg;
+                break;
+            case 'q':
+                window = optarg;
+                break;
+            case 'f':
+                filename = optarg;
+                break;
+            case 'l':
+				location=1;
+				break;
+			case 't':
+                datetime=1;
+				break;
+            case 'x':
+                xml_files = 1;
+                break;
+            case OPT_BACKFILL:
+                backfill = optarg;
+                break;
+            case OPT_CHECKPOINT:
+                checkpoint = optarg;
+                break;
+            case OPT_STATIONS:
+                stations_file = optarg;
+                if ((known_stations = station_set_load(stations_file)) == NULL)
+                    return 1;
+                if (verbose) printf("Read %lu stations from %s\n", (unsigned long) known_stations->count, stations_file);
+                break;
+            case OPT_TIMEOUT:
+                if ((request_timeout = atof(optarg)) < 0) {
+                    fprintf(stderr, "--timeout requires a number of seconds\n");
+                    return 1;
+                }
+                break;
+            case OPT_RETRIES:
+                if ((retries = atoi(optarg)) < 0) {
+                    fprintf(stderr, "--retries requires a number of retries\n");
+                    return 1;
+                }
+                break;
+            case OPT_HEDGE:
+                hedge = 1;
+                break;
+            case OPT_TRACE:
+                trace_file = optarg;
+                trace_start();
+                break;
+            case OPT_RATE:
+                if (throttle_set_rate(throttle, optarg))
+                    return 1;
+                break;
+            case OPT_WHERE:
+                where = optarg;
+                if ((filter = filter_compile(where)) == NULL)
+                    return 1;
+                break;
+            case 'C':
+                request_csv = 1;
+                break;
+			case 'd':
+				decode=1;
+				break;
+            case 'c':
+                category=1;
+                break;
+			case 'v':
+				verbose=1;
+				break;
+            case '?':
+            case 'h':
+            default:
+                usage(argv[0]);
+                return 1;
+		}
+	}
+    
+    if (storedir != NULL && (store = store_open(storedir)) == NULL)
+        return 1;
+
+    if (threads < 1)
+        threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    throttle_set_max(throttle, fetch_threads);
+
+    if ((cache = metar_cache_new((size_t) cache_size)) == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    if (encodefile != NULL) {
+        if ((encodefp = fopen(encodefile, "wb")) == NULL) {
+            perror(encodefile);
+            return 1;
+        }
+        if ((encoder = codec_encoder_new(encodefp)) == NULL) {
+            fprintf(stderr, "Unable to write to %s\n", encodefile);
+            return 1;
+        }
+    }
+
+    if (readtable != NULL) {
+        res = read_Table(readtable, &argv[optind], argc - optind);
+        if (close_Outputs(encodefp)) res = 1;
+        return res;
+    }
+
+    if (window != NULL || filename != NULL || replayfile != NULL) {
+        if (window != NULL) {
+            if (store == NULL) {
+                fprintf(stderr, "Querying requires a store (-s)\n");
+                return 1;
+            }
+            res = query_Store(window, &argv[optind], argc - optind);
+        } else if (filename != NULL) {
+            res = decode_File(filename);
+        } else {
+            res = replay_File(replayfile);
+        }
+        if (aggregate_hours && print_Aggregates()) res = 1;
+        if (close_Outputs(encodefp)) res = 1;
+        return res;
+    }
+
+    if (checkpoint != NULL && backfill == NULL) {
+        fprintf(stderr, "--checkpoint requires --backfill\n");
+        return 1;
+    }
+    if (backfill != NULL) {
+        if (region[0] != 0 || watch || xml_files || shards || shard_command != NULL ||
+            shard_worker || tablename != NULL) {
+            fprintf(stderr, "--backfill cannot be combined with --bbox, --radius, -w, -x, -n or -P\n");
+            return 1;
+        }
+        /* stop after the window in progress */
+        signal(SIGINT, stop_Watching);
+        signal(SIGTERM, stop_Watching);
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+        LIBXML_TEST_VERSION
+        xmlInitParser();
+        res = backfill_Stations(&argv[optind], argc - optind);
+        xmlCleanupParser();
+        curl_global_cleanup();
+        if (close_Outputs(encodefp)) res = 1;
+        return res;
+    }
+
+    if (region[0] != 0) {
+        if (optind < argc || watch || xml_files || shards || shard_command != NULL ||
+            shard_worker || tablename != NULL) {
+            fprintf(stderr, "--bbox and --radius cannot be combined with STATIONs, -w, -x, -n or -P\n");
+            return 1;
+        }
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+        LIBXML_TEST_VERSION
+        xmlInitParser();
+        res = fetch_Region();
+        xmlCleanupParser();
+        curl_global_cleanup();
+        if (close_Outputs(encodefp)) res = 1;
+        return res;
+    }
+
+    if (shard_worker) {
+        /* the frames get standard output to themselves; anything else printed goes to stderr */
+        if ((fd = dup(STDOUT_FILENO)) == -1 || (fp = fdopen(fd, "w")) == NULL) {
+            perror("stdout");
+            return 1;
+        }
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+        return shard_Worker(&argv[optind], argc - optind, fp);
+    }
+
+    if (shard_command != NULL && !shards)
+        shards = 1;
+    if (shards) {
+        if (watch || tablename != NULL) {
+            fprintf(stderr, "-n cannot be combined with -w or -P\n");
+            return 1;
+        }
+        res = sweep_Shards(&argv[optind], argc - optind);
+        if (close_Outputs(encodefp)) res = 1;
+        return res;
+    }
+
+    if (tablename != NULL &&
+        (obs_table = shm_table_create(tablename, (unsigned) (argc - optind))) == NULL)
+        return 1;
+
+    /* initialise the libraries once, before the threads use them */
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    LIBXML_TEST_VERSION
+    xmlInitParser();
+
+    if ((newest = malloc((argc - optind + 1) * sizeof(time_t))) == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    for (i = 0; i < argc - optind; i++)
+        newest[i] = -1;
+
+    if (watch) {
+        /* stop after the poll in progress */
+        signal(SIGINT, stop_Watching);
+        signal(SIGTERM, stop_Watching);
+    }
+
+    if (watch)
+        res = watch_Stations(&argv[optind], argc - optind, newest);
+    else
+        res = fetch_Stations(&argv[optind], argc - optind, newest);
+    free(newest);
+
+    xmlCleanupParser();
+    curl_global_cleanup();
+    /* the table stays for the readers */
+    shm_table_close(obs_table);
+    if (close_Outputs(encodefp)) res = 1;
+    return res;
 }
 
 // EOF
@@ -22,6 +22,8 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <pthread.h>
 #include "metar.h"
 
 extern int verbose;
@@ -130,11 +132,11 @@ static void add_cloud(cloud_list_t **head, cloud_t *cloud) {
 	current->next = NULL;
 } // add_cloud
 
-/* get the description of weather phenomena section of the METAR */
-static cloud_dict_entry *decode_cloud_abbreviation(char *pattern) {
+/* get the description of the len characters of cloud abbreviation at pattern */
+static cloud_dict_entry *decode_cloud_abbreviation(const char *pattern, size_t len) {
     int i=0;
     int num_entries = sizeof(cloud_dict) / sizeof(cloud_dict_entry);
-    size_t pattern_length = strnlen(pattern, LONGEST_CLOUD_DICT_KEY);
+    size_t pattern_length = len < LONGEST_CLOUD_DICT_KEY ? len : LONGEST_CLOUD_DICT_KEY;
     size_t key_length;
     size_t search_length;
 
@@ -151,30 +153,65 @@ static cloud_dict_entry *decode_cloud_abbreviation(char *pattern) {
     }
     return NULL;
 }
-//FIXME add function to delete cloud_list_t (currently leak the memory)
+
+/* PUBLIC--
+ * The abbreviation of a cloud code.
+ */
+const char *cloud_code_name(int code) {
+	if (code < 0 || code >= (int) (sizeof(cloud_dict) / sizeof(cloud_dict_entry)))
+		return "";
+	return cloud_dict[code].abbreviation;
+}
+
+/* the code of an entry of the cloud dictionary (CLOUD_*) */
+static int cloud_code(const cloud_dict_entry *entry) {
+	return entry == NULL ? CLOUD_NONE : (int) (entry - cloud_dict);
+}
 
 /* Add Phenomenon */
-static void add_phenomenon(phenomena_list_t **head, char *phenomenon) {
+static void add_phenomenon(phenomena_list_t **head, char *phenomenon, int intensity, unsigned codes) {
 	phenomena_list_t *current;
 
 	if (*head == NULL) {
 		*head = malloc(sizeof(phenomena_list_t));
 		current = *head;
-		current->phenomena = phenomenon;
-		current->next = NULL;
-		return;
-	}
-	current = *head;
-	while (current->next != NULL)
-		current = current->next;
+	} else {
+		current = *head;
+		while (current->next != NULL)
+			current = current->next;
 
-	current->next = (phenomena_list_t *)malloc(sizeof(phenomena_list_t));
-	current = current->next;
+		current->next = (phenomena_list_t *)malloc(sizeof(phenomena_list_t));
+		current = current->next;
+	}
 	current->phenomena = phenomenon;
+	current->intensity = intensity;
+	current->codes = codes;
 	current->next = NULL;
 } // add_phenomenon
 
-//FIXME add function to delete cloud_list_t (currently leaks the memory)
+/* PUBLIC--
+ * Free the cloud and phenomena lists of a parsed METAR.
+ */
+void free_Metar(metar_t *metar) {
+	cloud_list_t *cloud, *next_cloud;
+	phenomena_list_t *phenomenon, *next_phenomenon;
+
+	for (cloud = metar->clouds; cloud != NULL; cloud = next_cloud) {
+		next_cloud = cloud->next;
+		free(cloud->cloud->amount);
+		free(cloud->cloud->layer_modifier);
+		free(cloud->cloud);
+		free(cloud);
+	}
+	metar->clouds = NULL;
+
+	for (phenomenon = metar->phenomena; phenomenon != NULL; phenomenon = next_phenomenon) {
+		next_phenomenon = phenomenon->next;
+		free(phenomenon->phenomena);
+		free(phenomenon);
+	}
+	metar->phenomena = NULL;
+}
 
 /* build the phenomena regexp patterns*/
 static void build_phenomena_regex_patterns(char *pattern, int len) {
@@ -216,64 +253,178 @@ static void build_phenomena_regex_patterns(char *pattern, int len) {
 }
 
 
-/* get the description of weather phenomena section of the METAR */
-static char *decode_phenomena(char *pattern) {
+/* get the weather code (1 + the index in phenomena) of the two letters at pattern, 0 if unknown */
+static int phenomenon_code(const char *pattern) {
 	int i=0;
 	int size = sizeof(phenomena) / sizeof(phenomenon_t);
 
 	for (i=0; i < size; i++)
 		if (strncmp(pattern, phenomena[i].code, 2) == 0)
-			return (char*) phenomena[i].description;
+			return i + 1;
 
-	return NULL;
+	return 0;
 }
 
+/* get the description of weather phenomena section of the METAR */
+static char *decode_phenomena(char *pattern) {
+	int code = phenomenon_code(pattern);
+
+	return code ? (char*) phenomena[code - 1].description : NULL;
+}
 
-/* Analyse the token which is provided and, when possible, set the
- * corresponding value in the metar struct
+/* PUBLIC--
+ * The letters of a weather code.
  */
+const char *weather_code_name(int code) {
+	if (code == WEATHER_CAVOK)
+		return "CAVOK";
+	if (code < 1 || code > (int) (sizeof(phenomena) / sizeof(phenomenon_t)))
+		return "";
+	return phenomena[code - 1].code;
+}
+
+
 #define TMP_SIZE 99
 #define PHENOMENA_REGEX_SIZE 275
 #define MAX_REGEX_MATCHES 5
-static void analyse_token(char *token, metar_t *metar) {
-	regex_t preg;
+
+/* the patterns analyse_token() matches the tokens against */
+enum {
+	RE_STATION,
+	RE_DAYTIME,
+	RE_WIND,
+	RE_VIS,
+	RE_VISFRAC,
+	RE_TEMP,
+	RE_QNH,
+	RE_CLOUD,
+	RE_PHENOMENA,
+	NUM_PATTERNS
+};
+
+/* The patterns are compiled once per thread rather than for every token.
+ * regexec() locks the pattern it matches, so threads decoding at the same
+ * time do not share them; a thread's set is freed when it ends.
+ */
+static pthread_key_t patterns_key;
+static pthread_once_t patterns_once = PTHREAD_ONCE_INIT;
+
+static void free_patterns(void *arg) {
+	regex_t *patterns = arg;
+	int i;
+
+	for (i = 0; i < NUM_PATTERNS; i++)
+		regfree(&patterns[i]);
+	free(patterns);
+}
+
+static void create_patterns_key(void) {
+	if (pthread_key_create(&patterns_key, free_patterns)) {
+		perror("parseMetar");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* the patterns of the calling thread, compiled on first use */
+static regex_t *thread_patterns(void) {
+	regex_t *patterns;
+	char phenomena_regex_pattern[PHENOMENA_REGEX_SIZE];
+	const char *sources[NUM_PATTERNS] = {
+		"^([A-Z]+)$",
+		"^([0-9]{2})([0-9]{4})Z$",
+		"^(VRB|[0-9]{3})([0-9]{2})(G[0-9]+)?(KT)$",
+		"^([0-9]+)(SM)?$",
+		"^(M?)([0-9])/([0-9]{1,2})SM$",
+		"^(M?)([0-9]+)/(M?)([0-9]+)$",
+		"^([QA])([0-9]+)$",
+		// if you change the regex below, make sure you also change the cloud_dict at the top of the file
+		"^(SKC|CLR|NSC|NCD)$|^(FEW|SCT|BKN|OVC|VV)([0-9]{3})(TCU|CU|CB|CBMAM|ACC|CLD)?$",
+		phenomena_regex_pattern
+	};
+	int i;
+
+	pthread_once(&patterns_once, create_patterns_key);
+	if ((patterns = pthread_getspecific(patterns_key)) != NULL)
+		return patterns;
+
+	if ((patterns = malloc(NUM_PATTERNS * sizeof(regex_t))) == NULL) {
+		perror("parseMetar");
+		exit(EXIT_FAILURE);
+	}
+	memset(phenomena_regex_pattern, 0x0, PHENOMENA_REGEX_SIZE);
+	build_phenomena_regex_patterns(phenomena_regex_pattern, PHENOMENA_REGEX_SIZE);
+
+	for (i = 0; i < NUM_PATTERNS; i++) {
+		if (regcomp(&patterns[i], sources[i], REG_EXTENDED)) {
+			perror("parseMetar");
+			exit(errno);
+		}
+	}
+	pthread_setspecific(patterns_key, patterns);
+	return patterns;
+}
+
+/* match the len characters at token, which need not be NUL terminated */
+static int match_token(regex_t *preg, const char *token, size_t len, regmatch_t *pmatch) {
+#ifdef REG_STARTEND
+	pmatch[0].rm_so = 0;
+	pmatch[0].rm_eo = (regoff_t) len;
+	return regexec(preg, token, MAX_REGEX_MATCHES, pmatch, REG_STARTEND);
+#else
+	char copy[TMP_SIZE + 1];
+
+	if (len > TMP_SIZE)
+		return REG_NOMATCH;
+	memcpy(copy, token, len);
+	copy[len] = 0;
+	return regexec(preg, copy, MAX_REGEX_MATCHES, pmatch, 0);
+#endif
+}
+
+/* true if the len characters at token contain word */
+static int token_contains(const char *token, size_t len, const char *word) {
+	size_t n = strlen(word), i;
+
+	for (i = 0; i + n <= len; i++)
+		if (memcmp(token + i, word, n) == 0)
+			return 1;
+	return 0;
+}
+
+static int token_is(const char *token, size_t len, const char *word) {
+	return len == strlen(word) && memcmp(token, word, len) == 0;
+}
+
+
+/* Analyse the len characters of the token which is provided and, when
+ * possible, set the corresponding value in the metar struct.
+ * Returns the part of the report (METAR_PART_*) the token belongs to, -1 if unknown.
+ */
+static int analyse_token(const char *token, size_t len, metar_t *metar, int in_trend,
+						  regex_t *patterns) {
 	regmatch_t pmatch[MAX_REGEX_MATCHES];
 	int match_size;
     size_t string_length;
 	char tmp[TMP_SIZE];
-	char phenomena_regex_pattern[PHENOMENA_REGEX_SIZE];
+	int part = -1;
 
-	if (verbose) printf("Parsing token `%s'\n", token);
+	if (verbose) printf("Parsing token `%.*s'\n", (int) len, token);
 
 	// find station
-	if (metar->station[0] == 0) {
-		if (regcomp(&preg, "^([A-Z]+)$", REG_EXTENDED)) {
-			perror("parseMetar");
-			exit(errno);
-		}
-		if (!regexec(&preg, token, MAX_REGEX_MATCHES, pmatch, 0)) {
+	if (metar->station == STATION_ID_NONE) {
+		if (!match_token(&patterns[RE_STATION], token, len, pmatch)) {
 			match_size = pmatch[1].rm_eo - pmatch[1].rm_so;
-			memcpy(metar->station, token+pmatch[1].rm_so,
-				   (size_t) (match_size < 10 ? match_size : 10));
-			if (verbose) printf("   Found station %s\n", metar->station);
-
-			/* Free memory allocated to the pattern buffer by regcomp() */
-			regfree(&preg);
+			metar->station = station_id_n(token+pmatch[1].rm_so, (size_t) match_size);
+			if (verbose) printf("   Found station %s\n", station_name(metar->station, tmp));
 
-			return;
+			return METAR_PART_STATION;
 		}
-		/* Free memory allocated to the pattern buffer by regcomp() */
-		regfree(&preg);
 
 	}
 
 	// find day/time
 	if (metar->day == 0) {
-		if (regcomp(&preg, "^([0-9]{2})([0-9]{4})Z$", REG_EXTENDED)) {
-			perror("parseMetar");
-			exit(errno);
-		}
-		if (!regexec(&preg, token, MAX_REGEX_MATCHES, pmatch, 0)) {
+		if (!match_token(&patterns[RE_DAYTIME], token, len, pmatch)) {
 			match_size = pmatch[1].rm_eo - pmatch[1].rm_so;
 			memset(tmp, 0x0, TMP_SIZE);
 			memcpy(tmp, token+pmatch[1].rm_so, (size_t) (match_size < TMP_SIZE ? match_size : TMP_SIZE));
@@ -286,13 +437,8 @@ static void analyse_token(char *token, metar_t *metar) {
 			if (verbose) printf("   Found Day/Time %d/%d\n",
 					metar->day, metar->time);
 
-			/* Free memory allocated to the pattern buffer by regcomp() */
-			regfree(&preg);
-
-			return;
+			return METAR_PART_TIME;
 		}
-		/* Free memory allocated to the pattern buffer by regcomp() */
-		regfree(&preg);
 
 	} // daytime
 
@@ -300,12 +446,7 @@ static void analyse_token(char *token, metar_t *metar) {
     // FIXME parse when windspeed is greater than 6 knots and is variable (e.g. 23013KT 210V250)
     //       where wind direction varies between 210 and 250 degrees
 	if (metar->winddir == 0) {
-		if (regcomp(&preg, "^(VRB|[0-9]{3})([0-9]{2})(G[0-9]+)?(KT)$",
-					REG_EXTENDED)) {
-			perror("parseMetar");
-			exit(errno);
-		}
-		if (!regexec(&preg, token, MAX_REGEX_MATCHES, pmatch, 0)) {
+		if (!match_token(&patterns[RE_WIND], token, len, pmatch)) {
 			match_size = pmatch[1].rm_eo - pmatch[1].rm_so;
 			memset(tmp, 0x0, TMP_SIZE);
 			if (match_size) {
@@ -343,13 +484,8 @@ static void analyse_token(char *token, metar_t *metar) {
 					metar->winddir, metar->windstr, metar->windgust,
 					metar->windunit);
 
-			/* Free memory allocated to the pattern buffer by regcomp() */
-			regfree(&preg);
-
-			return;
+			return METAR_PART_WIND;
 		}
-		/* Free memory allocated to the pattern buffer by regcomp() */
-		regfree(&preg);
 
 	} // wind
 
@@ -372,11 +508,7 @@ static void analyse_token(char *token, metar_t *metar) {
     //
 
     if (metar->vis == 0) {
-		if (regcomp(&preg, "^([0-9]+)(SM)?$", REG_EXTENDED)) {
-			perror("parsemetar");
-			exit(errno);
-		}
-		if (!regexec(&preg, token, MAX_REGEX_MATCHES, pmatch, 0)) {
+		if (!match_token(&patterns[RE_VIS], token, len, pmatch)) {
 			match_size = pmatch[1].rm_eo - pmatch[1].rm_so;
 			memset(tmp, 0x0, TMP_SIZE);
 			memcpy(tmp, token+pmatch[1].rm_so, (size_t) (match_size < TMP_SIZE ? match_size : TMP_SIZE));
@@ -393,23 +525,35 @@ static void analyse_token(char *token, metar_t *metar) {
 			if (verbose) printf("   Visibility range/unit %d/%s\n", metar->vis,
 					metar->visunit);
 
-			/* Free memory allocated to the pattern buffer by regcomp() */
-			regfree(&preg);
-
-			return;
+			return METAR_PART_VIS;
 		}
-		/* Free memory allocated to the pattern buffer by regcomp() */
-		regfree(&preg);
 
 	} // visibility
 
+	// find fractional visibility in statute miles, e.g. 1/2SM or the second half of 1 1/2SM
+	if (metar->visfrac == 0 && !in_trend) {
+		if (!match_token(&patterns[RE_VISFRAC], token, len, pmatch)) {
+			int numerator = token[pmatch[2].rm_so] - '0';
+			int denominator = atoi(token + pmatch[3].rm_so);
+
+			/* a bare number in front of the fraction was parsed as meters above, it really is whole miles */
+			if (denominator > 0 && numerator < denominator) {
+				metar->visfrac = numerator * 16 / denominator;
+				memset(metar->visunit, 0x0, sizeof(metar->visunit));
+				strncpy(metar->visunit, "SM", sizeof(metar->visunit) - 1);
+			}
+
+			if (verbose) printf("   Visibility range/unit %d %d/16 %s\n", metar->vis,
+					metar->visfrac, metar->visunit);
+
+			return METAR_PART_VIS;
+		}
+
+	} // fractional visibility
+
 	// find temperature and dewpoint
 	if (metar->temp == 0) {
-		if (regcomp(&preg, "^(M?)([0-9]+)/(M?)([0-9]+)$", REG_EXTENDED)) {
-			perror("parsemetar");
-			exit(errno);
-		}
-		if (!regexec(&preg, token, MAX_REGEX_MATCHES, pmatch, 0)) {
+		if (!match_token(&patterns[RE_TEMP], token, len, pmatch)) {
 			match_size = pmatch[2].rm_eo - pmatch[2].rm_so;
 			memset(tmp, 0x0, TMP_SIZE);
 			memcpy(tmp, token+pmatch[2].rm_so, (size_t) (match_size < TMP_SIZE ? match_size : TMP_SIZE));
@@ -433,23 +577,14 @@ static void analyse_token(char *token, metar_t *metar) {
 			if (verbose)
 				printf("   Temp/dewpoint %d/%d\n", metar->temp, metar->dewp);
 
-			/* Free memory allocated to the pattern buffer by regcomp() */
-			regfree(&preg);
-
-			return;
+			return METAR_PART_TEMP;
 		}
-		/* Free memory allocated to the pattern buffer by regcomp() */
-		regfree(&preg);
 
 	} // temp
 
 	// find qnh
 	if (metar->qnh == 0) {
-		if (regcomp(&preg, "^([QA])([0-9]+)$", REG_EXTENDED)) {
-			perror("parsemetar");
-			exit(errno);
-		}
-		if (!regexec(&preg, token, MAX_REGEX_MATCHES, pmatch, 0)) {
+		if (!match_token(&patterns[RE_QNH], token, len, pmatch)) {
 			match_size = pmatch[1].rm_eo - pmatch[1].rm_so;
 			memset(tmp, 0x0, TMP_SIZE);
 			memcpy(tmp, token+pmatch[1].rm_so, (size_t) (match_size < 5 ? match_size : 5));
@@ -470,24 +605,13 @@ static void analyse_token(char *token, metar_t *metar) {
 			if (verbose)
 				printf("   Pressure/unit %d/%s\n", metar->qnh, metar->qnhunit);
 
-			/* Free memory allocated to the pattern buffer by regcomp() */
-			regfree(&preg);
-
-			return;
+			return METAR_PART_QNH;
 		}
-		/* Free memory allocated to the pattern buffer by regcomp() */
-		regfree(&preg);
 
 	} // qnh
 
 	// multiple cloud layers possible
-		// if you change the regex below, make sure you also change the cloud_dict at the top of the file
-	if (regcomp(&preg, "^(SKC|CLR|NSC|NCD)$|^(FEW|SCT|BKN|OVC|VV)([0-9]{3})(TCU|CU|CB|CBMAM|ACC|CLD)?$", REG_EXTENDED)) {
-		perror("parsemetar");
-		exit(errno);
-	}
-
-	if (!regexec(&preg, token, MAX_REGEX_MATCHES, pmatch, 0)) {
+	if (!match_token(&patterns[RE_CLOUD], token, len, pmatch)) {
 		cloud_t *cloud = malloc(sizeof(cloud_t));
         cloud_dict_entry *cloud_dict;
 		memset(cloud, 0x0, sizeof(cloud_t));
@@ -495,12 +619,14 @@ static void analyse_token(char *token, metar_t *metar) {
 		// Handle case where no clouds were detected (SKC, CLR, NSC, NCD)
 		match_size=pmatch[1].rm_eo - pmatch[1].rm_so;
 		if (match_size > 0) {
-            cloud_dict = decode_cloud_abbreviation(token + pmatch[1].rm_so);
+            cloud_dict = decode_cloud_abbreviation(token + pmatch[1].rm_so, len - pmatch[1].rm_so);
             string_length = strlen(cloud_dict->description);
             cloud->amount = malloc(string_length+1);
             memcpy(cloud->amount, cloud_dict->description, string_length);
             cloud->amount[string_length] = 0x0; //Force NUL termination
             cloud->print_altitude = cloud_dict->print_altitude;
+            cloud->amount_code = cloud_code(cloud_dict);
+            cloud->modifier_code = CLOUD_NONE;
 			cloud->layer_altitude = -1;   // base of cloud layer is irrelevant; no clouds were detected
 
             // no clouds detected means no layer modifier, put empty string into layer_modifier
@@ -508,14 +634,14 @@ static void analyse_token(char *token, metar_t *metar) {
             cloud->layer_modifier[0] = 0x0; //Force NUL termination
 		} else {
 			// Handle case where clouds were detected
-            //FIXME should I calculate the ceilings?
-
-            cloud_dict = decode_cloud_abbreviation(token + pmatch[2].rm_so);
+            cloud_dict = decode_cloud_abbreviation(token + pmatch[2].rm_so, len - pmatch[2].rm_so);
             string_length = strlen(cloud_dict->description);
             cloud->amount = malloc(string_length+1);
             memcpy(cloud->amount, cloud_dict->description, string_length);
             cloud->amount[string_length] = 0x0; //Force NUL termination
             cloud->print_altitude = cloud_dict->print_altitude;
+            cloud->amount_code = cloud_code(cloud_dict);
+            cloud->modifier_code = CLOUD_NONE;
 
             // Write base of cloud layer
 			match_size = pmatch[3].rm_eo - pmatch[3].rm_so;
@@ -523,20 +649,30 @@ static void analyse_token(char *token, metar_t *metar) {
 			memcpy(tmp, token + pmatch[3].rm_so, (size_t) (match_size < 3 ? match_size : 3));
 			sscanf(tmp, "%d", &cloud->layer_altitude);
 
+            // The ceiling is the lowest broken or overcast layer, or the vertical visibility into an obscuration.
+            // Layers forecast in a trend (BECMG, TEMPO) do not describe the current ceiling.
+            if (!in_trend &&
+                (strncmp(token + pmatch[2].rm_so, "BKN", 3) == 0 ||
+                 strncmp(token + pmatch[2].rm_so, "OVC", 3) == 0 ||
+                 strncmp(token + pmatch[2].rm_so, "VV", 2) == 0)) {
+                if (metar->ceiling == NO_CEILING || cloud->layer_altitude < metar->ceiling)
+                    metar->ceiling = cloud->layer_altitude;
+            }
+
             //Process pmatch[4] for cloud layer modifier TCU|CU|CB|CBMAM|ACC|CLD
             match_size = pmatch[4].rm_eo - pmatch[4].rm_so;
             if (match_size > 0){
-                cloud_dict = decode_cloud_abbreviation(token + pmatch[4].rm_so);
+                cloud_dict = decode_cloud_abbreviation(token + pmatch[4].rm_so, len - pmatch[4].rm_so);
                 string_length = strlen(cloud_dict->description);
                 cloud->layer_modifier = malloc(string_length+1);
                 memcpy(cloud->layer_modifier, cloud_dict->description, string_length);
                 cloud->layer_modifier[string_length] = 0x0; //Force NUL termination
+                cloud->modifier_code = cloud_code(cloud_dict);
 
             } else {
                 // no modifier, put empty string into layer_modifier
-                cloud->layer_modifier = malloc(strlen(""));
-                memcpy(cloud->layer_modifier, "", strlen(""));
-                cloud->layer_modifier[strlen("")] = 0x0; //Force NUL termination
+                cloud->layer_modifier = malloc(1);
+                cloud->layer_modifier[0] = 0x0; //Force NUL termination
 
             }
 		}
@@ -545,31 +681,25 @@ static void analyse_token(char *token, metar_t *metar) {
 		if (verbose)
 			printf("   Cloud cover/alt %s/%d00\n", cloud->amount, cloud->layer_altitude);
 
-		/* Free memory allocated to the pattern buffer by regcomp() */
-		regfree(&preg);
-
-		return;
+		return METAR_PART_CLOUDS;
 	} // cloud
 
-	/* Free memory allocated to the pattern buffer by regcomp() */
-	regfree(&preg);
 
 	// phenomena
-	memset(phenomena_regex_pattern, 0x0, PHENOMENA_REGEX_SIZE);
-    build_phenomena_regex_patterns(phenomena_regex_pattern, PHENOMENA_REGEX_SIZE);
-
 	// cannot expand CAVOK abbreviation in the array because it is more than
 	// 2 characters long and that screws up my algorithm - so we special case it here
-	if (strstr(token, "CAVOK") != NULL) {
-        add_phenomenon(&metar->phenomena, "Ceiling and visibility OK");
-	}
-
-	if (regcomp(&preg, phenomena_regex_pattern, REG_EXTENDED)) {
-		perror("parsemetar");
-		exit(errno);
+	if (token_contains(token, len, "CAVOK")) {
+        add_phenomenon(&metar->phenomena, strdup("Ceiling and visibility OK"), 0, WEATHER_CAVOK);
+        part = METAR_PART_CLOUDS;   // in place of the visibility, weather and clouds
+
+        // CAVOK implies a visibility of 10 km or more
+        if (metar->vis == 0 && !in_trend) {
+            metar->vis = 9999;
+            strcpy(metar->visunit, "M");
+        }
 	}
 
-	if (!regexec(&preg, token, MAX_REGEX_MATCHES, pmatch, 0)) {
+	if (!match_token(&patterns[RE_PHENOMENA], token, len, pmatch)) {
 		#define PHENOMENON_STR_SIZE 99
 		char *phenomenon_str;
 		phenomenon_str = malloc(PHENOMENON_STR_SIZE);
@@ -581,6 +711,7 @@ static void analyse_token(char *token, metar_t *metar) {
 		memcpy(tmp, token+pmatch[1].rm_so, (size_t) (match_size < 1 ? match_size : 1));
 		if (tmp[0] == '-') strncpy(phenomenon_str, "Light ", PHENOMENON_STR_SIZE);
 		else if (tmp[0] == '+') strncpy(phenomenon_str, "Heavy ", PHENOMENON_STR_SIZE);
+		int intensity = tmp[0] == '-' ? -1 : tmp[0] == '+' ? 1 : 0;
 
 		// split up in groups of 2 chars and decode per group
 		match_size=pmatch[2].rm_eo - pmatch[2].rm_so;
@@ -589,63 +720,214 @@ static void analyse_token(char *token, metar_t *metar) {
 
 		int i=0;
 		char code[2];
+		unsigned codes = 0;
 		while (i < strlen(tmp)) {
 			memset(code, 0x0, 2);
 			memcpy(code, tmp+i, 2);
 			strncat(phenomenon_str, decode_phenomena(code), PHENOMENON_STR_SIZE - strlen(phenomenon_str));
+			if (i < 8) codes |= (unsigned) phenomenon_code(code) << (4 * i);   // 8 bits per two letters
 			i += 2;
 		}
 
 		// remove trailing space and ensure nul termination
 		phenomenon_str[strlen(phenomenon_str)-1]=0;
-        add_phenomenon(&metar->phenomena, phenomenon_str);
+        add_phenomenon(&metar->phenomena, phenomenon_str, intensity, codes);
 		if (verbose)
 			printf("   Phenomena %s\n", phenomenon_str);
 
-		/* Free memory allocated to the pattern buffer by regcomp() */
-		regfree(&preg);
-
-		return;
+		return METAR_PART_WEATHER;
 	}
 
-	/* Free memory allocated to the pattern buffer by regcomp() */
-	regfree(&preg);
 
 	// Search for '$' at the end of the METAR (indicates maintenance needed on station)
-    if (strncmp(token, "$", 1) == 0){
+    if (len > 0 && token[0] == '$'){
         metar->maintenance_needed = MAINTENANCE_NEEDED;
     }
 
-	if (verbose) printf("   Unmatched token = %s\n", token);
+	if (verbose && part == -1) printf("   Unmatched token = %.*s\n", (int) len, token);
+	return part;
 }
 
 
 /* PUBLIC--
- * Parse the METAR contain in the report string. Place the parsed report in
- * the metar struct.
+ * Parse the METAR in the len characters at report like parse_Metar_n(),
+ * telling progress how far the decoding got after every token.
  */
-void parse_Metar(char *report, metar_t *metar) {
-	char *token;
-	char *last;
+int parse_Metar_until(const char *report, size_t len, metar_t *metar,
+					  metar_progress_fn progress, void *ctx) {
+	const char *token, *end, *next;
+	size_t toklen;
+	int in_trend = 0, part = METAR_PART_STATION, token_part;
+	regex_t *patterns = thread_patterns();
 
 	// clear results
 	memset(metar, 0x0, sizeof(metar_t));
 
-    // init maintenance_needed flag
+    // init maintenance_needed flag and ceiling
     metar->maintenance_needed = MAINTENANCE_NOT_NEEDED;
+    metar->ceiling = NO_CEILING;
+
+	// the report ends at the first newline
+	if ((end = memchr(report, '\n', len)) != NULL)
+		len = (size_t) (end - report);
+	end = report + len;
+	metar->report.ptr = report;
+	metar->report.len = len;
+
+	for (token = report; token < end; token = next < end ? next + 1 : end) {
+		if ((next = memchr(token, ' ', (size_t) (end - token))) == NULL)
+			next = end;
+		toklen = (size_t) (next - token);
+		if (toklen == 0)
+			continue;   // consecutive spaces
+
+		// remarks and trend forecasts do not describe the observed ceiling and visibility
+		if (token_is(token, toklen, "RMK") || token_is(token, toklen, "BECMG") ||
+			token_is(token, toklen, "TEMPO") || token_is(token, toklen, "NOSIG"))
+			in_trend = 1;
+
+		if (metar->remarks.ptr == NULL && token_is(token, toklen, "RMK")) {
+			metar->remarks.ptr = next < end ? next + 1 : end;
+			metar->remarks.len = (size_t) (end - metar->remarks.ptr);
+		}
 
-	// strip trailing newlines
-	while ((last = strrchr(report, '\n')) != NULL)
-		memset(last, 0, 1);
-
-	token = strtok(report, " ");
-	while (token != NULL) {
-		analyse_token(token, metar);
-		token = strtok(NULL, " ");
+		token_part = analyse_token(token, toklen, metar, in_trend, patterns);
+		if (in_trend) token_part = METAR_PART_REMARKS;
+		else if (token_part >= 0) metar->found |= 1u << token_part;
+		if (progress == NULL)
+			continue;
+		/* a token of one part ends the parts before it */
+		if (token_part > part) part = token_part;
+		if (progress(metar, part, metar->found, ctx))
+			return 1;
 	}
 
+	metar->category = flight_category(metar);
+	if (progress != NULL)
+		progress(metar, METAR_PART_END, metar->found, ctx);
+	return 0;
+} // parse_Metar_until
+
+/* PUBLIC--
+ * Parse the METAR in the len characters at report, which need not be NUL
+ * terminated, and place the parsed report in the metar struct. The report is
+ * not modified; the report and remarks spans in metar point into it.
+ */
+void parse_Metar_n(const char *report, size_t len, metar_t *metar) {
+	parse_Metar_until(report, len, metar, NULL, NULL);
+} // parse_Metar_n
+
+/* PUBLIC--
+ * Parse the METAR contain in the report string. Place the parsed report in
+ * the metar struct.
+ */
+void parse_Metar(const char *report, metar_t *metar) {
+	parse_Metar_n(report, strlen(report), metar);
 } // parse_Metar
 
+/* PUBLIC--
+ * Compute the flight category from the visibility and ceiling of a parsed METAR,
+ * using the same limits as the NOAA aviation weather center:
+ *
+ *   LIFR  ceiling below 500 ft and/or visibility below 1 mile
+ *   IFR   ceiling 500 to below 1000 ft and/or visibility 1 to below 3 miles
+ *   MVFR  ceiling 1000 to 3000 ft and/or visibility 3 to 5 miles
+ *   VFR   ceiling above 3000 ft and visibility above 5 miles
+ *
+ * Returns FLIGHT_CATEGORY_UNKNOWN if neither visibility nor clouds were reported.
+ */
+int flight_category(const metar_t *metar) {
+	double vis_sm = -1.0;    // visibility in statute miles, negative if unknown
+	int ceiling_ft = -1;     // ceiling in feet, negative if there is none
+
+	if (metar->visunit[0] != 0) {
+		if (strncmp(metar->visunit, "SM", 2) == 0)
+			vis_sm = metar->vis + metar->visfrac / 16.0;
+		else
+			vis_sm = metar->vis / 1609.344;
+	}
+	if (metar->ceiling != NO_CEILING)
+		ceiling_ft = metar->ceiling * 100;
+
+	if (vis_sm < 0 && metar->clouds == NULL)
+		return FLIGHT_CATEGORY_UNKNOWN;
+
+	if ((ceiling_ft >= 0 && ceiling_ft < 500) || (vis_sm >= 0 && vis_sm < 1.0))
+		return FLIGHT_CATEGORY_LIFR;
+	if ((ceiling_ft >= 0 && ceiling_ft < 1000) || (vis_sm >= 0 && vis_sm < 3.0))
+		return FLIGHT_CATEGORY_IFR;
+	if ((ceiling_ft >= 0 && ceiling_ft <= 3000) || (vis_sm >= 0 && vis_sm <= 5.0))
+		return FLIGHT_CATEGORY_MVFR;
+	return FLIGHT_CATEGORY_VFR;
+} // flight_category
+
+/* PUBLIC--
+ * Return the name of a flight category, or an empty string if it is unknown.
+ */
+const char *flight_category_name(int category) {
+	static const char *names[] = { "", "VFR", "MVFR", "IFR", "LIFR" };
+
+	if (category < FLIGHT_CATEGORY_UNKNOWN || category > FLIGHT_CATEGORY_LIFR)
+		return names[FLIGHT_CATEGORY_UNKNOWN];
+	return names[category];
+}
+
+/* PUBLIC--
+ * Convert a date such as 2016-09-24T21:35:00Z to seconds since the epoch.
+ * The seconds and the trailing Z are optional.
+ */
+time_t parse_date(const char *date) {
+	struct tm tm;
+	int n;
+
+	memset(&tm, 0x0, sizeof(tm));
+	n = sscanf(date, "%d-%d-%d%*1[T ]%d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+			   &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+	if (n < 3 || n == 4)
+		return -1;
+	if (tm.tm_mon < 1 || tm.tm_mon > 12 || tm.tm_mday < 1 || tm.tm_mday > 31)
+		return -1;
+	tm.tm_year -= 1900;
+	tm.tm_mon -= 1;
+	return timegm(&tm);
+}
+
+/* PUBLIC--
+ * Convert a date that need not be NUL terminated; it is copied so sscanf()
+ * cannot read past its end.
+ */
+time_t parse_date_n(const char *date, size_t len) {
+	char tmp[36];
+
+	if (len >= sizeof(tmp))
+		len = sizeof(tmp) - 1;
+	memcpy(tmp, date, len);
+	tmp[len] = 0;
+	return parse_date(tmp);
+}
+
+/* PUBLIC--
+ * Return the time of observation of a parsed METAR. The month and year are
+ * taken from the reference time; a day later in the month than the reference
+ * is assumed to be in the previous month.
+ */
+time_t metar_time(const metar_t *metar, time_t reference) {
+	struct tm tm;
+
+	gmtime_r(&reference, &tm);
+	if (metar->day > tm.tm_mday) {
+		if (--tm.tm_mon < 0) {
+			tm.tm_mon = 11;
+			tm.tm_year--;
+		}
+	}
+	tm.tm_mday = metar->day;
+	tm.tm_hour = metar->time / 100;
+	tm.tm_min = metar->time % 100;
+	tm.tm_sec = 0;
+	return timegm(&tm);
+}
+
 /* Dates from the NOAA XML have the following format: 2016-09-24T21:35:00Z
  * This function replaces the 'T' with a space to make the format clearer.
  */
@@ -688,6 +970,8 @@ xmlXPathObjectPtr getnodeset (xmlDocPtr doc, xmlChar *xpath){
  * data in the metar struct.
  *
  * Returns: 1 if noaa_data was parsed sucessfully
+ *         -1 if the response contains no reports, e.g. when no new report
+ *            was issued in the requested time window
  *          0 if noaa_data was not parsed successfully
  */
 int parse_NOAA_data(char *noaa_data, noaa_t *noaa) {
@@ -732,8 +1016,8 @@ int parse_NOAA_data(char *noaa_data, noaa_t *noaa) {
 
     doc = xmlReadMemory(noaa_data, length, "noname.xml", NULL, 0);
     if (doc == NULL) {
-        fprintf(stderr, "Failed to parse data from NOAA\n");
-        exit(EXIT_FAILURE);
+        if (verbose) printf("Unable to interpret XML data from NOAA.\n");
+        return 0;
     }
 
     /* The calls to getnodeset return a set of nodes for the Xpath.  However, we are only asking for the latest
@@ -751,13 +1035,11 @@ int parse_NOAA_data(char *noaa_data, noaa_t *noaa) {
         xmlXPathFreeObject(result);
         if (num_results==0){
             xmlFreeDoc(doc);
-            xmlCleanupParser();
-            return 0;
+            return -1;
         }
         if (num_results > 1) {
             if (verbose) printf("Got %i results from NOAA. Check the ICAO airport code.\n", num_results);
             xmlFreeDoc(doc);
-            xmlCleanupParser();
             return 0;
         }
 
@@ -765,7 +1047,6 @@ int parse_NOAA_data(char *noaa_data, noaa_t *noaa) {
     else {
         if(verbose) printf("Unable to interpret XML data from NOAA.\n");
         xmlFreeDoc(doc);
-        xmlCleanupParser();
         return 0;
     }
 
@@ -782,7 +1063,6 @@ int parse_NOAA_data(char *noaa_data, noaa_t *noaa) {
     else {
         if(verbose) printf("Unable to find METAR in the XML data from NOAA.\n");
         xmlFreeDoc(doc);
-        xmlCleanupParser();
         return 0;
     }
 
@@ -837,14 +1117,142 @@ int parse_NOAA_data(char *noaa_data, noaa_t *noaa) {
 		xmlXPathFreeObject (result);
 	}
 	xmlFreeDoc(doc);
-    /*
-     * Cleanup function for the XML library.
-     */
-    xmlCleanupParser();
-    /*
-     * this is to debug memory for regression tests
-     */
-    xmlMemoryDump();
+    /* The XML library is cleaned up once by the caller: several threads may be
+     * parsing responses at the same time. */
 
     return 1;
 } // parse_NOAA_data
+
+/* the first child element of node called name, NULL if there is none */
+static xmlNodePtr find_child(xmlNodePtr node, const char *name) {
+	for (node = node->children; node != NULL; node = node->next) {
+		if (node->type == XML_ELEMENT_NODE && xmlStrcmp(node->name, (const xmlChar *) name) == 0)
+			return node;
+	}
+	return NULL;
+}
+
+/* copy the text of the child element name of node into buf of size bytes,
+ * leaving buf alone if there is no such element */
+static void child_text(xmlDocPtr doc, xmlNodePtr node, const char *name, char *buf, size_t size) {
+	xmlChar *data;
+
+	if ((node = find_child(node, name)) == NULL ||
+		(data = xmlNodeListGetString(doc, node->xmlChildrenNode, 1)) == NULL)
+		return;
+	snprintf(buf, size, "%s", (char *) data);
+	xmlFree(data);
+}
+
+/* fill report from the children of the METAR element node */
+static void fill_report(xmlDocPtr doc, xmlNodePtr node, noaa_t *report) {
+	char number[64];
+
+	memset(report, 0, sizeof(noaa_t));
+	child_text(doc, node, "raw_text", report->report, sizeof(report->report));
+	child_text(doc, node, "observation_time", report->date, sizeof(report->date));
+	clean_date(report->date);
+	number[0] = 0;
+	child_text(doc, node, "latitude", number, sizeof(number));
+	report->latitude = strtod(number, NULL);
+	number[0] = 0;
+	child_text(doc, node, "longitude", number, sizeof(number));
+	report->longitude = strtod(number, NULL);
+	number[0] = 0;
+	child_text(doc, node, "elevation_m", number, sizeof(number));
+	report->elevation_m = strtod(number, NULL);
+	child_text(doc, node, "flight_category", report->category, sizeof(report->category));
+}
+
+/* PUBLIC--
+ * Parse every report of an XML response, e.g. that of a region.
+ */
+int parse_NOAA_reports(char *noaa_data, size_t len, noaa_t *noaa, int max_reports) {
+	xmlDocPtr doc;
+	xmlNodePtr node, data = NULL;
+	int n = 0;
+
+	if (len > INT_MAX ||
+		(doc = xmlReadMemory(noaa_data, (int) len, "noname.xml", NULL, XML_PARSE_NONET)) == NULL) {
+		if (verbose) printf("Unable to interpret XML data from NOAA.\n");
+		return 0;
+	}
+	if ((node = xmlDocGetRootElement(doc)) != NULL && xmlStrcmp(node->name, (const xmlChar *) "response") == 0)
+		data = find_child(node, "data");
+	if (data == NULL) {
+		if (verbose) printf("Unable to interpret XML data from NOAA.\n");
+		xmlFreeDoc(doc);
+		return 0;
+	}
+
+	for (node = data->children; node != NULL; node = node->next) {
+		if (node->type != XML_ELEMENT_NODE || xmlStrcmp(node->name, (const xmlChar *) "METAR") != 0 ||
+			find_child(node, "raw_text") == NULL)
+			continue;
+		if (n < max_reports)
+			fill_report(doc, node, &noaa[n]);
+		n++;
+	}
+	xmlFreeDoc(doc);
+	return n > 0 ? n : -1;
+}
+
+/* PUBLIC--
+ * Parse the reports of an XML response one at a time.
+ */
+int parse_NOAA_stream(const char *noaa_data, size_t len, noaa_report_fn fn, void *ctx) {
+	xmlTextReaderPtr reader;
+	xmlNodePtr node;
+	const xmlChar *name;
+	noaa_t report;
+	int n = 0, res, depth, have_data = 0, stopped = 0;
+
+	if (len > INT_MAX ||
+		(reader = xmlReaderForMemory(noaa_data, (int) len, "noname.xml", NULL, XML_PARSE_NONET)) == NULL) {
+		if (verbose) printf("Unable to interpret XML data from NOAA.\n");
+		return 0;
+	}
+
+	/* only the METAR element being read is expanded into a tree, which the
+	 * reader frees when it moves on */
+	res = xmlTextReaderRead(reader);
+	while (res == 1) {
+		if (xmlTextReaderNodeType(reader) != XML_READER_TYPE_ELEMENT) {
+			res = xmlTextReaderRead(reader);
+			continue;
+		}
+		name = xmlTextReaderConstName(reader);
+		depth = xmlTextReaderDepth(reader);
+		if (depth == 0 && xmlStrcmp(name, (const xmlChar *) "response") != 0)
+			break;
+		if (depth == 1 && xmlStrcmp(name, (const xmlChar *) "data") == 0)
+			have_data = 1;
+		if (depth == 2 && have_data && xmlStrcmp(name, (const xmlChar *) "METAR") == 0) {
+			if ((node = xmlTextReaderExpand(reader)) == NULL) {
+				res = -1;
+				break;
+			}
+			if (find_child(node, "raw_text") != NULL) {
+				fill_report(node->doc, node, &report);
+				n++;
+				if (fn(&report, ctx)) {
+					stopped = 1;
+					break;
+				}
+			}
+			res = xmlTextReaderNext(reader);
+			continue;
+		}
+		res = xmlTextReaderRead(reader);
+	}
+	xmlFreeTextReader(reader);
+
+	if (stopped)
+		return 0;
+	if (res < 0 || !have_data) {
+		if (verbose) printf("Unable to interpret XML data from NOAA.\n");
+		return 0;
+	}
+	return n > 0 ? n : -1;
+}
+
@@ -21,9 +21,12 @@
 #define Already_included_metar_h 1
 
 
+#include <time.h>
 #include <libxml/parser.h>
 #include <libxml/tree.h>
 #include <libxml/xpath.h>
+#include <libxml/xmlreader.h>
+#include "station.h"
 
 /* max size for a URL */
 #define  URL_MAXSIZE 300
@@ -31,9 +34,20 @@
 /* max size for a NOAA report */
 #define  METAR_MAXSIZE 4096   /* actual size of the XML data is typically a little more than 1K */
 
+/* max size for the response holding all reports of a region */
+#define  REGION_MAXSIZE (64 * 1024 * 1024)
+
 /* where to fetch reports */
 //#define  METARURL "http://weather.noaa.gov/pub/data/observations/metar/stations"
-#define  METARURL "https://www.aviationweather.gov/adds/dataserver_current/httpparam?datasource=metars&requestType=retrieve&format=xml&mostRecentForEachStation=constraint&hoursBeforeNow=1.25&stationString="
+#define  METARURL "https://www.aviationweather.gov/adds/dataserver_current/httpparam?datasource=metars&requestType=retrieve&format=xml&mostRecentForEachStation=constraint&stationString="
+
+/* Time window added to a query URL after the station. The first request asks
+ * for the reports of the last hours; once the newest report of a station is
+ * known, only reports issued after it are requested (times in seconds since
+ * the epoch).
+ */
+#define  METARURL_WINDOW "&hoursBeforeNow=1.25"
+#define  METARURL_SINCE "&startTime=%ld&endTime=%ld"
 
 
 /* clouds */
@@ -44,11 +58,31 @@
 #define DONT_PRINT_BASE 0
 #define NOT_APPLICABLE -1
 
+/* codes of the cloud amounts and layer modifiers */
+#define CLOUD_NONE  -1
+#define CLOUD_SKC    0
+#define CLOUD_CLR    1
+#define CLOUD_NSC    2
+#define CLOUD_NCD    3
+#define CLOUD_FEW    4
+#define CLOUD_SCT    5
+#define CLOUD_BKN    6
+#define CLOUD_OVC    7
+#define CLOUD_VV     8
+#define CLOUD_TCU    9
+#define CLOUD_CU    10
+#define CLOUD_CB    11
+#define CLOUD_CBMAM 12
+#define CLOUD_ACC   13
+#define CLOUD_CLD   14
+
 typedef struct {
 	char *amount;
 	int  layer_altitude;
     int  print_altitude;
     char *layer_modifier;   // TCU etc . . .
+    int  amount_code;       // CLOUD_SKC to CLOUD_VV
+    int  modifier_code;     // CLOUD_TCU to CLOUD_CLD, CLOUD_NONE if there is none
 } cloud_t;
 
 /* linked list of clouds */
@@ -57,9 +91,18 @@ typedef struct cloud_list_el {
 	struct cloud_list_el *next;
 } cloud_list_t;
 
+/* A group of weather phenomena such as -SHRA is coded as up to four codes of
+ * two letter phenomena, the first one in the lowest byte. A code is 1 plus
+ * the position of the phenomenon in the table in metar.c; weather_code_name()
+ * gives its letters. CAVOK is coded as WEATHER_CAVOK alone.
+ */
+#define WEATHER_CAVOK 0xff
+
 /* linked list of phenomena */
 typedef struct phenomena_list_el {
 	char *phenomena;
+	int intensity;          // -1 light, 0 moderate, 1 heavy
+	unsigned codes;         // the phenomena of the group, see above
 	struct phenomena_list_el *next;
 } phenomena_list_t;
 
@@ -67,9 +110,25 @@ typedef struct phenomena_list_el {
 #define MAINTENANCE_NOT_NEEDED 0
 #define MAINTENANCE_NEEDED 1
 
+/* ceiling value used when no BKN, OVC or VV layer was reported */
+#define NO_CEILING -1
+
+/* flight categories, ordered from best to worst conditions */
+#define FLIGHT_CATEGORY_UNKNOWN 0
+#define FLIGHT_CATEGORY_VFR     1
+#define FLIGHT_CATEGORY_MVFR    2
+#define FLIGHT_CATEGORY_IFR     3
+#define FLIGHT_CATEGORY_LIFR    4
+
+/* text in a buffer owned by someone else; it is not NUL terminated */
+typedef struct {
+	const char *ptr;
+	size_t len;
+} span_t;
+
 /* reports will be translated to this struct */
 typedef struct {
-	char station[10];
+	station_id_t station;
 	int  day;
 	int  time;
 	int  winddir;  // winddir == -1 signifies variable winds
@@ -77,6 +136,7 @@ typedef struct {
 	int  windgust;
 	char windunit[5];
 	int  vis;
+	int  visfrac;	// fractional statute miles, in sixteenths (1 1/2SM is vis=1, visfrac=8)
 	char visunit[5];
 	int  qnh;
 	char qnhunit[5];
@@ -84,9 +144,13 @@ typedef struct {
 	int  temp;
 	int  dewp;
     int maintenance_needed;
+    int ceiling;    // lowest BKN/OVC/VV layer in hundreds of feet, NO_CEILING if there is none
+    int category;   // FLIGHT_CATEGORY_*, computed from visibility and ceiling
+    unsigned found; // bit 1 << METAR_PART_* for each part of the observation in the report
     cloud_list_t *clouds;
 	phenomena_list_t *phenomena;
-    // FIXME Add ceiling to this and calculate ceiling
+	span_t report;      // the parsed report, in the buffer passed to parse_Metar_n()
+	span_t remarks;     // the text following RMK, empty if there are no remarks
 } metar_t;
 
 typedef struct {  //FIXME use #defines for array sizes
@@ -95,21 +159,99 @@ typedef struct {  //FIXME use #defines for array sizes
     double  latitude;
     double longitude;
     double  elevation_m;
-    char category[8];  // VFR, LVFR, IFR, LIFR
+    char category[8];  // VFR, MVFR, IFR, LIFR
 } noaa_t;
 
 /* convert meters to feet */
 double meters_to_feet(double meters);
 
-/* Parse the METAR contain in the report string. Place the parsed report in
- * the metar struct.
+/* Parse the METAR in the len characters at report and place the parsed
+ * report in the metar struct. The report need not be NUL terminated and is
+ * not modified; it must outlive the report and remarks spans in metar.
+ */
+void parse_Metar_n(const char *report, size_t len, metar_t *metar);
+
+/* The parts of a report, in the order they appear. While a report is decoded
+ * by parse_Metar_until(), the parts before the one reached are complete.
+ */
+#define METAR_PART_STATION  0
+#define METAR_PART_TIME     1
+#define METAR_PART_WIND     2
+#define METAR_PART_VIS      3
+#define METAR_PART_WEATHER  4
+#define METAR_PART_CLOUDS   5   // or CAVOK
+#define METAR_PART_TEMP     6
+#define METAR_PART_QNH      7
+#define METAR_PART_REMARKS  8   // remarks and trends, which follow the observation
+#define METAR_PART_END      9   // the whole report was decoded
+
+/* called after every token with the part reached and the parts found so far
+ * (bit 1 << METAR_PART_* for each); returns nonzero to stop decoding */
+typedef int (*metar_progress_fn)(const metar_t *metar, int part, unsigned found, void *ctx);
+
+/* parse_Metar_n(), calling progress after every token and once more with
+ * METAR_PART_END. Returns 1 if progress stopped the decoding, which leaves
+ * the rest of metar unset, and 0 if the whole report was decoded.
+ */
+int parse_Metar_until(const char *report, size_t len, metar_t *metar,
+					  metar_progress_fn progress, void *ctx);
+
+/* parse_Metar_n() for a NUL terminated report */
+void parse_Metar(const char *report, metar_t *metar);
+
+/* free the cloud and phenomena lists allocated by parse_Metar() */
+void free_Metar(metar_t *metar);
+
+/* return the abbreviation of a cloud code (e.g. BKN), "" if there is none */
+const char *cloud_code_name(int code);
+
+/* return the two letters of a weather code (e.g. RA), or CAVOK */
+const char *weather_code_name(int code);
+
+/* compute the flight category (FLIGHT_CATEGORY_*) from the visibility and
+ * ceiling of a parsed METAR.
+ */
+int flight_category(const metar_t *metar);
+
+/* return the name of a flight category (VFR, MVFR, IFR, LIFR) or "" when unknown */
+const char *flight_category_name(int category);
+
+/* convert a date such as 2016-09-24T21:35:00Z (or with a space instead of
+ * the T) to seconds since the epoch. Returns -1 if the date is not valid.
  */
-void parse_Metar(char *report, metar_t *metar);
+time_t parse_date(const char *date);
+
+/* parse_date() for the len characters at date, which need not be NUL terminated */
+time_t parse_date_n(const char *date, size_t len);
+
+/* return the time of observation of a parsed METAR in seconds since the epoch.
+ * A METAR only contains the day of the month; the month and year are taken
+ * from the reference time, which should be shortly after the observation.
+ */
+time_t metar_time(const metar_t *metar, time_t reference);
 
 /* parse the NOAA report contained in the noaa_data buffer. Place a parsed
- * data in the metar struct. 
+ * data in the metar struct. Returns 1 for success, -1 if the response holds
+ * no reports and 0 for other errors.
  */
 int parse_NOAA_data(char *noaa_data, noaa_t *noaa);
 
+/* Parse an XML response of len bytes holding any number of reports (e.g.
+ * those of a region), filling at most max_reports entries of noaa. Returns
+ * the number of reports in the response (which may be more than max_reports),
+ * -1 if it contains no reports and 0 if it could not be interpreted.
+ */
+int parse_NOAA_reports(char *noaa_data, size_t len, noaa_t *noaa, int max_reports);
+
+/* called by parse_NOAA_stream() for every report; returns nonzero to stop */
+typedef int (*noaa_report_fn)(const noaa_t *noaa, void *ctx);
+
+/* Parse an XML response of len bytes holding any number of reports one
+ * report at a time, without building a tree of the whole response, and call
+ * fn for each. Returns the number of reports, -1 if the response holds no
+ * reports and 0 if it could not be interpreted or fn stopped the parsing.
+ */
+int parse_NOAA_stream(const char *noaa_data, size_t len, noaa_report_fn fn, void *ctx);
+
 
 #endif  /* End Include Guard - don't add code below */
\ No newline at end of file
@@ -0,0 +1,302 @@
+/* metarbench.c -- measure the kernels deriving quantities from batches
+   Copyright 2016 Andrew Walton <dwalton64@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* Decodes a file of raw METARs (e.g. written by metargen) into a batch, then
+ * times the vector and scalar versions of every kernel of derive.c over it.
+ * The results of both are compared with each other and with the same
+ * formulas computed in double precision by the C library.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "batch.h"
+#include "derive.h"
+
+/* read by metar.c */
+int verbose = 0;
+
+/* reports decoded with a single call */
+#define CHUNK_REPORTS 4096
+
+/* the columns filled by the kernels */
+typedef struct {
+	float *humidity;
+	float *pressure_alt;
+	float *density_alt;
+	float *headwind;
+	float *crosswind;
+} derived_t;
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* show brief usage info */
+static void usage(char *name) {
+	printf("Usage: %s [OPTION]... FILE\n", name);
+	printf("Time the kernels deriving humidity, altitudes and wind components from\n");
+	printf("the raw METARs in FILE, one per line.\n\n");
+	printf("Options\n");
+	printf("   -r N      run every kernel N times (default: 20)\n");
+	printf("   -h        show this help\n");
+	printf("Example: metargen -n 1000000 > metars.txt && %s metars.txt\n", name);
+}
+
+/* decode the reports in the file into the batch
+ * returns 0 for success, 1 for an error */
+static int read_Batch(const char *filename, metar_batch_t *batch) {
+	FILE *fp;
+	char *data = NULL, *grown, *p, *end, *eol;
+	size_t len = 0, size = 0, n;
+	span_t spans[CHUNK_REPORTS];
+	int count = 0;
+
+	if ((fp = fopen(filename, "r")) == NULL) {
+		perror(filename);
+		return 1;
+	}
+	do {
+		if (len == size) {
+			size = size ? 2 * size : 1 << 20;
+			if ((grown = realloc(data, size)) == NULL) {
+				fprintf(stderr, "Out of memory\n");
+				fclose(fp);
+				free(data);
+				return 1;
+			}
+			data = grown;
+		}
+		n = fread(data + len, 1, size - len, fp);
+		len += n;
+	} while (n > 0);
+	fclose(fp);
+
+	end = data + len;
+	for (p = data; p < end; p = eol + 1) {
+		if ((eol = memchr(p, '\n', (size_t) (end - p))) == NULL)
+			eol = end;
+		if (eol == p)
+			continue;
+		spans[count].ptr = p;
+		spans[count].len = (size_t) (eol - p);
+		if (++count == CHUNK_REPORTS || eol == end) {
+			if (parse_Metar_batch(spans, (size_t) count, batch)) {
+				fprintf(stderr, "Out of memory\n");
+				free(data);
+				return 1;
+			}
+			count = 0;
+		}
+	}
+	if (count > 0 && parse_Metar_batch(spans, (size_t) count, batch)) {
+		fprintf(stderr, "Out of memory\n");
+		free(data);
+		return 1;
+	}
+	free(data);
+	return 0;
+}
+
+/* run every kernel, the vector or the scalar versions, repeat times
+ * returns the seconds taken by each kernel */
+static void run_Kernels(const metar_batch_t *batch, const float *elevation, const float *runway,
+						derived_t *out, int scalar, int repeat, double *seconds) {
+	double start;
+	int r;
+
+	start = now();
+	for (r = 0; r < repeat; r++) {
+		if (scalar) derive_humidity_scalar(batch, out->humidity);
+		else derive_humidity(batch, out->humidity);
+	}
+	seconds[0] = now() - start;
+
+	start = now();
+	for (r = 0; r < repeat; r++) {
+		if (scalar) derive_altitudes_scalar(batch, elevation, out->pressure_alt, out->density_alt);
+		else derive_altitudes(batch, elevation, out->pressure_alt, out->density_alt);
+	}
+	seconds[1] = now() - start;
+
+	start = now();
+	for (r = 0; r < repeat; r++) {
+		if (scalar) derive_wind_scalar(batch, runway, out->headwind, out->crosswind);
+		else derive_wind(batch, runway, out->headwind, out->crosswind);
+	}
+	seconds[2] = now() - start;
+}
+
+/* largest difference between two columns, and whether they disagree on NaN */
+static double max_difference(const float *a, const float *b, size_t count) {
+	double diff, max = 0;
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		if (isnan(a[i]) != isnan(b[i]))
+			return INFINITY;
+		if (!isnan(a[i]) && (diff = fabs((double) a[i] - b[i])) > max)
+			max = diff;
+	}
+	return max;
+}
+
+/* the formulas of derive.h in double precision */
+static void reference(const metar_batch_t *batch, const float *elevation, const float *runway,
+					  derived_t *ref) {
+	double t, td, qnh, pa, angle;
+	size_t i;
+
+	for (i = 0; i < batch->count; i++) {
+		t = batch->temp[i];
+		td = batch->dewp[i];
+		ref->humidity[i] = (float) (100 * exp(17.625 * td / (243.04 + td) - 17.625 * t / (243.04 + t)));
+
+		if (batch->qnh[i] <= 0) {
+			ref->pressure_alt[i] = ref->density_alt[i] = NAN;
+		} else {
+			qnh = batch->qnh[i];
+			if (batch->flags[i] & BATCH_QNH_INHG)
+				qnh *= 0.338639;
+			pa = 145366.45 * (1 - pow(qnh / 1013.25, 0.190284)) + elevation[i] * 3.28084;
+			ref->pressure_alt[i] = (float) pa;
+			ref->density_alt[i] = (float) (pa + 118.8 * (t - (15 - 0.0019812 * pa)));
+		}
+
+		if (batch->winddir[i] < 0) {
+			ref->headwind[i] = 0;
+			ref->crosswind[i] = (float) batch->windstr[i];
+		} else {
+			angle = (batch->winddir[i] - runway[i]) * M_PI / 180;
+			ref->headwind[i] = (float) (batch->windstr[i] * cos(angle));
+			ref->crosswind[i] = (float) (batch->windstr[i] * sin(angle));
+		}
+	}
+}
+
+static int alloc_Derived(derived_t *d, size_t count) {
+	d->humidity = malloc(count * sizeof(float));
+	d->pressure_alt = malloc(count * sizeof(float));
+	d->density_alt = malloc(count * sizeof(float));
+	d->headwind = malloc(count * sizeof(float));
+	d->crosswind = malloc(count * sizeof(float));
+	return d->humidity == NULL || d->pressure_alt == NULL || d->density_alt == NULL ||
+		   d->headwind == NULL || d->crosswind == NULL;
+}
+
+static void free_Derived(derived_t *d) {
+	free(d->humidity);
+	free(d->pressure_alt);
+	free(d->density_alt);
+	free(d->headwind);
+	free(d->crosswind);
+}
+
+
+int main(int argc, char *argv[]) {
+	static const char *kernels[] = { "humidity", "altitudes", "wind" };
+	metar_batch_t batch;
+	derived_t vec, sca, ref;
+	float *elevation, *runway;
+	double vector_seconds[3], scalar_seconds[3], rows;
+	double start, decode_seconds;
+	int repeat = 20, res, k;
+	size_t i;
+
+	while ((res = getopt(argc, argv, "hr:")) != -1) {
+		switch (res) {
+			case 'r':
+				if ((repeat = atoi(optarg)) < 1) {
+					fprintf(stderr, "-r requires a positive number\n");
+					return 1;
+				}
+				break;
+			case 'h':
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if (optind != argc - 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	metar_batch_init(&batch);
+	start = now();
+	if (read_Batch(argv[optind], &batch))
+		return 1;
+	decode_seconds = now() - start;
+	if (batch.count == 0) {
+		fprintf(stderr, "%s holds no reports\n", argv[optind]);
+		metar_batch_free(&batch);
+		return 1;
+	}
+
+	/* made up stations and runways */
+	elevation = malloc(batch.count * sizeof(float));
+	runway = malloc(batch.count * sizeof(float));
+	if (elevation == NULL || runway == NULL || alloc_Derived(&vec, batch.count) ||
+		alloc_Derived(&sca, batch.count) || alloc_Derived(&ref, batch.count)) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	for (i = 0; i < batch.count; i++) {
+		elevation[i] = (float) (i % 2000);
+		runway[i] = (float) (i * 37 % 360);
+	}
+
+	run_Kernels(&batch, elevation, runway, &vec, 0, repeat, vector_seconds);
+	run_Kernels(&batch, elevation, runway, &sca, 1, repeat, scalar_seconds);
+	reference(&batch, elevation, runway, &ref);
+
+	rows = (double) batch.count * repeat;
+	printf("%lu reports decoded in %.2f s (%.0f reports/s), %d runs of every kernel\n",
+		   (unsigned long) batch.count, decode_seconds, batch.count / decode_seconds, repeat);
+	printf("%-10s %12s %12s %8s\n", "kernel", "vector ns", "scalar ns", "speedup");
+	for (k = 0; k < 3; k++)
+		printf("%-10s %12.3f %12.3f %7.1fx\n", kernels[k], vector_seconds[k] / rows * 1e9,
+			   scalar_seconds[k] / rows * 1e9, scalar_seconds[k] / vector_seconds[k]);
+
+	printf("largest difference   vector-scalar   vector-double\n");
+	printf("humidity %%            %13.6g %15.6g\n", max_difference(vec.humidity, sca.humidity, batch.count),
+		   max_difference(vec.humidity, ref.humidity, batch.count));
+	printf("pressure altitude ft  %13.6g %15.6g\n", max_difference(vec.pressure_alt, sca.pressure_alt, batch.count),
+		   max_difference(vec.pressure_alt, ref.pressure_alt, batch.count));
+	printf("density altitude ft   %13.6g %15.6g\n", max_difference(vec.density_alt, sca.density_alt, batch.count),
+		   max_difference(vec.density_alt, ref.density_alt, batch.count));
+	printf("headwind kt           %13.6g %15.6g\n", max_difference(vec.headwind, sca.headwind, batch.count),
+		   max_difference(vec.headwind, ref.headwind, batch.count));
+	printf("crosswind kt          %13.6g %15.6g\n", max_difference(vec.crosswind, sca.crosswind, batch.count),
+		   max_difference(vec.crosswind, ref.crosswind, batch.count));
+
+	free_Derived(&vec);
+	free_Derived(&sca);
+	free_Derived(&ref);
+	free(elevation);
+	free(runway);
+	metar_batch_free(&batch);
+	return 0;
+}
+
+// EOF
@@ -0,0 +1,554 @@
+/* metargen.c -- generator of synthetic METAR reports
+   Copyright 2016 Andrew Walton <dwalton64@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* Writes any number of made up but valid METARs, to measure and stress the
+ * decoder with more reports than can be recorded. Every station reports once
+ * an hour, at the same minute; the reports of an hour are written station by
+ * station. The same seed and options always give the same output.
+ */
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* longest report generated (plus NUL termination) */
+#define REPORT_SIZE 256
+
+/* size of a NOAA XML record of a report */
+#define RECORD_SIZE 1024
+
+/* 2016-10-01T00:00:00Z */
+#define DEFAULT_START 1475280000L
+
+/* the ICAO prefixes of the European stations */
+static const char *eu_prefixes[] = {
+	"EB", "ED", "EG", "EH", "EI", "EK", "EN", "EP", "ES", "LE", "LF", "LI", "LO"
+};
+#define NUM_EU_PREFIXES (sizeof(eu_prefixes) / sizeof(eu_prefixes[0]))
+
+/* ICAO codes available per format: K and three letters, or a European prefix and two */
+#define MAX_US_STATIONS (26 * 26 * 26)
+#define MAX_EU_STATIONS ((int) NUM_EU_PREFIXES * 26 * 26)
+
+/* precipitation, which may be light or heavy, and phenomena that may not */
+static const char *precipitation[] = {
+	"RA", "RA", "RA", "SN", "DZ", "SHRA", "SHRA", "SHSN", "TSRA", "SHRAGS",
+	"FZRA", "FZDZ", "TSRAGR", "RASN", "SHGS", "PL", "SG", "TSSN"
+};
+static const char *obscurations[] = {
+	"BR", "BR", "FG", "HZ", "FU", "BCFG", "MIFG", "VCSH", "VCTS", "BLSN", "DRSN"
+};
+#define NUM_PRECIPITATION (sizeof(precipitation) / sizeof(precipitation[0]))
+#define NUM_OBSCURATIONS (sizeof(obscurations) / sizeof(obscurations[0]))
+
+/* visibilities, from good to bad */
+static const char *us_visibilities[] = {
+	"10SM", "10SM", "10SM", "9SM", "7SM", "6SM", "5SM", "4SM", "3SM",
+	"2 1/2SM", "2SM", "1 1/2SM", "1 1/4SM", "1SM", "3/4SM", "1/2SM", "1/4SM", "M1/4SM"
+};
+static const int us_visibility_sixteenths[] = {
+	160, 160, 160, 144, 112, 96, 80, 64, 48, 40, 32, 24, 20, 16, 12, 8, 4, 2
+};
+static const int eu_visibilities[] = {
+	9999, 9999, 9999, 8000, 7000, 6000, 5000, 4000, 3000, 2500, 2000, 1500, 1200,
+	1000, 800, 600, 400, 300, 200, 100
+};
+#define NUM_US_VISIBILITIES (sizeof(us_visibilities) / sizeof(us_visibilities[0]))
+#define NUM_EU_VISIBILITIES (sizeof(eu_visibilities) / sizeof(eu_visibilities[0]))
+
+static const char *cloud_amounts[] = { "FEW", "SCT", "BKN", "OVC" };
+
+/* a generated station */
+typedef struct {
+	char name[5];
+	int us;                 // US format, otherwise European
+	int minute;             // minute of the hour the station reports at
+	int climate;            // mean temperature in degrees Celsius
+	double latitude;
+	double longitude;
+	double elevation_m;
+	char *last;             // XML record of the newest report, for -X
+} gen_station_t;
+
+/* the weather of one report */
+typedef struct {
+	int winddir;            // -1 for variable
+	int windstr;
+	int windgust;           // 0 if there are no gusts
+	int vis;                // sixteenths of a statute mile
+	int ceiling;            // hundreds of feet, -1 if there is none
+	int temp;
+	int dewp;
+} gen_weather_t;
+
+/* share of the reports, in percent */
+typedef struct {
+	int us;
+	int gusts;
+	int variable;
+	int weather;
+	int cavok;
+	int maintenance;
+} gen_mix_t;
+
+static uint64_t random_state;
+
+
+/* splitmix64, which is good enough and the same on every platform */
+static uint64_t next_random(void) {
+	uint64_t z = (random_state += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+/* a random number from 0 to n - 1 */
+static int random_int(int n) {
+	return (int) (next_random() % (uint64_t) n);
+}
+
+/* true in percent out of 100 cases */
+static int chance(int percent) {
+	return random_int(100) < percent;
+}
+
+/* append to the string at *p, which ends before end */
+static void append(char **p, char *end, const char *format, ...) {
+	va_list ap;
+	int n;
+
+	va_start(ap, format);
+	n = vsnprintf(*p, (size_t) (end - *p), format, ap);
+	va_end(ap);
+	if (n > 0)
+		*p += n < end - *p ? n : end - *p - 1;
+}
+
+
+/* create the stations, percent_us of them in US format
+ * returns NULL if out of memory */
+static gen_station_t *make_stations(int num_stations, int percent_us) {
+	gen_station_t *stations = calloc((size_t) num_stations, sizeof(gen_station_t));
+	gen_station_t *st;
+	int i, code, num_us = 0, num_eu = 0;
+
+	if (stations == NULL)
+		return NULL;
+	for (i = 0; i < num_stations; i++) {
+		st = &stations[i];
+		st->us = chance(percent_us);
+		if (st->us && num_us == MAX_US_STATIONS) st->us = 0;
+		if (!st->us && num_eu == MAX_EU_STATIONS) st->us = 1;
+
+		/* the codes are dealt out in an order that looks random, without repeats */
+		if (st->us) {
+			code = (int) ((num_us++ * 7919L + 4321) % MAX_US_STATIONS);
+			sprintf(st->name, "K%c%c%c", 'A' + code / 676, 'A' + code / 26 % 26, 'A' + code % 26);
+			st->minute = chance(80) ? 51 + random_int(5) : random_int(60);
+			st->latitude = 25 + random_int(2400) / 100.0;
+			st->longitude = -124 + random_int(5700) / 100.0;
+		} else {
+			code = (int) ((num_eu++ * 7919L + 1234) % MAX_EU_STATIONS);
+			sprintf(st->name, "%s%c%c", eu_prefixes[code / 676], 'A' + code / 26 % 26, 'A' + code % 26);
+			st->minute = chance(70) ? 20 + 30 * random_int(2) : 25 + 30 * random_int(2);
+			st->latitude = 36 + random_int(3000) / 100.0;
+			st->longitude = -10 + random_int(4000) / 100.0;
+		}
+		st->climate = 20 - (int) (st->latitude - 25) / 2 + random_int(7) - 3;
+		st->elevation_m = random_int(15000) / 10.0;
+	}
+	return stations;
+}
+
+
+/* write the cloud layers, the lowest first, and set the ceiling */
+static void make_clouds(char **p, char *end, gen_weather_t *wx, int us, int showers, int thunder, int fog) {
+	int layers, i, amount = 0, altitude = 0, modifier_layer;
+
+	wx->ceiling = -1;
+	if (fog && chance(50)) {
+		/* the sky cannot be seen */
+		wx->ceiling = 1 + random_int(5);
+		append(p, end, " VV%03d", wx->ceiling);
+		return;
+	}
+	if ((layers = random_int(5)) == 0 && !showers && !thunder) {
+		append(p, end, " %s", us ? "CLR" : "NSC");
+		return;
+	}
+	if (layers == 0)
+		layers = 1;
+	modifier_layer = thunder || (showers && chance(50)) ? random_int(layers) : -1;
+	for (i = 0; i < layers; i++) {
+		/* the layers get higher and usually denser */
+		altitude += i == 0 ? 3 + random_int(40) : 5 + random_int(60);
+		if (altitude > 450) break;
+		if (i > 0 && chance(60) && amount < 3) amount++;
+		else if (i == 0) amount = random_int(4);
+		append(p, end, " %s%03d", cloud_amounts[amount], altitude);
+		if (i == modifier_layer) append(p, end, "%s", thunder || chance(40) ? "CB" : "TCU");
+		if (amount >= 2 && wx->ceiling == -1)
+			wx->ceiling = altitude;
+		if (amount == 3)
+			break;   // nothing is seen above an overcast layer
+	}
+}
+
+/* write the weather groups; returns how much they reduce the visibility */
+static int make_weather(char **p, char *end, int *showers, int *thunder, int *fog) {
+	const char *group;
+	int groups = 1 + (chance(25) ? 1 : 0), i, reduce = 0;
+	int intensity;
+
+	*showers = *thunder = *fog = 0;
+	for (i = 0; i < groups; i++) {
+		if (i == 0 || chance(30)) {
+			group = precipitation[random_int((int) NUM_PRECIPITATION)];
+			intensity = random_int(10);
+			append(p, end, " %s%s", intensity < 4 ? "-" : intensity < 8 ? "" : "+", group);
+			reduce += intensity < 4 ? 2 : intensity < 8 ? 5 : 9;
+		} else {
+			group = obscurations[random_int((int) NUM_OBSCURATIONS)];
+			append(p, end, " %s", group);
+			reduce += 6;
+		}
+		if (strstr(group, "SH") != NULL) *showers = 1;
+		if (strstr(group, "TS") != NULL) *thunder = 1;
+		if (strstr(group, "FG") != NULL) *fog = 1;
+	}
+	if (*fog) reduce += 6;
+	return reduce;
+}
+
+/* write a report of a station observed at obs_time into report */
+static void make_report(const gen_station_t *st, time_t obs_time, const gen_mix_t *mix,
+						char *report, gen_weather_t *wx) {
+	char *p = report, *end = report + REPORT_SIZE;
+	char weather[REPORT_SIZE], *w = weather;
+	struct tm tm;
+	int showers = 0, thunder = 0, fog = 0, reduce = 0, vis, hour_from_peak;
+
+	gmtime_r(&obs_time, &tm);
+	append(&p, end, "%s %02d%02d%02dZ", st->name, tm.tm_mday, tm.tm_hour, tm.tm_min);
+	if (st->us && chance(30))
+		append(&p, end, " AUTO");
+
+	/* mostly light winds, now and then a gale */
+	wx->windstr = chance(10) ? 0 : 2 + random_int(chance(85) ? 14 : 40);
+	wx->winddir = wx->windstr == 0 ? 0 : 10 * (1 + random_int(36));
+	wx->windgust = 0;
+	if (wx->windstr > 0 && wx->windstr <= 6 && chance(mix->variable))
+		wx->winddir = -1;
+	if (wx->windstr >= 8 && chance(mix->gusts))
+		wx->windgust = wx->windstr + 5 + random_int(16);
+	if (wx->winddir == -1) append(&p, end, " VRB%02dKT", wx->windstr);
+	else append(&p, end, " %03d%02d", wx->winddir, wx->windstr);
+	if (wx->winddir != -1 && wx->windgust) append(&p, end, "G%02dKT", wx->windgust);
+	else if (wx->winddir != -1) append(&p, end, "KT");
+	if (wx->winddir > 0 && wx->windstr >= 6 && chance(10))
+		append(&p, end, " %03dV%03d", (wx->winddir + 320) % 360 + 10, (wx->winddir + 30) % 360 + 10);
+
+	/* the temperature follows the time of day, peaking at 15 UTC */
+	hour_from_peak = abs(tm.tm_hour - 15);
+	if (hour_from_peak > 12) hour_from_peak = 24 - hour_from_peak;
+	wx->temp = st->climate + 4 - hour_from_peak / 2 + random_int(3) - 1;
+	wx->dewp = wx->temp - random_int(15);
+
+	if (chance(mix->weather))
+		reduce = make_weather(&w, weather + sizeof(weather), &showers, &thunder, &fog);
+	*w = 0;
+
+	if (!st->us && reduce == 0 && chance(mix->cavok)) {
+		append(&p, end, " CAVOK");
+		wx->vis = 160;
+		wx->ceiling = -1;
+	} else {
+		if (st->us) {
+			vis = random_int(3) + reduce;
+			if (vis >= (int) NUM_US_VISIBILITIES) vis = NUM_US_VISIBILITIES - 1;
+			append(&p, end, " %s", us_visibilities[vis]);
+			wx->vis = us_visibility_sixteenths[vis];
+		} else {
+			vis = random_int(3) + reduce;
+			if (vis >= (int) NUM_EU_VISIBILITIES) vis = NUM_EU_VISIBILITIES - 1;
+			append(&p, end, " %04d", eu_visibilities[vis]);
+			wx->vis = eu_visibilities[vis] * 16 / 1609;
+		}
+		append(&p, end, "%s", weather);
+		make_clouds(&p, end, wx, st->us, showers, thunder, fog);
+	}
+	if (fog && wx->dewp < wx->temp - 1)
+		wx->dewp = wx->temp - 1;
+
+	append(&p, end, " %s%02d/%s%02d", wx->temp < 0 ? "M" : "", abs(wx->temp),
+		   wx->dewp < 0 ? "M" : "", abs(wx->dewp));
+	if (st->us) {
+		append(&p, end, " A%04d", 2920 + random_int(160));
+		append(&p, end, " RMK %s SLP%03d", chance(30) ? "AO1" : "AO2", random_int(1000));
+		if (chance(50))
+			append(&p, end, " T%d%03d%d%03d", wx->temp < 0, abs(wx->temp) * 10 + random_int(10),
+				   wx->dewp < 0, abs(wx->dewp) * 10 + random_int(10));
+	} else {
+		append(&p, end, " Q%04d", 985 + random_int(55));
+		if (chance(40)) append(&p, end, " NOSIG");
+	}
+	if (chance(mix->maintenance))
+		append(&p, end, " $");
+}
+
+/* flight category of the weather, as the server computes it */
+static const char *category_of(const gen_weather_t *wx) {
+	if ((wx->ceiling != -1 && wx->ceiling < 5) || wx->vis < 16) return "LIFR";
+	if ((wx->ceiling != -1 && wx->ceiling < 10) || wx->vis < 48) return "IFR";
+	if ((wx->ceiling != -1 && wx->ceiling <= 30) || wx->vis <= 80) return "MVFR";
+	return "VFR";
+}
+
+/* write the XML record the server returns for a report into record */
+static void make_record(const gen_station_t *st, time_t obs_time, const char *report,
+						const gen_weather_t *wx, char *record) {
+	char date[32];
+	struct tm tm;
+
+	gmtime_r(&obs_time, &tm);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", &tm);
+	snprintf(record, RECORD_SIZE,
+			 "    <METAR>\n"
+			 "      <raw_text>%s</raw_text>\n"
+			 "      <station_id>%s</station_id>\n"
+			 "      <observation_time>%s</observation_time>\n"
+			 "      <latitude>%.2f</latitude>\n"
+			 "      <longitude>%.2f</longitude>\n"
+			 "      <temp_c>%d.0</temp_c>\n"
+			 "      <dewpoint_c>%d.0</dewpoint_c>\n"
+			 "      <wind_dir_degrees>%d</wind_dir_degrees>\n"
+			 "      <wind_speed_kt>%d</wind_speed_kt>\n"
+			 "      <elevation_m>%.1f</elevation_m>\n"
+			 "      <flight_category>%s</flight_category>\n"
+			 "    </METAR>\n",
+			 report, st->name, date, st->latitude, st->longitude, wx->temp, wx->dewp,
+			 wx->winddir < 0 ? 0 : wx->winddir, wx->windstr, st->elevation_m, category_of(wx));
+}
+
+/* write the start of a response of the server holding num_results reports */
+static void response_head(FILE *fp, unsigned long num_results) {
+	fprintf(fp, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+			"<response version=\"1.2\">\n"
+			"  <request_index>1</request_index>\n"
+			"  <data_source name=\"metars\" />\n"
+			"  <request type=\"retrieve\" />\n"
+			"  <errors />\n"
+			"  <warnings />\n"
+			"  <time_taken_ms>1</time_taken_ms>\n"
+			"  <data num_results=\"%lu\">\n", num_results);
+}
+
+static void response_tail(FILE *fp) {
+	fprintf(fp, "  </data>\n</response>\n");
+}
+
+/* write the newest report of every station to a response of its own in dir
+ * returns 0 for success, 1 for an error */
+static int write_Station_files(const char *dir, const gen_station_t *stations, int num_stations) {
+	char path[4096];
+	FILE *fp;
+	int i;
+
+	if (mkdir(dir, 0755) != 0 && access(dir, W_OK) != 0) {
+		perror(dir);
+		return 1;
+	}
+	for (i = 0; i < num_stations; i++) {
+		if (stations[i].last == NULL)
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, stations[i].name);
+		if ((fp = fopen(path, "w")) == NULL) {
+			perror(path);
+			return 1;
+		}
+		response_head(fp, 1);
+		fputs(stations[i].last, fp);
+		response_tail(fp);
+		if (fclose(fp) != 0) {
+			perror(path);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+/* show brief usage info */
+static void usage(char *name) {
+	printf("Usage: %s [OPTION]...\n", name);
+	printf("Write synthetic METAR reports, one per line.\n\n");
+	printf("Options\n");
+	printf("   -n N      write N reports (default: 1000)\n");
+	printf("   -S SEED   seed of the random numbers (default: 1); the same seed and\n");
+	printf("             options always give the same reports\n");
+	printf("   -s N      number of stations, each reporting once an hour (default: 500)\n");
+	printf("   -T SECS   time of the first hour, in seconds since 1970 (default: %ld)\n", DEFAULT_START);
+	printf("   -u PCT    share of the stations in US format, the others are European (default: 50)\n");
+	printf("   -g PCT    share of the reports with wind over 8 KT that have gusts (default: 25)\n");
+	printf("   -V PCT    share of the reports with light wind that is variable (default: 20)\n");
+	printf("   -w PCT    share of the reports with weather phenomena (default: 30)\n");
+	printf("   -k PCT    share of the European reports without weather that are CAVOK (default: 30)\n");
+	printf("   -m PCT    share of the reports of stations needing maintenance ($) (default: 5)\n");
+	printf("   -t        start every line with the observation time, as metar -t does\n");
+	printf("   -x        write a single XML response of the server holding all reports\n");
+	printf("   -X DIR    also write the newest report of every station to DIR as the\n");
+	printf("             XML response of the server for that station (for METARURL=file://DIR/)\n");
+	printf("   -h        show this help\n");
+	printf("Example: %s -n 1000000 -S 7 > metars.txt && metar -d -f metars.txt\n", name);
+}
+
+/* a percentage option; exits if it is not valid */
+static int percent_arg(const char *arg, int option) {
+	char *end;
+	long value = strtol(arg, &end, 10);
+
+	if (end == arg || *end != 0 || value < 0 || value > 100) {
+		fprintf(stderr, "-%c requires a percentage from 0 to 100\n", option);
+		exit(EXIT_FAILURE);
+	}
+	return (int) value;
+}
+
+
+int main(int argc, char *argv[]) {
+	gen_mix_t mix = { 50, 25, 20, 30, 30, 5 };
+	gen_station_t *stations, *st;
+	gen_weather_t wx;
+	unsigned long count = 1000, i;
+	long start = DEFAULT_START;
+	int num_stations = 500, dates = 0, xml = 0, res, retval = 0;
+	char *dir = NULL;
+	char report[REPORT_SIZE];
+	char record[RECORD_SIZE];
+	char date[32];
+	time_t obs_time;
+	struct tm tm;
+
+	random_state = 1;
+	while ((res = getopt(argc, argv, "hn:S:s:T:u:g:V:w:k:m:txX:")) != -1) {
+		switch (res) {
+			case 'n':
+				count = strtoul(optarg, NULL, 10);
+				break;
+			case 'S':
+				random_state = strtoull(optarg, NULL, 10);
+				break;
+			case 's':
+				num_stations = atoi(optarg);
+				if (num_stations < 1 || num_stations > MAX_US_STATIONS + MAX_EU_STATIONS) {
+					fprintf(stderr, "-s requires 1 to %d stations\n", MAX_US_STATIONS + MAX_EU_STATIONS);
+					return 1;
+				}
+				break;
+			case 'T':
+				start = atol(optarg);
+				break;
+			case 'u':
+				mix.us = percent_arg(optarg, res);
+				break;
+			case 'g':
+				mix.gusts = percent_arg(optarg, res);
+				break;
+			case 'V':
+				mix.variable = percent_arg(optarg, res);
+				break;
+			case 'w':
+				mix.weather = percent_arg(optarg, res);
+				break;
+			case 'k':
+				mix.cavok = percent_arg(optarg, res);
+				break;
+			case 'm':
+				mix.maintenance = percent_arg(optarg, res);
+				break;
+			case 't':
+				dates = 1;
+				break;
+			case 'x':
+				xml = 1;
+				break;
+			case 'X':
+				dir = optarg;
+				break;
+			case 'h':
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+	if ((stations = make_stations(num_stations, mix.us)) == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	/* the reports are written in large blocks */
+	setvbuf(stdout, NULL, _IOFBF, 1 << 20);
+	if (xml)
+		response_head(stdout, count);
+
+	for (i = 0; i < count; i++) {
+		st = &stations[i % (unsigned long) num_stations];
+		obs_time = (time_t) (start + (long) (i / (unsigned long) num_stations) * 3600 + st->minute * 60);
+		make_report(st, obs_time, &mix, report, &wx);
+
+		if (xml || dir != NULL)
+			make_record(st, obs_time, report, &wx, record);
+		if (xml) {
+			fputs(record, stdout);
+		} else {
+			if (dates) {
+				gmtime_r(&obs_time, &tm);
+				strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%SZ ", &tm);
+				fputs(date, stdout);
+			}
+			puts(report);
+		}
+		if (dir != NULL) {
+			if (st->last == NULL && (st->last = malloc(RECORD_SIZE)) == NULL) {
+				fprintf(stderr, "Out of memory\n");
+				return 1;
+			}
+			memcpy(st->last, record, RECORD_SIZE);
+		}
+	}
+	if (xml)
+		response_tail(stdout);
+	if (fflush(stdout) != 0) {
+		perror("stdout");
+		retval = 1;
+	}
+
+	if (dir != NULL && write_Station_files(dir, stations, num_stations))
+		retval = 1;
+	for (res = 0; res < num_stations; res++)
+		free(stations[res].last);
+	free(stations);
+	return retval;
+}
+
+// EOF
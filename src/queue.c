@@ -0,0 +1,166 @@
+/* queue.c -- bounded lock-free queue connecting threads
+   Copyright 2016 Andrew Walton <dwalton64@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <sched.h>
+#include <time.h>
+#include "queue.h"
+
+struct queue_cell {
+	atomic_size_t seq;    // position that may use the cell next
+	void *item;
+};
+
+/* number of times a waiting thread yields before it starts sleeping */
+#define QUEUE_SPINS 64
+/* longest sleep of a waiting thread, in nanoseconds */
+#define QUEUE_MAX_SLEEP 1000000
+
+
+/* wait a little longer every time; stages waiting for the network may wait long */
+static void backoff(unsigned *round) {
+	struct timespec ts;
+
+	if (*round < QUEUE_SPINS) {
+		(*round)++;
+		sched_yield();
+		return;
+	}
+	ts.tv_sec = 0;
+	ts.tv_nsec = 1000L << (*round - QUEUE_SPINS);
+	if (ts.tv_nsec < QUEUE_MAX_SLEEP) (*round)++;
+	else ts.tv_nsec = QUEUE_MAX_SLEEP;
+	nanosleep(&ts, NULL);
+}
+
+
+/* PUBLIC--
+ * Initialise a queue holding at least capacity items.
+ */
+int queue_init(queue_t *queue, size_t capacity) {
+	size_t size = 2, i;
+
+	while (size < capacity)
+		size *= 2;
+	queue->cells = malloc(size * sizeof(queue_cell_t));
+	if (queue->cells == NULL)
+		return 1;
+	for (i = 0; i < size; i++)
+		atomic_init(&queue->cells[i].seq, i);
+	queue->mask = size - 1;
+	atomic_init(&queue->head, 0);
+	atomic_init(&queue->tail, 0);
+	atomic_init(&queue->closed, 0);
+	return 0;
+}
+
+/* PUBLIC--
+ * Add an item without waiting.
+ */
+int queue_try_push(queue_t *queue, void *item) {
+	size_t pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+	queue_cell_t *cell;
+	intptr_t diff;
+
+	for (;;) {
+		cell = &queue->cells[pos & queue->mask];
+		diff = (intptr_t) atomic_load_explicit(&cell->seq, memory_order_acquire) - (intptr_t) pos;
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(&queue->head, &pos, pos + 1,
+													  memory_order_relaxed, memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			return 1;   // the cell still holds the item of the previous lap
+		} else {
+			pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+		}
+	}
+	cell->item = item;
+	atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+	return 0;
+}
+
+/* PUBLIC--
+ * Remove the oldest item without waiting.
+ */
+void *queue_try_pop(queue_t *queue) {
+	size_t pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+	queue_cell_t *cell;
+	intptr_t diff;
+	void *item;
+
+	for (;;) {
+		cell = &queue->cells[pos & queue->mask];
+		diff = (intptr_t) atomic_load_explicit(&cell->seq, memory_order_acquire) - (intptr_t) (pos + 1);
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(&queue->tail, &pos, pos + 1,
+													  memory_order_relaxed, memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			return NULL;   // nothing was pushed to the cell in this lap yet
+		} else {
+			pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+		}
+	}
+	item = cell->item;
+	atomic_store_explicit(&cell->seq, pos + queue->mask + 1, memory_order_release);
+	return item;
+}
+
+/* PUBLIC--
+ * Add an item, waiting while the queue is full.
+ */
+void queue_push(queue_t *queue, void *item) {
+	unsigned round = 0;
+
+	while (queue_try_push(queue, item))
+		backoff(&round);
+}
+
+/* PUBLIC--
+ * Remove the oldest item, waiting while the queue is empty. Returns NULL once
+ * the queue is closed and empty.
+ */
+void *queue_pop(queue_t *queue) {
+	unsigned round = 0;
+	void *item;
+
+	for (;;) {
+		if ((item = queue_try_pop(queue)) != NULL)
+			return item;
+		if (atomic_load_explicit(&queue->closed, memory_order_acquire))
+			/* the last items may have been pushed just before closing */
+			return queue_try_pop(queue);
+		backoff(&round);
+	}
+}
+
+/* PUBLIC--
+ * Tell the consumers that nothing more will be pushed.
+ */
+void queue_close(queue_t *queue) {
+	atomic_store_explicit(&queue->closed, 1, memory_order_release);
+}
+
+/* PUBLIC--
+ * Free the ring.
+ */
+void queue_destroy(queue_t *queue) {
+	free(queue->cells);
+	queue->cells = NULL;
+}
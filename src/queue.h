@@ -0,0 +1,70 @@
+/* queue.h -- bounded lock-free queue connecting threads
+   Copyright 2016 Andrew Walton <dwalton64@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef Already_included_queue_h
+#define Already_included_queue_h 1
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+/* A fixed size ring of pointers that any number of threads may push to and
+ * pop from without taking a lock. Every cell carries a sequence number that
+ * tells whether it is ready to be written or read in the current lap of the
+ * ring, so producers and consumers only contend on their own position.
+ *
+ * queue_push() waits while the queue is full, which holds back a stage that
+ * runs ahead of the next one. Once the producers are done the queue is closed
+ * and queue_pop() returns NULL when it is empty.
+ */
+#define QUEUE_CACHE_LINE 64
+
+typedef struct queue_cell queue_cell_t;
+
+typedef struct {
+	queue_cell_t *cells;
+	size_t mask;                                      // capacity - 1, a power of two
+	_Alignas(QUEUE_CACHE_LINE) atomic_size_t head;    // next position to push
+	_Alignas(QUEUE_CACHE_LINE) atomic_size_t tail;    // next position to pop
+	_Alignas(QUEUE_CACHE_LINE) atomic_int closed;
+} queue_t;
+
+/* initialise a queue holding at least capacity items.
+ * Returns 0 for success, 1 if out of memory.
+ */
+int queue_init(queue_t *queue, size_t capacity);
+
+/* add item (not NULL) without waiting. Returns 0 for success, 1 if the queue is full */
+int queue_try_push(queue_t *queue, void *item);
+
+/* remove the oldest item without waiting. Returns NULL if the queue is empty */
+void *queue_try_pop(queue_t *queue);
+
+/* add item, waiting while the queue is full */
+void queue_push(queue_t *queue, void *item);
+
+/* remove the oldest item, waiting while the queue is empty.
+ * Returns NULL once the queue is closed and empty.
+ */
+void *queue_pop(queue_t *queue);
+
+/* tell the consumers that nothing more will be pushed */
+void queue_close(queue_t *queue);
+
+/* free the ring; the items in it are not freed */
+void queue_destroy(queue_t *queue);
+
+#endif  /* End Include Guard - don't add code below */
@@ -0,0 +1,163 @@
+/* schedule.c -- deciding when to poll the stations of -w
+   Copyright 2016 Andrew Walton <dwalton64@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "schedule.h"
+
+#define MINUTE_OF(t) ((int) (((t) / 60) % 60))
+
+
+/* first expected observation time after t, -1 if none is known. Reports are
+ * expected at the minutes of the hour most of them were observed at; the
+ * special reports in between are too rare to count. */
+static time_t next_issue(const sched_station_t *st, time_t t) {
+	time_t minute = t - t % 60;
+	int i, m, max = 0;
+
+	for (i = 0; i < 60; i++)
+		if (st->minutes[i] > max) max = st->minutes[i];
+	for (i = 1; i <= 60; i++) {
+		m = MINUTE_OF(minute + 60 * i);
+		if (st->minutes[m] >= 2 && 4 * st->minutes[m] >= max)
+			return minute + 60 * i;
+	}
+	return -1;
+}
+
+
+/* PUBLIC--
+ * Create the schedule of the stations.
+ */
+schedule_t *schedule_new(int num_stations, int interval) {
+	schedule_t *sched = malloc(sizeof(schedule_t));
+	int i;
+
+	if (sched == NULL)
+		return NULL;
+	if ((sched->stations = calloc((size_t) num_stations + 1, sizeof(sched_station_t))) == NULL) {
+		free(sched);
+		return NULL;
+	}
+	for (i = 0; i < num_stations; i++) {
+		sched->stations[i].lag = SCHED_DEFAULT_LAG;
+		sched->stations[i].last_obs = -1;
+		sched->stations[i].next_poll = 0;
+	}
+	sched->num_stations = num_stations;
+	sched->interval = interval;
+	sched->polls = 0;
+	return sched;
+}
+
+/* PUBLIC--
+ * Learn from a report of a station.
+ */
+void schedule_observed(schedule_t *sched, int i, time_t obs_time, time_t seen) {
+	sched_station_t *st = &sched->stations[i];
+	int m = MINUTE_OF(obs_time), j, lag;
+
+	if (obs_time <= st->last_obs)
+		return;
+	st->last_obs = obs_time;
+	st->reports++;
+
+	/* old habits fade, so a station that changes its minutes is followed */
+	if (st->minutes[m] == UINT8_MAX)
+		for (j = 0; j < 60; j++)
+			st->minutes[j] /= 2;
+	st->minutes[m]++;
+
+	/* a report that was only seen after a long wait says little about the
+	 * delay of the server, as the station was not polled in the meantime.
+	 * That is always the case before the issue times are known. */
+	if (seen == -1 || st->reports <= SCHED_MIN_REPORTS || (lag = (int) (seen - obs_time)) < 0 || lag >= st->lag + SCHED_WINDOW)
+		return;
+	/* a report that was there at the first poll may have been there earlier;
+	 * one that was late moves the expected delay towards its own */
+	if (lag <= st->lag) st->lag = lag > SCHED_LAG_STEP ? lag - SCHED_LAG_STEP : 0;
+	else st->lag = (3 * st->lag + lag) / 4;
+}
+
+/* PUBLIC--
+ * Plan the next poll of a station.
+ */
+void schedule_polled(schedule_t *sched, int i, time_t now, int invalid) {
+	sched_station_t *st = &sched->stations[i];
+	time_t sparse = now + sched->interval, after, issue, next = sparse;
+
+	sched->polls++;
+	if (invalid) {
+		st->next_poll = SCHED_NEVER;
+		return;
+	}
+
+	if (st->reports >= SCHED_MIN_REPORTS) {
+		/* wait for the first report after the newest one, skipping the ones
+		 * that were not issued */
+		after = st->last_obs;
+		if (after < now - st->lag - SCHED_WINDOW - 3600)
+			after = now - st->lag - SCHED_WINDOW - 3600;
+		while ((issue = next_issue(st, after)) != -1) {
+			if (now < issue + st->lag) {
+				next = issue + st->lag;
+				break;
+			}
+			if (now < issue + st->lag + SCHED_WINDOW) {
+				next = now + SCHED_DENSE;
+				break;
+			}
+			after = issue;
+		}
+	}
+	/* a station polled early with a batch is not due again right away */
+	if (next < now + 2 * SCHED_BATCH)
+		next = now + 2 * SCHED_BATCH;
+	st->next_poll = next < sparse ? next : sparse;
+}
+
+/* PUBLIC--
+ * Find the stations to poll.
+ */
+int schedule_due(schedule_t *sched, time_t now, int *due) {
+	int i, n = 0;
+
+	for (i = 0; i < sched->num_stations; i++)
+		if (sched->stations[i].next_poll <= now + SCHED_BATCH)
+			due[n++] = i;
+	return n;
+}
+
+/* PUBLIC--
+ * Time of the earliest poll.
+ */
+time_t schedule_next(const schedule_t *sched) {
+	time_t next = SCHED_NEVER;
+	int i;
+
+	for (i = 0; i < sched->num_stations; i++)
+		if (sched->stations[i].next_poll < next)
+			next = sched->stations[i].next_poll;
+	return next;
+}
+
+void schedule_free(schedule_t *sched) {
+	if (sched == NULL)
+		return;
+	free(sched->stations);
+	free(sched);
+}
@@ -0,0 +1,82 @@
+/* schedule.h -- deciding when to poll the stations of -w
+   Copyright 2016 Andrew Walton <dwalton64@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef Already_included_schedule_h
+#define Already_included_schedule_h 1
+
+#include <stdint.h>
+#include <time.h>
+
+/* Most stations issue their routine reports at the same minutes of every hour
+ * (e.g. hh:51, or hh:25 and hh:55) and the server has them a few minutes
+ * later. A station keeps a histogram of the minutes of its observation times
+ * and learns the delay until the reports can be fetched. Once it has seen a few reports
+ * it is polled when the next one is expected, then every SCHED_DENSE seconds
+ * until it arrives or SCHED_WINDOW seconds have passed. In between it is only
+ * polled every interval seconds (-w), which catches the special reports.
+ *
+ * Stations due within SCHED_BATCH seconds of each other are polled together.
+ */
+#define SCHED_MIN_REPORTS 3       // reports seen before the issue times are trusted
+#define SCHED_DEFAULT_LAG 180     // seconds until a new report is available
+#define SCHED_LAG_STEP    10      // seconds the delay is shortened by when a report was in time
+#define SCHED_DENSE       60      // seconds between polls while a report is expected
+#define SCHED_WINDOW      600     // seconds a late report is polled for
+#define SCHED_BATCH       15
+
+/* next poll of a station that is never polled again */
+#define SCHED_NEVER ((time_t) INT64_MAX)
+
+typedef struct {
+	uint8_t minutes[60];      // reports observed at every minute of the hour
+	int reports;
+	int lag;                  // seconds from observation to availability
+	time_t last_obs;          // newest observation time, -1 if none
+	time_t next_poll;
+} sched_station_t;
+
+typedef struct {
+	sched_station_t *stations;
+	int num_stations;
+	int interval;             // longest time between polls of a station
+	unsigned long polls;      // station polls so far
+} schedule_t;
+
+/* a schedule of num_stations stations, polled at least every interval
+ * seconds; all are due right away. Returns NULL if out of memory.
+ */
+schedule_t *schedule_new(int num_stations, int interval);
+
+/* station i has a report observed at obs_time, which was first seen at seen
+ * (-1 if not known, e.g. a report read from the store) */
+void schedule_observed(schedule_t *sched, int i, time_t obs_time, time_t seen);
+
+/* station i was polled at now; plans its next poll. A station that is not
+ * valid (invalid is set) is not polled again. */
+void schedule_polled(schedule_t *sched, int i, time_t now, int invalid);
+
+/* store the numbers of the stations to poll at now into due, in order.
+ * Returns the number of stations.
+ */
+int schedule_due(schedule_t *sched, time_t now, int *due);
+
+/* time of the earliest poll planned, SCHED_NEVER if there is none */
+time_t schedule_next(const schedule_t *sched);
+
+void schedule_free(schedule_t *sched);
+
+#endif  /* End Include Guard - don't add code below */
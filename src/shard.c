@@ -0,0 +1,417 @@
+/* shard.c -- sweeps split among worker processes
+   Copyright 2016 Andrew Walton <dwalton64@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "shard.h"
+#include "station.h"
+
+/* header of every frame, followed by payload_len bytes */
+typedef struct {
+	uint32_t type;          // SHARD_FRAME_*
+	uint32_t seq;           // position of the station in the shard
+	int32_t  status;
+	uint32_t output_len;    // the output comes first in the payload
+	uint32_t has_rec;       // a shard_rec_t and the report follow the output
+	uint32_t payload_len;
+} shard_frame_t;
+
+/* the observation of a result. Interned station ids differ between
+ * processes, so the name of the station is sent along. */
+typedef struct {
+	obs_record_t rec;
+	char station[16];
+} shard_rec_t;
+
+typedef struct {
+	pid_t pid;
+	int fd;                    // -1 once the worker closed the pipe
+	char **stations;
+	unsigned long *index;      // position on the command line of every station
+	unsigned long count;
+	unsigned long received;    // results received so far
+	char *buf;                 // received bytes not forming a whole frame yet
+	size_t len;
+	size_t size;
+	int have_magic;
+	int failed;
+} shard_t;
+
+/* stands in for the results a dead worker did not send */
+static char lost_result;
+
+
+/* PUBLIC--
+ * Start the stream of a worker.
+ */
+int shard_write_header(FILE *fp) {
+	return fwrite(SHARD_MAGIC, 1, SHARD_MAGIC_LEN, fp) != SHARD_MAGIC_LEN;
+}
+
+/* PUBLIC--
+ * Send the result of a station.
+ */
+int shard_write_result(FILE *fp, unsigned long seq, int status, const char *output,
+					   size_t output_len, const obs_record_t *rec, const char *report) {
+	shard_frame_t frame;
+	shard_rec_t srec;
+
+	memset(&frame, 0, sizeof(frame));
+	frame.type = SHARD_FRAME_RESULT;
+	frame.seq = (uint32_t) seq;
+	frame.status = status;
+	frame.output_len = (uint32_t) output_len;
+	frame.payload_len = (uint32_t) output_len;
+	if (rec != NULL) {
+		memset(&srec, 0, sizeof(srec));
+		srec.rec = *rec;
+		station_name(rec->station, srec.station);
+		frame.has_rec = 1;
+		frame.payload_len += sizeof(srec) + rec->report_len;
+	}
+	if (frame.payload_len > SHARD_MAX_PAYLOAD)
+		return 1;
+
+	fwrite(&frame, sizeof(frame), 1, fp);
+	if (output_len > 0)
+		fwrite(output, 1, output_len, fp);
+	if (rec != NULL) {
+		fwrite(&srec, sizeof(srec), 1, fp);
+		fwrite(report, 1, rec->report_len, fp);
+	}
+	return ferror(fp) != 0;
+}
+
+/* PUBLIC--
+ * End the stream of a worker.
+ */
+int shard_write_stats(FILE *fp, const shard_stats_t *stats) {
+	shard_frame_t frame;
+
+	memset(&frame, 0, sizeof(frame));
+	frame.type = SHARD_FRAME_STATS;
+	frame.payload_len = sizeof(shard_stats_t);
+	fwrite(&frame, sizeof(frame), 1, fp);
+	fwrite(stats, sizeof(shard_stats_t), 1, fp);
+	return ferror(fp) != 0;
+}
+
+
+/* start the worker of a shard with a pipe to read its frames from
+ * returns 0 for success, 1 for an error */
+static int start_shard(const shard_config_t *cfg, shard_t *sh) {
+	int fds[2];
+	char *script, **argv;
+	unsigned long i;
+
+	if (pipe(fds) != 0) {
+		perror("pipe");
+		return 1;
+	}
+	/* later workers must not keep the pipes of the earlier ones open */
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+
+	/* the child would write out what is still buffered a second time */
+	fflush(NULL);
+	if ((sh->pid = fork()) == -1) {
+		perror("fork");
+		close(fds[0]);
+		close(fds[1]);
+		return 1;
+	}
+
+	if (sh->pid == 0) {
+		close(fds[0]);
+		if (cfg->command == NULL) {
+			FILE *out = fdopen(fds[1], "w");
+			/* anything printed by the worker goes to stderr, not into the output */
+			dup2(STDERR_FILENO, STDOUT_FILENO);
+			_exit(out == NULL ? 1 : cfg->worker(sh->stations, (int) sh->count, out));
+		}
+
+		/* sh -c '<command> "$@"' sh STATION... */
+		script = malloc(strlen(cfg->command) + 6);
+		argv = malloc((sh->count + 5) * sizeof(char *));
+		if (script == NULL || argv == NULL)
+			_exit(1);
+		sprintf(script, "%s \"$@\"", cfg->command);
+		argv[0] = "sh";
+		argv[1] = "-c";
+		argv[2] = script;
+		argv[3] = "sh";
+		for (i = 0; i < sh->count; i++)
+			argv[4 + i] = sh->stations[i];
+		argv[4 + i] = NULL;
+		dup2(fds[1], STDOUT_FILENO);
+		close(fds[1]);
+		execv("/bin/sh", argv);
+		perror("/bin/sh");
+		_exit(127);
+	}
+
+	close(fds[1]);
+	sh->fd = fds[0];
+	return 0;
+}
+
+/* take the whole frames out of the buffer of a shard
+ * returns 0 for success, 1 if the worker does not speak the protocol */
+static int take_frames(shard_t *sh, char **results, shard_stats_t *stats) {
+	shard_frame_t frame;
+	size_t pos = 0, total;
+	char *copy;
+
+	if (!sh->have_magic) {
+		if (sh->len < SHARD_MAGIC_LEN)
+			return 0;
+		if (memcmp(sh->buf, SHARD_MAGIC, SHARD_MAGIC_LEN) != 0)
+			return 1;
+		sh->have_magic = 1;
+		pos = SHARD_MAGIC_LEN;
+	}
+
+	while (sh->len - pos >= sizeof(frame)) {
+		memcpy(&frame, sh->buf + pos, sizeof(frame));
+		if (frame.payload_len > SHARD_MAX_PAYLOAD)
+			return 1;
+		total = sizeof(frame) + frame.payload_len;
+		if (sh->len - pos < total)
+			break;
+
+		if (frame.type == SHARD_FRAME_RESULT) {
+			/* a worker sends its stations in order, so the frame says nothing new
+			 * about which one it is; it is only checked */
+			if (frame.seq != sh->received || sh->received >= sh->count ||
+				frame.output_len > frame.payload_len)
+				return 1;
+			if ((copy = malloc(total)) == NULL)
+				return 1;
+			memcpy(copy, sh->buf + pos, total);
+			results[sh->index[sh->received++]] = copy;
+		} else if (frame.type == SHARD_FRAME_STATS && frame.payload_len == sizeof(shard_stats_t)) {
+			memcpy(stats, sh->buf + pos + sizeof(frame), sizeof(shard_stats_t));
+		} else {
+			return 1;
+		}
+		pos += total;
+	}
+
+	memmove(sh->buf, sh->buf + pos, sh->len - pos);
+	sh->len -= pos;
+	return 0;
+}
+
+/* read what the worker of a shard sent; closes the pipe at the end
+ * returns 0 for success, 1 for an error */
+static int read_shard(shard_t *sh, int num, char **results, shard_stats_t *stats) {
+	ssize_t n;
+	size_t grow;
+	char *p;
+
+	if (sh->size - sh->len < 4096) {
+		grow = sh->size ? 2 * sh->size : 65536;
+		if ((p = realloc(sh->buf, grow)) == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			return 1;
+		}
+		sh->buf = p;
+		sh->size = grow;
+	}
+
+	n = read(sh->fd, sh->buf + sh->len, sh->size - sh->len);
+	if (n < 0 && (errno == EINTR || errno == EAGAIN))
+		return 0;
+	if (n > 0) {
+		sh->len += (size_t) n;
+		if (take_frames(sh, results, stats) == 0)
+			return 0;
+		fprintf(stderr, "Shard %d sent an invalid result\n", num);
+	} else if (n < 0) {
+		perror("read");
+	}
+
+	/* the worker is done, or is not heard any more */
+	close(sh->fd);
+	sh->fd = -1;
+	return n != 0 || sh->len != 0;
+}
+
+/* wait for the worker of a shard and report how it ended
+ * returns 0 if it succeeded, 1 otherwise */
+static int wait_shard(shard_t *sh, int num) {
+	int status;
+
+	while (waitpid(sh->pid, &status, 0) == -1) {
+		if (errno != EINTR) {
+			perror("waitpid");
+			return 1;
+		}
+	}
+	if (WIFSIGNALED(status)) {
+		fprintf(stderr, "Shard %d was killed by signal %d\n", num, WTERMSIG(status));
+		return 1;
+	}
+	return WEXITSTATUS(status) != 0;
+}
+
+
+/* PUBLIC--
+ * Split the stations among workers and merge their results in order.
+ */
+int shard_run(const shard_config_t *cfg, char **stations, unsigned long num_stations,
+			  const int *shard_of, shard_callback_t cb, void *ctx) {
+	shard_t *shards;
+	struct pollfd *fds;
+	char **results;
+	shard_frame_t frame;
+	shard_rec_t srec;
+	shard_result_t res;
+	unsigned long i, next = 0;
+	int s, n, open_shards = 0, retval = 0;
+
+	shards = calloc((size_t) cfg->num_shards, sizeof(shard_t));
+	fds = calloc((size_t) cfg->num_shards, sizeof(struct pollfd));
+	results = calloc(num_stations, sizeof(char *));
+	if (shards == NULL || fds == NULL || results == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	memset(cfg->stats, 0, (size_t) cfg->num_shards * sizeof(shard_stats_t));
+
+	/* the stations of a shard keep their command line order */
+	for (i = 0; i < num_stations; i++)
+		shards[shard_of[i]].count++;
+	for (s = 0; s < cfg->num_shards; s++) {
+		shards[s].fd = -1;
+		shards[s].stations = malloc((shards[s].count + 1) * sizeof(char *));
+		shards[s].index = malloc((shards[s].count + 1) * sizeof(unsigned long));
+		if (shards[s].stations == NULL || shards[s].index == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		shards[s].count = 0;
+	}
+	for (i = 0; i < num_stations; i++) {
+		shard_t *sh = &shards[shard_of[i]];
+		sh->stations[sh->count] = stations[i];
+		sh->index[sh->count++] = i;
+	}
+
+	/* a worker that dies must not take the coordinator with it */
+	signal(SIGPIPE, SIG_IGN);
+	for (s = 0; s < cfg->num_shards; s++) {
+		if (shards[s].count == 0)
+			continue;
+		if (start_shard(cfg, &shards[s])) {
+			shards[s].failed = 1;
+			retval = 1;
+		} else {
+			open_shards++;
+		}
+	}
+
+	while (next < num_stations) {
+		/* a shard that is done gives up on the stations it did not send */
+		for (s = 0; s < cfg->num_shards; s++) {
+			shard_t *sh = &shards[s];
+			if (sh->fd != -1 || sh->received == sh->count)
+				continue;
+			for (; sh->received < sh->count; sh->received++)
+				results[sh->index[sh->received]] = &lost_result;
+		}
+
+		for (; next < num_stations && results[next] != NULL; next++) {
+			if (results[next] == &lost_result) {
+				if (cb(next, NULL, ctx)) retval = 1;
+				continue;
+			}
+			memcpy(&frame, results[next], sizeof(frame));
+			res.status = frame.status;
+			res.output = results[next] + sizeof(frame);
+			res.output_len = frame.output_len;
+			res.rec = NULL;
+			res.report = NULL;
+			if (frame.has_rec && frame.payload_len >= frame.output_len + sizeof(srec)) {
+				memcpy(&srec, res.output + frame.output_len, sizeof(srec));
+				srec.station[sizeof(srec.station) - 1] = 0;
+				srec.rec.station = station_id(srec.station);
+				if (frame.payload_len == frame.output_len + sizeof(srec) + srec.rec.report_len) {
+					res.rec = &srec.rec;
+					res.report = res.output + frame.output_len + sizeof(srec);
+				}
+			}
+			if (cb(next, &res, ctx)) retval = 1;
+			free(results[next]);
+		}
+		if (next == num_stations || open_shards == 0)
+			break;
+
+		n = 0;
+		for (s = 0; s < cfg->num_shards; s++) {
+			if (shards[s].fd == -1)
+				continue;
+			fds[n].fd = shards[s].fd;
+			fds[n].events = POLLIN;
+			fds[n].revents = 0;
+			n++;
+		}
+		if (poll(fds, (nfds_t) n, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			retval = 1;
+			break;
+		}
+		for (s = 0, n = 0; s < cfg->num_shards; s++) {
+			if (shards[s].fd == -1)
+				continue;
+			if (fds[n++].revents == 0)
+				continue;
+			if (read_shard(&shards[s], s, results, &cfg->stats[s])) {
+				shards[s].failed = 1;
+				retval = 1;
+			}
+			if (shards[s].fd == -1)
+				open_shards--;
+		}
+	}
+
+	for (s = 0; s < cfg->num_shards; s++) {
+		if (shards[s].fd != -1)
+			close(shards[s].fd);
+		if (shards[s].pid > 0 && wait_shard(&shards[s], s))
+			retval = 1;
+		free(shards[s].stations);
+		free(shards[s].index);
+		free(shards[s].buf);
+	}
+	for (i = next; i < num_stations; i++)
+		if (results[i] != &lost_result)
+			free(results[i]);
+	free(results);
+	free(shards);
+	free(fds);
+	return retval;
+}
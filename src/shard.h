@@ -0,0 +1,110 @@
+/* shard.h -- sweeps split among worker processes
+   Copyright 2016 Andrew Walton <dwalton64@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef Already_included_shard_h
+#define Already_included_shard_h 1
+
+#include <stdio.h>
+#include <stdint.h>
+#include "store.h"
+
+/* A coordinator gives every worker process a shard of the stations. A worker
+ * fetches and decodes its stations like a single process would and writes
+ * the results to a pipe as a stream of frames:
+ *
+ *   SHARD_MAGIC
+ *   one SHARD_FRAME_RESULT per station, in the order the stations were given
+ *   one SHARD_FRAME_STATS
+ *
+ * A result carries the rendered output of the station and, if the report was
+ * decoded, its observation and raw report so the coordinator can store or
+ * encode it. The coordinator merges the results of all workers back into the
+ * order of the command line. A worker that dies (e.g. on a response the XML
+ * parser gives up on) only loses the stations it had not sent yet.
+ *
+ * The frames are in native byte order; a worker started through a command
+ * (e.g. ssh) must run on a machine of the same architecture.
+ */
+#define SHARD_MAGIC "METARSH1"
+#define SHARD_MAGIC_LEN 8
+
+#define SHARD_FRAME_RESULT 1
+#define SHARD_FRAME_STATS  2
+
+/* largest payload of a frame; the output of a station is far smaller */
+#define SHARD_MAX_PAYLOAD (1 << 20)
+
+/* counters a worker sends at the end of its stream */
+typedef struct {
+	uint32_t stations;
+	uint32_t ok;          // stations with a new report
+	uint32_t unchanged;
+	uint32_t invalid;
+	uint32_t failed;
+	uint32_t reserved;
+	uint64_t bytes;       // bytes of responses received
+} shard_stats_t;
+
+/* a station as received by the coordinator; only valid during the callback */
+typedef struct {
+	int status;                // status of the station as sent by the worker
+	const char *output;
+	size_t output_len;
+	const obs_record_t *rec;   // NULL if the report was not decoded
+	const char *report;        // rec->report_len characters, not NUL terminated
+} shard_result_t;
+
+/* called for every station in command line order. res is NULL if the worker
+ * of the station died before sending it. Returns 0 for success, 1 for an error.
+ */
+typedef int (*shard_callback_t)(unsigned long index, const shard_result_t *res, void *ctx);
+
+/* runs a shard in a forked worker, writing the frames to out, which it must
+ * close. Returns the exit status of the worker. */
+typedef int (*shard_worker_t)(char **stations, int num_stations, FILE *out);
+
+typedef struct {
+	int num_shards;
+	const char *command;       // shell command starting a worker, NULL to fork
+	shard_worker_t worker;     // runs a shard if command is NULL
+	shard_stats_t *stats;      // num_shards counters filled in by shard_run()
+} shard_config_t;
+
+/* Split the stations among cfg->num_shards workers, station i going to
+ * shard_of[i], and call cb for every station in order.
+ *
+ * A forked worker calls cfg->worker. A command is run by /bin/sh with the
+ * stations of the shard appended as arguments and must write the frames to
+ * its standard output (metar -W does).
+ * Returns 0 for success, 1 if a worker failed or a result could not be handled.
+ */
+int shard_run(const shard_config_t *cfg, char **stations, unsigned long num_stations,
+			  const int *shard_of, shard_callback_t cb, void *ctx);
+
+/* start the stream of a worker. Returns 0 for success, 1 for an error */
+int shard_write_header(FILE *fp);
+
+/* send the result of the seq-th station of the shard. rec and report may be NULL.
+ * Returns 0 for success, 1 for an error.
+ */
+int shard_write_result(FILE *fp, unsigned long seq, int status, const char *output,
+					   size_t output_len, const obs_record_t *rec, const char *report);
+
+/* end the stream of a worker with its counters. Returns 0 for success, 1 for an error */
+int shard_write_stats(FILE *fp, const shard_stats_t *stats);
+
+#endif  /* End Include Guard - don't add code below */
@@ -0,0 +1,286 @@
+/* shmtable.c -- latest observation of every station in shared memory
+   Copyright 2016 Andrew Walton <dwalton64@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shmtable.h"
+
+/* smallest table created */
+#define SHM_TABLE_MIN_SLOTS 64
+
+/* times a reader copies a slot before giving up on a writer that died in it */
+#define SHM_TABLE_MAX_TRIES 1000000
+
+
+/* upper case the station into key; returns its length, 0 if it does not fit */
+static size_t make_key(const char *station, char *key) {
+	size_t len;
+
+	for (len = 0; station[len] != 0; len++) {
+		if (len == SHM_TABLE_NAME_SIZE - 1)
+			return 0;
+		key[len] = (char) toupper((unsigned char) station[len]);
+	}
+	memset(key + len, 0, SHM_TABLE_NAME_SIZE - len);
+	return len;
+}
+
+/* FNV-1a of the key */
+static uint32_t key_hash(const char *key) {
+	uint32_t h = 2166136261u;
+
+	while (*key)
+		h = (h ^ (unsigned char) *key++) * 16777619u;
+	return h;
+}
+
+static size_t table_size(unsigned capacity) {
+	return sizeof(shm_header_t) + (size_t) capacity * sizeof(shm_slot_t);
+}
+
+/* map the object open at fd and check that it is a table
+ * returns 0 for success, 1 if it is not */
+static int map_table(shm_table_t *table, int fd) {
+	struct stat st;
+	void *p;
+
+	if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(shm_header_t))
+		return 1;
+	p = mmap(NULL, (size_t) st.st_size, table->writable ? PROT_READ | PROT_WRITE : PROT_READ,
+			 MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED)
+		return 1;
+	table->header = p;
+	table->slots = (shm_slot_t *) ((char *) p + sizeof(shm_header_t));
+	table->size = (size_t) st.st_size;
+
+	if (memcmp(table->header->magic, SHM_TABLE_MAGIC, 8) != 0 ||
+		table->header->slot_size != sizeof(shm_slot_t) ||
+		(table->header->capacity & (table->header->capacity - 1)) != 0 ||
+		table->size < table_size(table->header->capacity)) {
+		munmap(p, table->size);
+		table->header = NULL;
+		return 1;
+	}
+	return 0;
+}
+
+static shm_table_t *new_table(const char *name, int writable) {
+	shm_table_t *table = calloc(1, sizeof(shm_table_t));
+
+	if (table == NULL || (table->name = malloc(strlen(name) + 2)) == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		free(table);
+		return NULL;
+	}
+	/* shared memory objects are named like /name */
+	sprintf(table->name, "%s%s", name[0] == '/' ? "" : "/", name);
+	table->writable = writable;
+	return table;
+}
+
+
+/* PUBLIC--
+ * Open a table for publishing, creating it if needed.
+ */
+shm_table_t *shm_table_create(const char *name, unsigned capacity) {
+	shm_table_t *table;
+	unsigned slots = SHM_TABLE_MIN_SLOTS;
+	int fd;
+
+	if ((table = new_table(name, 1)) == NULL)
+		return NULL;
+	/* keep the table at most half full, so the probes stay short */
+	while (slots < 2 * capacity)
+		slots *= 2;
+
+	if ((fd = shm_open(table->name, O_RDWR | O_CREAT, 0644)) == -1) {
+		perror(table->name);
+		goto fail;
+	}
+	/* the readers keep using a table that is large enough */
+	if (map_table(table, fd) == 0) {
+		if (table->header->capacity >= slots) {
+			close(fd);
+			return table;
+		}
+		atomic_store(&table->header->retired, 1);
+		munmap(table->header, table->size);
+		table->header = NULL;
+	}
+	close(fd);
+
+	/* a reader that has the old object mapped keeps it until it reopens */
+	shm_unlink(table->name);
+	if ((fd = shm_open(table->name, O_RDWR | O_CREAT | O_EXCL, 0644)) == -1) {
+		perror(table->name);
+		goto fail;
+	}
+	if (ftruncate(fd, (off_t) table_size(slots)) != 0) {
+		perror(table->name);
+		close(fd);
+		goto fail;
+	}
+	table->header = mmap(NULL, table_size(slots), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (table->header == MAP_FAILED) {
+		perror(table->name);
+		table->header = NULL;
+		goto fail;
+	}
+	table->size = table_size(slots);
+	table->slots = (shm_slot_t *) ((char *) table->header + sizeof(shm_header_t));
+	/* the object is zero filled, so every slot is unused */
+	table->header->slot_size = sizeof(shm_slot_t);
+	table->header->capacity = slots;
+	atomic_store(&table->header->retired, 0);
+	atomic_store(&table->header->used, 0);
+	/* the magic goes last: until then a reader does not accept the table */
+	atomic_thread_fence(memory_order_release);
+	memcpy(table->header->magic, SHM_TABLE_MAGIC, 8);
+	return table;
+
+fail:
+	shm_table_close(table);
+	return NULL;
+}
+
+/* PUBLIC--
+ * Publish the newest report of a station.
+ */
+int shm_table_publish(shm_table_t *table, const char *station, const noaa_t *noaa,
+					  const obs_record_t *rec) {
+	char key[SHM_TABLE_NAME_SIZE];
+	uint32_t mask = table->header->capacity - 1, i, probes;
+	shm_slot_t *slot = NULL;
+	unsigned seq;
+
+	if (make_key(station, key) == 0)
+		return 1;
+	for (i = key_hash(key) & mask, probes = 0; probes <= mask; i = (i + 1) & mask, probes++) {
+		slot = &table->slots[i];
+		/* only this process writes, so the slot can be looked at directly */
+		if (atomic_load_explicit(&slot->seq, memory_order_relaxed) == 0 ||
+			memcmp(slot->entry.station, key, SHM_TABLE_NAME_SIZE) == 0)
+			break;
+	}
+	if (probes > mask) {
+		if (!table->full)
+			fprintf(stderr, "The table %s is full, %s is not published\n", table->name, key);
+		table->full = 1;
+		return 1;
+	}
+	if ((seq = atomic_load_explicit(&slot->seq, memory_order_relaxed)) == 0)
+		atomic_fetch_add(&table->header->used, 1);
+
+	/* the readers see an odd number until the slot is complete again */
+	atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	memcpy(slot->entry.station, key, SHM_TABLE_NAME_SIZE);
+	slot->entry.published = (int64_t) time(NULL);
+	slot->entry.noaa = *noaa;
+	slot->entry.have_rec = rec != NULL;
+	if (rec != NULL) slot->entry.rec = *rec;
+	else memset(&slot->entry.rec, 0, sizeof(obs_record_t));
+	atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+	return 0;
+}
+
+
+/* PUBLIC--
+ * Map a table read only.
+ */
+shm_table_t *shm_table_open(const char *name) {
+	shm_table_t *table;
+	int fd;
+
+	if ((table = new_table(name, 0)) == NULL)
+		return NULL;
+	if ((fd = shm_open(table->name, O_RDONLY, 0)) == -1) {
+		perror(table->name);
+		shm_table_close(table);
+		return NULL;
+	}
+	if (map_table(table, fd)) {
+		fprintf(stderr, "%s is not a table of observations\n", table->name);
+		close(fd);
+		shm_table_close(table);
+		return NULL;
+	}
+	close(fd);
+	return table;
+}
+
+/* PUBLIC--
+ * Copy the entry of a station out of the table.
+ */
+int shm_table_read(const shm_table_t *table, const char *station, shm_entry_t *entry) {
+	char key[SHM_TABLE_NAME_SIZE];
+	uint32_t mask = table->header->capacity - 1, i, probes;
+	shm_slot_t *slot;
+	unsigned seq, tries;
+
+	if (make_key(station, key) == 0)
+		return 0;
+	for (i = key_hash(key) & mask, probes = 0; probes <= mask; i = (i + 1) & mask, probes++) {
+		slot = &table->slots[i];
+		for (tries = 0; tries < SHM_TABLE_MAX_TRIES; tries++) {
+			seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+			if (seq == 0)
+				return 0;   // the end of the probe sequence
+			if (seq & 1)
+				continue;
+			/* the station of a slot is written before its sequence number
+			 * first becomes even and never changes after that */
+			if (memcmp(slot->entry.station, key, SHM_TABLE_NAME_SIZE) != 0)
+				break;
+			memcpy(entry, &slot->entry, sizeof(shm_entry_t));
+			atomic_thread_fence(memory_order_acquire);
+			if (atomic_load_explicit(&slot->seq, memory_order_relaxed) == seq)
+				return 1;
+		}
+		if (tries == SHM_TABLE_MAX_TRIES)
+			return -1;
+	}
+	return 0;
+}
+
+/* PUBLIC--
+ * True if the table was replaced by a writer.
+ */
+int shm_table_retired(const shm_table_t *table) {
+	return atomic_load_explicit(&table->header->retired, memory_order_relaxed) != 0;
+}
+
+/* PUBLIC--
+ * Unmap a table.
+ */
+void shm_table_close(shm_table_t *table) {
+	if (table == NULL)
+		return;
+	if (table->header != NULL)
+		munmap(table->header, table->size);
+	free(table->name);
+	free(table);
+}
@@ -0,0 +1,109 @@
+/* shmtable.h -- latest observation of every station in shared memory
+   Copyright 2016 Andrew Walton <dwalton64@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef Already_included_shmtable_h
+#define Already_included_shmtable_h 1
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "metar.h"
+#include "store.h"
+
+/* One process (metar -P) publishes the newest report of every station it
+ * fetches into a POSIX shared memory object; any number of local processes
+ * map it read only and look stations up without system calls or locks.
+ *
+ * The object is a header followed by a power of two number of slots, found
+ * by hashing the station name with linear probing. A slot is never moved or
+ * given to another station. Every slot has a sequence number that is odd
+ * while the writer changes it: a reader copies the slot and tries again if
+ * the number was odd or changed during the copy (a seqlock). The writer never
+ * waits for the readers.
+ *
+ * A writer that needs a larger table replaces the object and marks the old
+ * one retired; readers should then reopen it.
+ */
+#define SHM_TABLE_MAGIC "METARTB1"
+
+/* longest station name kept in a slot, plus NUL termination */
+#define SHM_TABLE_NAME_SIZE 16
+
+/* what a slot holds, as copied out by shm_table_read() */
+typedef struct {
+	char station[SHM_TABLE_NAME_SIZE];   // upper case
+	int64_t published;                   // when the writer stored it, seconds since the epoch
+	noaa_t noaa;
+	int32_t have_rec;
+	int32_t reserved;
+	/* the decoded observation; its station id is only meaningful for four
+	 * letter ICAO codes, otherwise use station */
+	obs_record_t rec;
+} shm_entry_t;
+
+typedef struct {
+	atomic_uint seq;                     // odd while being written, 0 if unused
+	uint32_t reserved;
+	shm_entry_t entry;
+} shm_slot_t;
+
+typedef struct {
+	char magic[8];
+	uint32_t slot_size;                  // sizeof(shm_slot_t), so both sides agree on the layout
+	uint32_t capacity;                   // number of slots, a power of two
+	atomic_uint retired;                 // set once a writer replaced the object
+	atomic_uint used;                    // slots given to a station
+} shm_header_t;
+
+typedef struct {
+	char *name;
+	int writable;
+	size_t size;
+	shm_header_t *header;
+	shm_slot_t *slots;
+	int full;                            // a station did not fit, reported once
+} shm_table_t;
+
+/* Open the table called name (e.g. "/metar") for publishing, creating it or
+ * replacing it if it cannot hold capacity stations.
+ * Returns NULL for an error, which has been reported.
+ */
+shm_table_t *shm_table_create(const char *name, unsigned capacity);
+
+/* publish the newest report of a station; rec may be NULL.
+ * Returns 0 for success, 1 if the table is full.
+ */
+int shm_table_publish(shm_table_t *table, const char *station, const noaa_t *noaa,
+					  const obs_record_t *rec);
+
+/* Map the table called name read only. Returns NULL for an error, which has
+ * been reported.
+ */
+shm_table_t *shm_table_open(const char *name);
+
+/* Copy the entry of station (case insensitive) into entry. Makes no system
+ * calls and takes no locks. Returns 1 if the station was found, 0 if it is
+ * not in the table and -1 if its slot is stuck being written (the writer died).
+ */
+int shm_table_read(const shm_table_t *table, const char *station, shm_entry_t *entry);
+
+/* true if a writer replaced the table and it should be opened again */
+int shm_table_retired(const shm_table_t *table);
+
+/* unmap the table; the object itself is left for other readers */
+void shm_table_close(shm_table_t *table);
+
+#endif  /* End Include Guard - don't add code below */
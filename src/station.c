@@ -0,0 +1,268 @@
+/* station.c -- compact station identifiers
+   Copyright 2016 Andrew Walton <dwalton64@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <stdio.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "station.h"
+
+/* names of the interned stations; the index is the id without STATION_INTERNED */
+typedef struct {
+	char (*names)[STATION_NAME_SIZE];
+	uint32_t count;
+	uint32_t size;
+	uint32_t *slots;         // open addressing hash of index + 1, 0 is empty
+	uint32_t num_slots;      // a power of two
+} intern_table_t;
+
+static intern_table_t interned;
+static pthread_mutex_t intern_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static uint32_t name_hash(const char *name) {
+	uint32_t h = 2166136261u;   // FNV-1a
+	for (; *name; name++) {
+		h ^= (unsigned char) *name;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static int grow_table(void) {
+	uint32_t num_slots = interned.num_slots ? interned.num_slots * 2 : 64;
+	uint32_t size = num_slots / 2;
+	uint32_t *slots, i, j;
+	char (*names)[STATION_NAME_SIZE];
+
+	names = realloc(interned.names, size * sizeof(*names));
+	if (names == NULL) return 1;
+	interned.names = names;
+	interned.size = size;
+
+	slots = calloc(num_slots, sizeof(uint32_t));
+	if (slots == NULL) return 1;
+	for (i = 0; i < interned.count; i++) {
+		j = name_hash(interned.names[i]) & (num_slots - 1);
+		while (slots[j]) j = (j + 1) & (num_slots - 1);
+		slots[j] = i + 1;
+	}
+	free(interned.slots);
+	interned.slots = slots;
+	interned.num_slots = num_slots;
+	return 0;
+}
+
+/* return the interned id of an upper case name, adding it if needed */
+static station_id_t intern(const char *name) {
+	station_id_t id = STATION_ID_NONE;
+	uint32_t i;
+
+	pthread_mutex_lock(&intern_lock);
+	if (interned.count == interned.size && grow_table())
+		goto out;
+
+	i = name_hash(name) & (interned.num_slots - 1);
+	while (interned.slots[i]) {
+		if (strcmp(interned.names[interned.slots[i] - 1], name) == 0) {
+			id = STATION_INTERNED | (interned.slots[i] - 1);
+			goto out;
+		}
+		i = (i + 1) & (interned.num_slots - 1);
+	}
+
+	strcpy(interned.names[interned.count], name);
+	interned.slots[i] = ++interned.count;
+	id = STATION_INTERNED | (interned.count - 1);
+
+out:
+	pthread_mutex_unlock(&intern_lock);
+	return id;
+}
+
+
+/* PUBLIC--
+ * Return the id of the len characters at name, interning it if needed.
+ */
+station_id_t station_id_n(const char *name, size_t len) {
+	char upper[STATION_NAME_SIZE];
+	size_t i;
+
+	if (len == 0 || len >= STATION_NAME_SIZE)
+		return STATION_ID_NONE;
+	for (i = 0; i < len; i++) {
+		if (!isalnum((unsigned char) name[i]))
+			return STATION_ID_NONE;
+		upper[i] = (char) toupper((unsigned char) name[i]);
+	}
+	upper[len] = 0;
+
+	if (len == 4)
+		return ((station_id_t) (unsigned char) upper[0] << 24) |
+			   ((station_id_t) (unsigned char) upper[1] << 16) |
+			   ((station_id_t) (unsigned char) upper[2] << 8) |
+			   (station_id_t) (unsigned char) upper[3];
+	return intern(upper);
+}
+
+/* PUBLIC--
+ * station_id_n() for a NUL terminated name.
+ */
+station_id_t station_id(const char *name) {
+	return station_id_n(name, strnlen(name, STATION_NAME_SIZE));
+}
+
+/* PUBLIC--
+ * Write the name of a station into buf and return buf.
+ */
+char *station_name(station_id_t id, char *buf) {
+	uint32_t index = id & ~STATION_INTERNED;
+
+	buf[0] = 0;
+	if (id == STATION_ID_NONE)
+		return buf;
+
+	if (!(id & STATION_INTERNED)) {
+		buf[0] = (char) (id >> 24);
+		buf[1] = (char) (id >> 16);
+		buf[2] = (char) (id >> 8);
+		buf[3] = (char) id;
+		buf[4] = 0;
+		return buf;
+	}
+
+	pthread_mutex_lock(&intern_lock);
+	if (index < interned.count)
+		memcpy(buf, interned.names[index], STATION_NAME_SIZE);
+	pthread_mutex_unlock(&intern_lock);
+	return buf;
+}
+
+
+/* bits set in the Bloom filter per station */
+#define BLOOM_HASHES 4
+
+/* bits of the Bloom filter per station, giving about 0.2% false positives */
+#define BLOOM_BITS_PER_STATION 16
+
+/* the i-th bit of the Bloom filter for id */
+static uint32_t bloom_bit(const station_set_t *set, station_id_t id, int i) {
+	uint32_t h1 = station_hash(id), h2 = station_hash(id ^ 0x9e3779b9u) | 1;
+
+	return (h1 + (uint32_t) i * h2) & set->bloom_mask;
+}
+
+static int compare_ids(const void *a, const void *b) {
+	station_id_t x = *(const station_id_t *) a, y = *(const station_id_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* PUBLIC--
+ * Read a set of known stations from a file.
+ */
+station_set_t *station_set_load(const char *filename) {
+	FILE *fp;
+	station_set_t *set;
+	station_id_t *grown;
+	char line[1024];
+	size_t size = 0, len, i, n;
+	uint32_t bits;
+	int k;
+
+	if ((fp = fopen(filename, "r")) == NULL) {
+		perror(filename);
+		return NULL;
+	}
+	if ((set = calloc(1, sizeof(station_set_t))) == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		fclose(fp);
+		return NULL;
+	}
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		/* only ICAO codes, so nothing is interned */
+		if ((len = strcspn(line, " \t,\r\n")) != 4 || station_id_n(line, len) == STATION_ID_NONE)
+			continue;
+		if (set->count == size) {
+			size = size ? 2 * size : 1024;
+			if ((grown = realloc(set->ids, size * sizeof(station_id_t))) == NULL) {
+				fprintf(stderr, "Out of memory\n");
+				fclose(fp);
+				station_set_free(set);
+				return NULL;
+			}
+			set->ids = grown;
+		}
+		set->ids[set->count++] = station_id_n(line, len);
+	}
+	fclose(fp);
+	if (set->count == 0) {
+		fprintf(stderr, "%s does not list any ICAO station codes\n", filename);
+		station_set_free(set);
+		return NULL;
+	}
+
+	qsort(set->ids, set->count, sizeof(station_id_t), compare_ids);
+	for (i = n = 1; i < set->count; i++) {
+		if (set->ids[i] != set->ids[n - 1])
+			set->ids[n++] = set->ids[i];
+	}
+	set->count = n;
+
+	for (bits = 64; bits < set->count * BLOOM_BITS_PER_STATION && bits < 0x80000000u; bits *= 2)
+		;
+	if ((set->bloom = calloc(bits / 64, sizeof(uint64_t))) == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		station_set_free(set);
+		return NULL;
+	}
+	set->bloom_mask = bits - 1;
+	for (i = 0; i < set->count; i++) {
+		for (k = 0; k < BLOOM_HASHES; k++) {
+			bits = bloom_bit(set, set->ids[i], k);
+			set->bloom[bits / 64] |= (uint64_t) 1 << (bits % 64);
+		}
+	}
+	return set;
+}
+
+/* PUBLIC--
+ * True if the station is in the set.
+ */
+int station_set_contains(const station_set_t *set, station_id_t id) {
+	uint32_t bit;
+	int k;
+
+	if (id == STATION_ID_NONE || (id & STATION_INTERNED))
+		return 0;
+	for (k = 0; k < BLOOM_HASHES; k++) {
+		bit = bloom_bit(set, id, k);
+		if (!(set->bloom[bit / 64] & ((uint64_t) 1 << (bit % 64))))
+			return 0;
+	}
+	return bsearch(&id, set->ids, set->count, sizeof(station_id_t), compare_ids) != NULL;
+}
+
+void station_set_free(station_set_t *set) {
+	if (set == NULL)
+		return;
+	free(set->ids);
+	free(set->bloom);
+	free(set);
+}
@@ -0,0 +1,87 @@
+/* station.h -- compact station identifiers
+   Copyright 2016 Andrew Walton <dwalton64@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef Already_included_station_h
+#define Already_included_station_h 1
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* A station is identified by a 32 bit integer. A regular four character ICAO
+ * code is packed into it one character per byte, first character in the most
+ * significant byte, so comparing two ids orders them alphabetically.
+ *
+ * Any other identifier (e.g. "ED" or a five letter code) is interned: the id
+ * is an index into a table of names with STATION_INTERNED set. Interned ids
+ * are only meaningful within the process that created them and sort after
+ * all ICAO codes.
+ */
+typedef uint32_t station_id_t;
+
+#define STATION_ID_NONE  0u
+#define STATION_INTERNED 0x80000000u
+
+/* longest identifier (plus NUL termination) that can be interned */
+#define STATION_NAME_SIZE 10
+
+/* return the id of the len characters at name (case insensitive), interning
+ * it if needed. Returns STATION_ID_NONE if it is not made of 1 to 9 letters
+ * and digits.
+ */
+station_id_t station_id_n(const char *name, size_t len);
+
+/* station_id_n() for a NUL terminated name */
+station_id_t station_id(const char *name);
+
+/* write the (upper case) name of a station into buf, which must hold
+ * STATION_NAME_SIZE characters, and return buf.
+ */
+char *station_name(station_id_t id, char *buf);
+
+/* The stations known to exist, e.g. those of the server's station list. The
+ * ICAO codes are kept as a sorted array of ids, with a Bloom filter in front
+ * so most unknown codes are rejected without searching the array.
+ */
+typedef struct {
+	station_id_t *ids;       // sorted, without duplicates
+	size_t count;
+	uint64_t *bloom;
+	uint32_t bloom_mask;     // number of bits in the filter - 1
+} station_set_t;
+
+/* Read the set from a file holding a station on every line, as the first
+ * field (up to a space, tab or comma). Lines whose first field is not a four
+ * character ICAO code, such as headers and comments, are skipped.
+ * Returns NULL after printing why if the file cannot be read or holds no
+ * stations.
+ */
+station_set_t *station_set_load(const char *filename);
+
+/* true if the station is in the set; interned ids never are */
+int station_set_contains(const station_set_t *set, station_id_t id);
+
+void station_set_free(station_set_t *set);
+
+/* hash of a station id, for hash tables keyed by station */
+static inline uint32_t station_hash(station_id_t id) {
+	id ^= id >> 16;
+	id *= 0x45d9f3bu;
+	id ^= id >> 16;
+	return id;
+}
+
+#endif  /* End Include Guard - don't add code below */
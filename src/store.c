@@ -0,0 +1,461 @@
+/* store.c -- append-only time-series store for decoded observations
+   Copyright 2016 Andrew Walton <dwalton64@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "store.h"
+
+extern int verbose;
+
+/* every log starts with this magic, the version is the last character */
+#define STORE_MAGIC "METARLG2"
+#define STORE_MAGIC_SIZE 8
+
+/* records are padded so the next one starts 8-byte aligned in the mapped log */
+#define ENTRY_SIZE(report_len) ((sizeof(obs_record_t) + (report_len) + 7) & ~(size_t) 7)
+
+/* max size for the path of a log or index file */
+#define STORE_PATH_MAXSIZE 1024
+
+typedef struct {
+	int64_t  obs_time;
+	uint64_t offset;
+} store_index_t;
+
+/* a station appended to; its files are closed (-1) when not recently used */
+struct store_partition {
+	station_id_t station;
+	int     log_fd;
+	int     idx_fd;
+	off_t   size;          // current size of the log
+	int64_t last_time;     // time of the newest record in the log
+	int     since_index;   // records appended since the last index entry
+	store_partition_t *chain;              // next in the bucket
+	store_partition_t *newer, *older;      // while the files are open
+};
+
+
+/* fill an observation record from a parsed METAR */
+void obs_from_metar(obs_record_t *rec, const metar_t *metar, time_t obs_time, size_t report_len) {
+	memset(rec, 0x0, sizeof(obs_record_t));
+	rec->obs_time = obs_time;
+	rec->station = metar->station;
+	rec->winddir = metar->winddir;
+	rec->windstr = metar->windstr;
+	rec->windgust = metar->windgust;
+	rec->vis = metar->vis;
+	rec->visfrac = metar->visfrac;
+	rec->qnh = metar->qnh;
+	rec->qnhfp = metar->qnhfp;
+	rec->temp = metar->temp;
+	rec->dewp = metar->dewp;
+	rec->ceiling = metar->ceiling;
+	rec->category = (uint8_t) metar->category;
+
+	if (strncmp(metar->visunit, "SM", 2) == 0) rec->flags |= OBS_VIS_SM;
+	if (metar->qnhunit[0] == '"') rec->flags |= OBS_QNH_INHG;
+	if (metar->maintenance_needed == MAINTENANCE_NEEDED) rec->flags |= OBS_MAINTENANCE;
+	if (metar->found & (1u << METAR_PART_TEMP)) rec->flags |= OBS_HAVE_TEMP;
+
+	rec->report_len = (uint16_t) (report_len < UINT16_MAX ? report_len : UINT16_MAX);
+}
+
+
+/* Station names become file names. They only contain letters and digits, see station_id_n(). */
+static int station_path(char *path, const store_t *store, station_id_t station, const char *ext) {
+	char name[STATION_NAME_SIZE];
+	int len;
+
+	if (station == STATION_ID_NONE)
+		return 1;
+	len = snprintf(path, STORE_PATH_MAXSIZE, "%s/%s.%s", store->dir, station_name(station, name), ext);
+	return (len < 0 || len >= STORE_PATH_MAXSIZE) ? 1 : 0;
+}
+
+static int add_index_entry(store_partition_t *part, int64_t obs_time, off_t offset) {
+	store_index_t entry;
+
+	entry.obs_time = obs_time;
+	entry.offset = (uint64_t) offset;
+	if (write(part->idx_fd, &entry, sizeof(entry)) != sizeof(entry)) {
+		perror("store index");
+		return 1;
+	}
+	return 0;
+}
+
+/* Find the end of the log, starting at the last indexed record. A record that was
+ * only partially written (e.g. the program was killed) is cut off, and index
+ * entries missing for the same reason are added.
+ */
+static int recover_partition(store_partition_t *part) {
+	store_index_t last;
+	obs_record_t rec;
+	off_t idx_size, off;
+	char name[STATION_NAME_SIZE];
+	int n = 0;
+
+	idx_size = lseek(part->idx_fd, 0, SEEK_END);
+	idx_size -= idx_size % (off_t) sizeof(store_index_t);
+	if (idx_size > 0 && pread(part->idx_fd, &last, sizeof(last), idx_size - sizeof(last)) == sizeof(last))
+		off = (off_t) last.offset;
+	else
+		off = STORE_MAGIC_SIZE;
+	if (ftruncate(part->idx_fd, idx_size) != 0)
+		return 1;
+
+	while (off + (off_t) sizeof(rec) <= part->size &&
+		   pread(part->log_fd, &rec, sizeof(rec), off) == sizeof(rec)) {
+		if (off + (off_t) ENTRY_SIZE(rec.report_len) > part->size)
+			break;
+		/* the record at the offset of the last index entry is indexed already */
+		if (n % STORE_INDEX_INTERVAL == 0 && !(n == 0 && idx_size > 0))
+			if (add_index_entry(part, rec.obs_time, off)) return 1;
+		part->last_time = rec.obs_time;
+		off += ENTRY_SIZE(rec.report_len);
+		n++;
+	}
+
+	if (off < part->size) {
+		if (verbose) printf("Truncating partial record at offset %ld of %s log\n", (long) off, station_name(part->station, name));
+		if (ftruncate(part->log_fd, off) != 0)
+			return 1;
+		part->size = off;
+	}
+	part->since_index = n % STORE_INDEX_INTERVAL;
+	return 0;
+}
+
+static void lru_unlink(store_t *store, store_partition_t *part) {
+	if (part->newer) part->newer->older = part->older;
+	else store->newest = part->older;
+	if (part->older) part->older->newer = part->newer;
+	else store->oldest = part->newer;
+	part->newer = part->older = NULL;
+}
+
+static void lru_push(store_t *store, store_partition_t *part) {
+	part->older = store->newest;
+	part->newer = NULL;
+	if (store->newest) store->newest->newer = part;
+	store->newest = part;
+	if (store->oldest == NULL) store->oldest = part;
+}
+
+static void close_files(store_t *store, store_partition_t *part) {
+	if (part->log_fd >= 0) close(part->log_fd);
+	if (part->idx_fd >= 0) close(part->idx_fd);
+	part->log_fd = part->idx_fd = -1;
+	lru_unlink(store, part);
+	store->num_open--;
+}
+
+/* open a file of a station, closing the least recently used files to make
+ * room if the process is out of file descriptors */
+static int open_file(store_t *store, station_id_t station, const char *ext, char *path) {
+	int fd;
+
+	if (station_path(path, store, station, ext))
+		return -1;
+	while ((fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644)) < 0 &&
+		   (errno == EMFILE || errno == ENFILE) && store->oldest != NULL)
+		close_files(store, store->oldest);
+	return fd;
+}
+
+/* open the files of a partition, if they are not open already */
+static int open_files(store_t *store, store_partition_t *part, char *path) {
+	if (part->log_fd >= 0) {
+		lru_unlink(store, part);
+		lru_push(store, part);
+		return 0;
+	}
+	if (store->num_open >= store->max_open)
+		close_files(store, store->oldest);
+
+	errno = 0;
+	if ((part->log_fd = open_file(store, part->station, "log", path)) < 0 ||
+		(part->idx_fd = open_file(store, part->station, "idx", path)) < 0) {
+		if (errno) perror(path);
+		if (part->log_fd >= 0) close(part->log_fd);
+		part->log_fd = -1;
+		return 1;
+	}
+	lru_push(store, part);
+	store->num_open++;
+	return 0;
+}
+
+/* add a partition to the hash table, keeping at least as many buckets as stations */
+static int add_partition(store_t *store, store_partition_t *part) {
+	store_partition_t **buckets, *p, *chain;
+	size_t num_buckets, i, j;
+
+	if (store->count >= store->num_buckets) {
+		num_buckets = store->num_buckets ? store->num_buckets * 2 : 64;
+		buckets = calloc(num_buckets, sizeof(store_partition_t *));
+		if (buckets == NULL) return 1;
+		for (i = 0; i < store->num_buckets; i++) {
+			for (p = store->buckets[i]; p != NULL; p = chain) {
+				chain = p->chain;
+				j = station_hash(p->station) & (num_buckets - 1);
+				p->chain = buckets[j];
+				buckets[j] = p;
+			}
+		}
+		free(store->buckets);
+		store->buckets = buckets;
+		store->num_buckets = num_buckets;
+	}
+	i = station_hash(part->station) & (store->num_buckets - 1);
+	part->chain = store->buckets[i];
+	store->buckets[i] = part;
+	store->count++;
+	return 0;
+}
+
+static store_partition_t *open_partition(store_t *store, station_id_t station) {
+	store_partition_t *part;
+	char path[STORE_PATH_MAXSIZE];
+	char magic[STORE_MAGIC_SIZE];
+
+	if (store->num_buckets > 0)
+		for (part = store->buckets[station_hash(station) & (store->num_buckets - 1)]; part != NULL; part = part->chain)
+			if (part->station == station)
+				return open_files(store, part, path) ? NULL : part;
+
+	if (station == STATION_ID_NONE) {
+		fprintf(stderr, "Cannot store observations without a station\n");
+		return NULL;
+	}
+
+	part = calloc(1, sizeof(store_partition_t));
+	if (part == NULL) return NULL;
+	part->station = station;
+	part->last_time = INT64_MIN;
+	part->log_fd = part->idx_fd = -1;
+	if (open_files(store, part, path)) {
+		free(part);
+		return NULL;
+	}
+	errno = 0;
+
+	part->size = lseek(part->log_fd, 0, SEEK_END);
+	if (part->size < STORE_MAGIC_SIZE) {
+		/* new (or hopelessly truncated) log */
+		if (ftruncate(part->log_fd, 0) != 0 || ftruncate(part->idx_fd, 0) != 0 ||
+			write(part->log_fd, STORE_MAGIC, STORE_MAGIC_SIZE) != STORE_MAGIC_SIZE)
+			goto error;
+		part->size = STORE_MAGIC_SIZE;
+	} else {
+		if (pread(part->log_fd, magic, STORE_MAGIC_SIZE, 0) != STORE_MAGIC_SIZE ||
+			memcmp(magic, STORE_MAGIC, STORE_MAGIC_SIZE) != 0) {
+			fprintf(stderr, "%s is not a metar store log\n", path);
+			goto error;
+		}
+		if (recover_partition(part))
+			goto error;
+	}
+
+	if (add_partition(store, part))
+		goto error;
+	return part;
+
+error:
+	if (errno) perror(path);
+	close_files(store, part);
+	free(part);
+	return NULL;
+}
+
+
+/* PUBLIC--
+ * Open the store in directory dir, creating the directory if needed.
+ */
+store_t *store_open(const char *dir) {
+	store_t *store;
+	struct rlimit rl;
+
+	if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+		perror(dir);
+		return NULL;
+	}
+
+	store = calloc(1, sizeof(store_t));
+	if (store == NULL) return NULL;
+	store->dir = strdup(dir);
+
+	/* two files per station, leaving most descriptors to the rest of the program */
+	store->max_open = STORE_MAX_OPEN;
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY &&
+		rl.rlim_cur / 4 < (rlim_t) store->max_open)
+		store->max_open = rl.rlim_cur / 4 > 0 ? (int) (rl.rlim_cur / 4) : 1;
+	return store;
+}
+
+
+/* PUBLIC--
+ * Append an observation and its raw report to the log of its station.
+ */
+int store_append(store_t *store, const obs_record_t *rec, const char *report) {
+	store_partition_t *part;
+	char name[STATION_NAME_SIZE];
+	char buffer[ENTRY_SIZE(UINT16_MAX)];
+	size_t len;
+	off_t offset;
+
+	part = open_partition(store, rec->station);
+	if (part == NULL)
+		return 1;
+
+	if (rec->obs_time <= part->last_time) {
+		if (verbose) printf("Not storing %s observation, it is not newer than the last one stored\n",
+							station_name(rec->station, name));
+		return 0;
+	}
+
+	/* write the record, report and padding in one go so they end up together in the log */
+	len = ENTRY_SIZE(rec->report_len);
+	memset(buffer, 0x0, len);
+	memcpy(buffer, rec, sizeof(obs_record_t));
+	memcpy(buffer + sizeof(obs_record_t), report, rec->report_len);
+
+	offset = part->size;
+	if (write(part->log_fd, buffer, len) != (ssize_t) len) {
+		perror("store log");
+		return 1;
+	}
+	part->size += len;
+	part->last_time = rec->obs_time;
+
+	if (part->since_index == 0 && add_index_entry(part, rec->obs_time, offset))
+		return 1;
+	part->since_index = (part->since_index + 1) % STORE_INDEX_INTERVAL;
+
+	return 0;
+}
+
+
+/* PUBLIC--
+ * Call cb for every record of station observed between from and to.
+ */
+int store_query(store_t *store, station_id_t station, time_t from, time_t to,
+                store_callback_t cb, void *ctx) {
+	char path[STORE_PATH_MAXSIZE];
+	struct stat st;
+	int log_fd, idx_fd;
+	char *log = NULL;
+	store_index_t *index = NULL;
+	size_t num_index = 0, lo, hi, mid;
+	off_t off = STORE_MAGIC_SIZE;
+	const obs_record_t *rec;
+	obs_record_t copy;
+
+	if (station_path(path, store, station, "log"))
+		return 1;
+	log_fd = open(path, O_RDONLY);
+	if (log_fd < 0) {
+		/* nothing was ever stored for this station */
+		if (errno == ENOENT) return 0;
+		perror(path);
+		return 1;
+	}
+	if (fstat(log_fd, &st) != 0 || st.st_size <= STORE_MAGIC_SIZE) {
+		close(log_fd);
+		return 0;
+	}
+	log = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, log_fd, 0);
+	close(log_fd);
+	if (log == MAP_FAILED) {
+		perror(path);
+		return 1;
+	}
+
+	/* binary search the sparse index for the last entry at or before from */
+	if (station_path(path, store, station, "idx") == 0 && (idx_fd = open(path, O_RDONLY)) >= 0) {
+		struct stat ist;
+		if (fstat(idx_fd, &ist) == 0 && ist.st_size >= (off_t) sizeof(store_index_t)) {
+			num_index = (size_t) ist.st_size / sizeof(store_index_t);
+			index = mmap(NULL, num_index * sizeof(store_index_t), PROT_READ, MAP_SHARED, idx_fd, 0);
+			if (index == MAP_FAILED) {
+				index = NULL;
+				num_index = 0;
+			}
+		}
+		close(idx_fd);
+	}
+	lo = 0;
+	hi = num_index;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (index[mid].obs_time <= from) lo = mid + 1;
+		else hi = mid;
+	}
+	if (lo > 0 && (off_t) index[lo - 1].offset < st.st_size)
+		off = (off_t) index[lo - 1].offset;
+
+	/* scan sequentially until past the end of the window */
+	while (off + (off_t) sizeof(obs_record_t) <= st.st_size) {
+		rec = (const obs_record_t *) (log + off);
+		if (off + (off_t) ENTRY_SIZE(rec->report_len) > st.st_size || rec->obs_time > to)
+			break;
+		if (rec->obs_time >= from) {
+			/* interned ids differ between processes, give the record the id of this one */
+			if (rec->station != station) {
+				copy = *rec;
+				copy.station = station;
+				rec = &copy;
+			}
+			if (cb(rec, log + off + sizeof(obs_record_t), ctx))
+				break;
+		}
+		off += ENTRY_SIZE(rec->report_len);
+	}
+
+	if (index != NULL) munmap(index, num_index * sizeof(store_index_t));
+	munmap(log, (size_t) st.st_size);
+	return 0;
+}
+
+
+/* PUBLIC--
+ * Flush and close all files and free the store.
+ */
+void store_close(store_t *store) {
+	store_partition_t *part, *chain;
+	size_t i;
+
+	if (store == NULL) return;
+	for (i = 0; i < store->num_buckets; i++) {
+		for (part = store->buckets[i]; part != NULL; part = chain) {
+			chain = part->chain;
+			if (part->log_fd >= 0) close_files(store, part);
+			free(part);
+		}
+	}
+	free(store->buckets);
+	free(store->dir);
+	free(store);
+}
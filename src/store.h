@@ -0,0 +1,115 @@
+/* store.h -- append-only time-series store for decoded observations
+   Copyright 2016 Andrew Walton <dwalton64@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef Already_included_store_h
+#define Already_included_store_h 1
+
+#include <stdint.h>
+#include <time.h>
+#include "metar.h"
+#include "station.h"
+
+/* The store keeps one log file per station (<dir>/<STATION>.log). Every
+ * observation is appended as a fixed size obs_record_t followed by the raw
+ * report text. Records of a station must arrive in time order; a record that
+ * is not newer than the last one stored for its station is ignored, so
+ * repeatedly storing the same report is harmless.
+ *
+ * Next to the log lives a sparse index (<dir>/<STATION>.idx) with the time
+ * and offset of every STORE_INDEX_INTERVAL-th record. A query binary searches
+ * the index and then scans the memory mapped log sequentially.
+ */
+#define STORE_INDEX_INTERVAL 64
+
+/* flags used in obs_record_t */
+#define OBS_VIS_SM       0x01   // vis is in statute miles, otherwise meters
+#define OBS_QNH_INHG     0x02   // qnh is in inches of mercury, otherwise hPa
+#define OBS_MAINTENANCE  0x04   // the station reported that maintenance is needed
+#define OBS_HAVE_TEMP    0x08   // the report has a temperature group, otherwise temp and dewp are 0
+
+/* a decoded observation as it is kept in the store. It has a fixed size and
+ * contains no pointers so it can be written to disk as is.
+ */
+typedef struct {
+	int64_t  obs_time;      // seconds since the epoch, UTC
+	station_id_t station;
+	int32_t  winddir;       // -1 signifies variable winds
+	int32_t  windstr;       // knots
+	int32_t  windgust;      // knots
+	int32_t  vis;
+	int32_t  visfrac;       // sixteenths of a statute mile
+	int32_t  qnh;
+	int32_t  qnhfp;         // fixed-point decimal places
+	int32_t  temp;
+	int32_t  dewp;
+	int32_t  ceiling;       // hundreds of feet, NO_CEILING if there is none
+	uint8_t  category;      // FLIGHT_CATEGORY_*
+	uint8_t  flags;         // OBS_*
+	uint16_t report_len;    // length of the raw report following the record in the log
+	uint32_t reserved;
+} obs_record_t;
+
+/* called for every record found by store_query(). The report is not NUL
+ * terminated and points into the mapped log; it is only valid during the call.
+ * Return non-zero to stop the query.
+ */
+typedef int (*store_callback_t)(const obs_record_t *rec, const char *report, void *ctx);
+
+/* Appending keeps the log and index of a station open, but no more than
+ * STORE_MAX_OPEN stations (and a quarter of the file descriptors the process
+ * may open) at once: the files of the least recently appended station are
+ * closed to make room. The stations appended to are found in a hash table.
+ */
+#define STORE_MAX_OPEN 256
+
+typedef struct store_partition store_partition_t;
+
+typedef struct {
+	char *dir;
+	store_partition_t **buckets;    // stations appended to, by station_hash()
+	size_t num_buckets;             // a power of two
+	size_t count;
+	store_partition_t *newest;      // stations with open files, most recently used first
+	store_partition_t *oldest;      // closed first
+	int num_open;
+	int max_open;
+} store_t;
+
+/* fill an observation record from a parsed METAR */
+void obs_from_metar(obs_record_t *rec, const metar_t *metar, time_t obs_time, size_t report_len);
+
+/* open the store in directory dir, creating the directory if needed.
+ * Returns NULL on error.
+ */
+store_t *store_open(const char *dir);
+
+/* append an observation and its raw report to the log of its station.
+ * Returns 0 if the record was stored or ignored because it is not newer than
+ * the last stored record, 1 for an error.
+ */
+int store_append(store_t *store, const obs_record_t *rec, const char *report);
+
+/* call cb for every record of station observed between from and to (inclusive),
+ * in time order. Returns 0 for success, 1 for an error.
+ */
+int store_query(store_t *store, station_id_t station, time_t from, time_t to,
+                store_callback_t cb, void *ctx);
+
+/* flush and close all files and free the store */
+void store_close(store_t *store);
+
+#endif  /* End Include Guard - don't add code below */
@@ -0,0 +1,396 @@
+/* throttle.c -- adaptive limits on the requests sent to the servers
+   Copyright 2016 Andrew Walton <dwalton64@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <limits.h>
+#include <time.h>
+#include "throttle.h"
+
+
+/* seconds on the monotonic clock, which the condition variable waits on */
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* copy the host of url (without user and port) into name, which holds
+ * THROTTLE_HOST_SIZE characters; empty if the URL has none */
+static void host_of(const char *url, char *name) {
+	const char *p, *end, *at;
+	size_t len;
+
+	name[0] = 0;
+	if ((p = strstr(url, "://")) == NULL)
+		return;
+	p += 3;
+	end = p + strcspn(p, "/?#");
+	if ((at = memchr(p, '@', (size_t) (end - p))) != NULL)
+		p = at + 1;
+	if (*p == '[') {
+		/* an IPv6 address, which is full of colons */
+		if ((at = memchr(p, ']', (size_t) (end - p))) != NULL)
+			end = at + 1;
+	} else if ((at = memchr(p, ':', (size_t) (end - p))) != NULL) {
+		end = at;
+	}
+	len = (size_t) (end - p);
+	if (len >= THROTTLE_HOST_SIZE)
+		len = THROTTLE_HOST_SIZE - 1;
+	memcpy(name, p, len);
+	name[len] = 0;
+}
+
+/* the host called name, added with the default rate if it is new;
+ * NULL if out of memory. The lock must be held. */
+static throttle_host_t *find_host(throttle_t *t, const char *name) {
+	throttle_host_t *host;
+
+	for (host = t->hosts; host != NULL; host = host->next)
+		if (strcasecmp(host->name, name) == 0)
+			return host;
+	if ((host = calloc(1, sizeof(throttle_host_t))) == NULL)
+		return NULL;
+	strcpy(host->name, name);
+	host->rate = t->default_rate;
+	host->burst = host->tokens = t->default_burst;
+	host->refilled = now();
+	host->next = t->hosts;
+	t->hosts = host;
+	return host;
+}
+
+/* add the tokens earned since the last refill */
+static void refill(throttle_host_t *host, double time) {
+	if (host->rate > 0 && time > host->refilled) {
+		host->tokens += (time - host->refilled) * host->rate;
+		if (host->tokens > host->burst)
+			host->tokens = host->burst;
+	}
+	host->refilled = time;
+}
+
+/* seconds until a request to host may be sent, -1 until another request
+ * is done, 0 if right away. The lock must be held. */
+static double admit(throttle_t *t, throttle_host_t *host, double time) {
+	if (t->in_flight >= (int) t->limit)
+		return -1;
+	if (host != NULL) {
+		refill(host, time);
+		if (time < host->paused_until)
+			return host->paused_until - time;
+		if (host->rate > 0 && host->tokens < 1)
+			return (1 - host->tokens) / host->rate;
+	}
+	return 0;
+}
+
+/* count the request as sent. The lock must be held. */
+static void take(throttle_t *t, throttle_host_t *host, double time, throttle_ticket_t *ticket) {
+	t->in_flight++;
+	if (host != NULL && host->rate > 0)
+		host->tokens -= 1;
+	ticket->host = host;
+	ticket->start = time;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+	double x = *(const double *) a, y = *(const double *) b;
+
+	return (x > y) - (x < y);
+}
+
+
+/* PUBLIC--
+ * Create a throttle.
+ */
+throttle_t *throttle_new(void) {
+	throttle_t *t = calloc(1, sizeof(throttle_t));
+	pthread_condattr_t attr;
+
+	if (t == NULL)
+		return NULL;
+	pthread_mutex_init(&t->lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&t->changed, &attr);
+	pthread_condattr_destroy(&attr);
+	t->max_limit = INT_MAX;
+	t->limit = THROTTLE_INITIAL;
+	return t;
+}
+
+/* PUBLIC--
+ * Set the largest number of requests in flight.
+ */
+void throttle_set_max(throttle_t *t, int max_limit) {
+	pthread_mutex_lock(&t->lock);
+	t->max_limit = max_limit < 1 ? 1 : max_limit;
+	if (t->limit > t->max_limit)
+		t->limit = t->max_limit;
+	pthread_mutex_unlock(&t->lock);
+}
+
+/* PUBLIC--
+ * Parse and set the rate of a host, or the default rate.
+ */
+int throttle_set_rate(throttle_t *t, const char *spec) {
+	char name[THROTTLE_HOST_SIZE] = "";
+	const char *eq = strchr(spec, '='), *p;
+	throttle_host_t *host;
+	double rate, burst;
+	char *end;
+
+	if (eq != NULL) {
+		/* the name is passed on to the commands of -N, so it must not need quoting */
+		for (p = spec; p < eq; p++)
+			if (!isalnum((unsigned char) *p) && strchr(".-_[]:", *p) == NULL)
+				break;
+		if (p < eq || eq == spec || eq - spec >= THROTTLE_HOST_SIZE) {
+			fprintf(stderr, "--rate: not a host name in `%s'\n", spec);
+			return 1;
+		}
+		memcpy(name, spec, (size_t) (eq - spec));
+		name[eq - spec] = 0;
+		spec = eq + 1;
+	}
+	rate = strtod(spec, &end);
+	burst = rate < 1 ? 1 : rate;
+	if (*end == ',')
+		burst = strtod(end + 1, &end);
+	if (end == spec || *end != 0 || !(rate > 0) || !(burst >= 1)) {
+		fprintf(stderr, "--rate requires [HOST=]RATE[,BURST] with RATE requests per second above 0 and BURST at least 1\n");
+		return 1;
+	}
+
+	pthread_mutex_lock(&t->lock);
+	if (eq == NULL) {
+		t->default_rate = rate;
+		t->default_burst = burst;
+		host = NULL;
+	} else if ((host = find_host(t, name)) != NULL) {
+		host->rate = rate;
+		host->burst = host->tokens = burst;
+		host->configured = 1;
+	}
+	pthread_mutex_unlock(&t->lock);
+	if (eq != NULL && host == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	return 0;
+}
+
+/* PUBLIC--
+ * Divide the rates among processes.
+ */
+void throttle_share(throttle_t *t, int shares) {
+	throttle_host_t *host;
+
+	if (shares <= 1)
+		return;
+	pthread_mutex_lock(&t->lock);
+	t->default_rate /= shares;
+	t->default_burst = t->default_burst / shares < 1 ? 1 : t->default_burst / shares;
+	for (host = t->hosts; host != NULL; host = host->next) {
+		host->rate /= shares;
+		host->burst = host->burst / shares < 1 ? 1 : host->burst / shares;
+		if (host->tokens > host->burst)
+			host->tokens = host->burst;
+	}
+	pthread_mutex_unlock(&t->lock);
+}
+
+/* PUBLIC--
+ * Format the rates as command line options.
+ */
+char *throttle_format_rates(const throttle_t *t) {
+	const throttle_host_t *host;
+	size_t size = 64, len;
+	char *buf;
+
+	for (host = t->hosts; host != NULL; host = host->next)
+		size += THROTTLE_HOST_SIZE + 64;
+	if ((buf = malloc(size)) == NULL)
+		return NULL;
+	buf[0] = 0;
+	if (t->default_rate > 0)
+		sprintf(buf, " --rate %.17g,%.17g", t->default_rate, t->default_burst);
+	for (host = t->hosts; host != NULL; host = host->next) {
+		if (host->configured) {
+			len = strlen(buf);
+			sprintf(buf + len, " --rate %s=%.17g,%.17g", host->name, host->rate, host->burst);
+		}
+	}
+	return buf;
+}
+
+/* PUBLIC--
+ * Wait for room in flight and a token of the host of the URL.
+ */
+void throttle_acquire(throttle_t *t, const char *url, throttle_ticket_t *ticket) {
+	char name[THROTTLE_HOST_SIZE];
+	throttle_host_t *host;
+	struct timespec until;
+	double time, wait;
+
+	host_of(url, name);
+	pthread_mutex_lock(&t->lock);
+	host = find_host(t, name);
+	for (;;) {
+		time = now();
+		if ((wait = admit(t, host, time)) == 0)
+			break;
+		if (wait < 0) {
+			pthread_cond_wait(&t->changed, &t->lock);
+		} else {
+			wait += time;
+			until.tv_sec = (time_t) wait;
+			until.tv_nsec = (long) ((wait - (double) until.tv_sec) * 1e9);
+			pthread_cond_timedwait(&t->changed, &t->lock, &until);
+		}
+	}
+	take(t, host, time, ticket);
+	pthread_mutex_unlock(&t->lock);
+}
+
+/* PUBLIC--
+ * Admit a request if it may be sent right away.
+ */
+int throttle_try_acquire(throttle_t *t, const char *url, throttle_ticket_t *ticket) {
+	char name[THROTTLE_HOST_SIZE];
+	throttle_host_t *host;
+	double time;
+	int retval = 1;
+
+	host_of(url, name);
+	pthread_mutex_lock(&t->lock);
+	host = find_host(t, name);
+	time = now();
+	if (admit(t, host, time) == 0) {
+		take(t, host, time, ticket);
+		retval = 0;
+	}
+	pthread_mutex_unlock(&t->lock);
+	return retval;
+}
+
+/* PUBLIC--
+ * Adapt the limit to the outcome of a request.
+ */
+void throttle_release(throttle_t *t, const throttle_ticket_t *ticket, int outcome, double retry_after) {
+	double time, latency;
+
+	pthread_mutex_lock(&t->lock);
+	time = now();
+	latency = time - ticket->start;
+	t->in_flight--;
+
+	if (outcome == THROTTLE_OK) {
+		/* requests queueing at the server take longer before they fail */
+		if (t->base_latency > 0 && latency > THROTTLE_SLOW * t->base_latency &&
+			latency - t->base_latency > THROTTLE_QUEUEING)
+			outcome = THROTTLE_OVERLOAD;
+		/* the shortest latency slowly follows longer ones, so a server that
+		 * became slower for good is not taken for an overloaded one */
+		if (t->base_latency == 0 || latency < t->base_latency)
+			t->base_latency = latency;
+		else
+			t->base_latency += (latency - t->base_latency) / THROTTLE_FORGET;
+
+		t->latencies[t->next_latency] = latency;
+		t->next_latency = (t->next_latency + 1) % THROTTLE_SAMPLES;
+		if (t->num_latencies < THROTTLE_SAMPLES)
+			t->num_latencies++;
+	}
+
+	if (outcome == THROTTLE_OVERLOAD) {
+		if (ticket->start >= t->last_decrease) {
+			t->limit *= THROTTLE_DECREASE;
+			if (t->limit < 1)
+				t->limit = 1;
+			t->decreased = 1;
+			t->last_decrease = time;
+		}
+	} else if (outcome == THROTTLE_OK) {
+		t->limit += t->decreased ? 1 / t->limit : 1;
+		if (t->limit > t->max_limit)
+			t->limit = t->max_limit;
+	}
+
+	if (retry_after > 0 && ticket->host != NULL && time + retry_after > ticket->host->paused_until)
+		ticket->host->paused_until = time + retry_after;
+
+	pthread_cond_broadcast(&t->changed);
+	pthread_mutex_unlock(&t->lock);
+}
+
+/* PUBLIC--
+ * Return a quantile of the recent latencies.
+ */
+double throttle_latency(throttle_t *t, double q) {
+	double sorted[THROTTLE_SAMPLES];
+	int n, i;
+
+	pthread_mutex_lock(&t->lock);
+	n = t->num_latencies;
+	memcpy(sorted, t->latencies, (size_t) n * sizeof(double));
+	pthread_mutex_unlock(&t->lock);
+
+	if (n < THROTTLE_MIN_SAMPLES)
+		return 0;
+	qsort(sorted, (size_t) n, sizeof(double), compare_doubles);
+	if ((i = (int) (q * n)) >= n)
+		i = n - 1;
+	return sorted[i];
+}
+
+/* PUBLIC--
+ * Return the number of requests allowed in flight.
+ */
+int throttle_limit(throttle_t *t) {
+	int limit;
+
+	pthread_mutex_lock(&t->lock);
+	limit = (int) t->limit;
+	pthread_mutex_unlock(&t->lock);
+	return limit;
+}
+
+/* PUBLIC--
+ * Free the throttle.
+ */
+void throttle_free(throttle_t *t) {
+	throttle_host_t *host, *next;
+
+	if (t == NULL)
+		return;
+	for (host = t->hosts; host != NULL; host = next) {
+		next = host->next;
+		free(host);
+	}
+	pthread_cond_destroy(&t->changed);
+	pthread_mutex_destroy(&t->lock);
+	free(t);
+}
+
+// EOF
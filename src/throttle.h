@@ -0,0 +1,135 @@
+/* throttle.h -- adaptive limits on the requests sent to the servers
+   Copyright 2016 Andrew Walton <dwalton64@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef Already_included_throttle_h
+#define Already_included_throttle_h 1
+
+#include <pthread.h>
+
+/* The number of requests in flight is adapted to the server with AIMD, like
+ * the congestion window of TCP. It starts at THROTTLE_INITIAL and grows by one
+ * for every response until the server first shows signs of overload, then by
+ * one for every limit responses (about one per round trip). A response of 429
+ * (Too Many Requests) or 5xx, a timeout or a failed connection, or a response
+ * taking more than THROTTLE_SLOW times the shortest recent one, halves the
+ * limit. Only requests sent after the last decrease can lower it again, so a
+ * burst of failures counts once.
+ *
+ * Independently, the requests to a host may be limited to a rate with a token
+ * bucket: a request takes a token, the tokens refill at rate per second and at
+ * most burst are saved up. A Retry-After of the server holds back every request
+ * to the host until then.
+ *
+ * The latencies of the last THROTTLE_SAMPLES answers are kept to tell how
+ * long requests usually take, e.g. when to hedge a slow one.
+ */
+#define THROTTLE_INITIAL   4
+#define THROTTLE_DECREASE  0.5
+#define THROTTLE_SLOW      3.0     // latency over the shortest one that counts as overload
+#define THROTTLE_QUEUEING  0.05    // seconds of extra latency that are never overload
+#define THROTTLE_FORGET    64      // responses over which the shortest latency is forgotten
+#define THROTTLE_HOST_SIZE 256
+#define THROTTLE_SAMPLES   256
+#define THROTTLE_MIN_SAMPLES 20    // answers before the latencies are trusted
+
+/* the outcome of a request, as far as the load of the server is concerned */
+#define THROTTLE_OK        0    // answered; slow answers still count as overload
+#define THROTTLE_OVERLOAD  1    // 429, 5xx, timeout or failed connection
+#define THROTTLE_NEUTRAL   2    // failed for other reasons (e.g. a bad URL)
+
+typedef struct throttle_host throttle_host_t;
+
+struct throttle_host {
+	char name[THROTTLE_HOST_SIZE];     // empty for URLs without a host, e.g. files
+	double rate;                       // requests per second, 0 for no limit
+	double burst;
+	double tokens;
+	double refilled;                   // time the tokens were last refilled
+	double paused_until;               // Retry-After of the server
+	int configured;                    // the rate was given for this host
+	throttle_host_t *next;
+};
+
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	double limit;                      // requests allowed in flight
+	int max_limit;
+	int in_flight;
+	int decreased;                     // the limit was lowered before (no more slow start)
+	double last_decrease;
+	double base_latency;               // shortest recent latency, 0 if none yet
+	double default_rate;               // of the hosts without a rate of their own
+	double default_burst;
+	throttle_host_t *hosts;
+	double latencies[THROTTLE_SAMPLES];   // ring of recent answers
+	int num_latencies;
+	int next_latency;
+} throttle_t;
+
+/* a request admitted by throttle_acquire() */
+typedef struct {
+	throttle_host_t *host;
+	double start;
+} throttle_ticket_t;
+
+/* a throttle without rates, letting any number of requests be in flight
+ * once the limit has grown. Returns NULL if out of memory.
+ */
+throttle_t *throttle_new(void);
+
+/* let at most max_limit requests be in flight at once (at least 1) */
+void throttle_set_max(throttle_t *t, int max_limit);
+
+/* Limit the rate of the requests to a host, from spec "[HOST=]RATE[,BURST]";
+ * without HOST the rate applies to every host not given a rate of its own.
+ * The burst defaults to the rate (at least 1).
+ * Returns 0 for success, 1 if spec is not valid (reported on stderr).
+ */
+int throttle_set_rate(throttle_t *t, const char *spec);
+
+/* Divide the rates among shares processes fetching at the same time */
+void throttle_share(throttle_t *t, int shares);
+
+/* the rates as --rate options for another process (e.g. " --rate 2,5"),
+ * empty if there are none. Returns NULL if out of memory; free() the result.
+ */
+char *throttle_format_rates(const throttle_t *t);
+
+/* wait until a request to url may be sent, and fill in the ticket */
+void throttle_acquire(throttle_t *t, const char *url, throttle_ticket_t *ticket);
+
+/* throttle_acquire() without waiting.
+ * Returns 0 if the request may be sent, 1 if not.
+ */
+int throttle_try_acquire(throttle_t *t, const char *url, throttle_ticket_t *ticket);
+
+/* The request of the ticket is done with outcome (THROTTLE_*); retry_after
+ * is the number of seconds the server asked to wait, 0 if none.
+ */
+void throttle_release(throttle_t *t, const throttle_ticket_t *ticket, int outcome, double retry_after);
+
+/* the latency in seconds below which a fraction q (e.g. 0.95) of the
+ * recent answers came, 0 if too few were seen */
+double throttle_latency(throttle_t *t, double q);
+
+/* requests currently allowed in flight */
+int throttle_limit(throttle_t *t);
+
+void throttle_free(throttle_t *t);
+
+#endif  /* End Include Guard - don't add code below */
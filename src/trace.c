@@ -0,0 +1,190 @@
+/* trace.c -- record what the threads spend their time on
+   Copyright 2016 Andrew Walton <dwalton64@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "trace.h"
+
+/* the spans of a thread; count is the number ever recorded */
+typedef struct trace_ring trace_ring_t;
+
+struct trace_ring {
+	trace_event_t *events;         // TRACE_RING_EVENTS
+	uint64_t count;
+	int tid;                       // numbered in order of creation, from 1
+	int in_use;                    // a running thread records into it
+	char name[TRACE_NAME_SIZE];
+	trace_ring_t *next;
+};
+
+int trace_enabled = 0;
+
+static uint64_t epoch;
+static pthread_key_t ring_key;
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static trace_ring_t *rings = NULL;
+static int num_rings = 0;
+static __thread trace_ring_t *my_ring = NULL;
+
+
+/* the thread owning the ring ended */
+static void release_ring(void *ring) {
+	pthread_mutex_lock(&rings_lock);
+	((trace_ring_t *) ring)->in_use = 0;
+	pthread_mutex_unlock(&rings_lock);
+}
+
+/* take over the ring of an ended thread called name, or add one
+ * returns NULL if out of memory */
+static trace_ring_t *acquire_ring(const char *name) {
+	trace_ring_t *ring, **tail;
+
+	pthread_mutex_lock(&rings_lock);
+	for (tail = &rings; (ring = *tail) != NULL; tail = &ring->next)
+		if (!ring->in_use && strcmp(ring->name, name) == 0)
+			break;
+	if (ring == NULL && (ring = calloc(1, sizeof(trace_ring_t))) != NULL) {
+		if ((ring->events = malloc(TRACE_RING_EVENTS * sizeof(trace_event_t))) == NULL) {
+			free(ring);
+			ring = NULL;
+		} else {
+			ring->tid = ++num_rings;
+			strncpy(ring->name, name, TRACE_NAME_SIZE - 1);
+			*tail = ring;
+		}
+	}
+	if (ring != NULL)
+		ring->in_use = 1;
+	pthread_mutex_unlock(&rings_lock);
+
+	if (ring != NULL)
+		pthread_setspecific(ring_key, ring);
+	return ring;
+}
+
+/* write s as a JSON string */
+static void write_string(FILE *fp, const char *s) {
+	fputc('"', fp);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\') fprintf(fp, "\\%c", *s);
+		else if ((unsigned char) *s < 0x20) fprintf(fp, "\\u%04x", *s);
+		else fputc(*s, fp);
+	}
+	fputc('"', fp);
+}
+
+
+/* PUBLIC--
+ * Return the time in nanoseconds.
+ */
+uint64_t trace_clock(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+/* PUBLIC--
+ * Record a span of the calling thread.
+ */
+void trace_record(const char *name, const char *arg, uint64_t start) {
+	trace_ring_t *ring = my_ring;
+	trace_event_t *ev;
+	uint64_t end = trace_clock();
+
+	if (ring == NULL && (ring = my_ring = acquire_ring("main")) == NULL)
+		return;
+	ev = &ring->events[ring->count % TRACE_RING_EVENTS];
+	ev->name = name;
+	strncpy(ev->arg, arg != NULL ? arg : "", TRACE_ARG_SIZE - 1);
+	ev->arg[TRACE_ARG_SIZE - 1] = 0;
+	ev->start = start - epoch;
+	ev->duration = end - start;
+	ring->count++;
+}
+
+/* PUBLIC--
+ * Start recording.
+ */
+void trace_start(void) {
+	if (trace_enabled)
+		return;
+	pthread_key_create(&ring_key, release_ring);
+	epoch = trace_clock();
+	trace_enabled = 1;
+}
+
+/* PUBLIC--
+ * Name the calling thread.
+ */
+void trace_thread(const char *name) {
+	if (!trace_enabled || (my_ring != NULL && strcmp(my_ring->name, name) == 0))
+		return;
+	if (my_ring != NULL)
+		release_ring(my_ring);
+	my_ring = acquire_ring(name);
+}
+
+/* PUBLIC--
+ * Write the spans as a JSON object of Chrome trace events.
+ */
+int trace_write(const char *filename) {
+	const trace_ring_t *ring;
+	const trace_event_t *ev;
+	uint64_t i, first, dropped = 0;
+	long pid = (long) getpid();
+	const char *sep = "";
+	FILE *fp;
+
+	if ((fp = fopen(filename, "w")) == NULL) {
+		perror(filename);
+		return 1;
+	}
+	fprintf(fp, "{\"traceEvents\":[");
+	for (ring = rings; ring != NULL; ring = ring->next) {
+		fprintf(fp, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%ld,\"tid\":%d,\"args\":{\"name\":",
+				sep, pid, ring->tid);
+		write_string(fp, ring->name);
+		fprintf(fp, "}}");
+		sep = ",";
+
+		first = ring->count > TRACE_RING_EVENTS ? ring->count - TRACE_RING_EVENTS : 0;
+		dropped += first;
+		for (i = first; i < ring->count; i++) {
+			ev = &ring->events[i % TRACE_RING_EVENTS];
+			/* timestamps are in microseconds */
+			fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"metar\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+					"\"pid\":%ld,\"tid\":%d,\"args\":{\"arg\":", ev->name,
+					ev->start / 1e3, ev->duration / 1e3, pid, ring->tid);
+			write_string(fp, ev->arg);
+			fprintf(fp, "}}");
+		}
+	}
+	fprintf(fp, "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped\":%llu}}\n",
+			(unsigned long long) dropped);
+	if (fclose(fp) != 0) {
+		perror(filename);
+		return 1;
+	}
+	return 0;
+}
+
+// EOF
@@ -0,0 +1,80 @@
+/* trace.h -- record what the threads spend their time on
+   Copyright 2016 Andrew Walton <dwalton64@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef Already_included_trace_h
+#define Already_included_trace_h 1
+
+#include <stdint.h>
+
+/* A span of work (a download, a parse, ...) is timed with
+ *
+ *     uint64_t start = trace_begin();
+ *     ...
+ *     trace_end("download", station, start);
+ *
+ * which costs a test of trace_enabled while tracing is off. Every thread
+ * records its spans into a ring of its own, without locks; once the ring is
+ * full the oldest spans are overwritten. The ring of a thread that ended is
+ * taken over by the next thread with the same name, so threads started for
+ * every poll do not pile up rings.
+ *
+ * trace_write() saves the spans in the trace event format of Chrome, which
+ * chrome://tracing and https://ui.perfetto.dev show as a timeline per thread.
+ * It must not run while other threads are still recording.
+ */
+#define TRACE_RING_EVENTS 16384
+#define TRACE_ARG_SIZE    16
+#define TRACE_NAME_SIZE   16
+
+typedef struct {
+	const char *name;             // a string constant
+	char arg[TRACE_ARG_SIZE];     // e.g. the station, truncated
+	uint64_t start;               // nanoseconds since trace_start()
+	uint64_t duration;
+} trace_event_t;
+
+/* set by trace_start(), before any threads are started */
+extern int trace_enabled;
+
+/* nanoseconds on the monotonic clock */
+uint64_t trace_clock(void);
+
+/* record a span that began at start and ends now */
+void trace_record(const char *name, const char *arg, uint64_t start);
+
+static inline uint64_t trace_begin(void) {
+	return trace_enabled ? trace_clock() : 0;
+}
+
+static inline void trace_end(const char *name, const char *arg, uint64_t start) {
+	if (trace_enabled)
+		trace_record(name, arg, start);
+}
+
+/* start recording */
+void trace_start(void);
+
+/* name the calling thread in the trace (e.g. "fetch"); threads that do not
+ * name themselves are called "main" */
+void trace_thread(const char *name);
+
+/* Write the spans recorded so far to filename as Chrome trace events.
+ * Returns 0 for success, 1 for an error (reported on stderr).
+ */
+int trace_write(const char *filename);
+
+#endif  /* End Include Guard - don't add code below */